@@ -0,0 +1,513 @@
+/**
+ * @file blinkdb_bench.cpp
+ * @brief Multi-threaded, pipelined RESP load generator in the spirit of redis-benchmark and memtier.
+ *
+ * Each thread drives its share of the connections from one epoll loop,
+ * keeping up to --pipeline requests in flight per connection. Latency is
+ * measured per request from the moment it is queued for sending until its
+ * reply has been parsed, and recorded into per-thread LatencyHistograms
+ * that are merged for the report.
+ */
+#include "byte_buffer.h"
+#include "latency_histogram.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BENCH_READ_SIZE (64 * 1024)
+#define BENCH_MAX_EVENTS 256
+
+struct BenchOptions {
+    std::string host = "127.0.0.1";
+    uint16_t port = 9001;
+    size_t threads = 4;
+    size_t connections = 50;  ///< Total, spread over the threads.
+    size_t pipeline = 1;      ///< Requests in flight per connection.
+    uint64_t requests = 1000000;
+    double duration = 0;      ///< Seconds; when set, runs for this long instead of a request count.
+    uint64_t keyspace = 100000;
+    std::string key_prefix = "key:";
+    bool sequential = false;  ///< Walk the keyspace in order instead of picking keys uniformly.
+    size_t value_min = 32;
+    size_t value_max = 32;
+    unsigned set_ratio = 1;
+    unsigned get_ratio = 10;
+    bool preload = false;
+    uint64_t seed = 1;
+};
+
+/**
+ * @brief What one thread sends: its key range, mix and budget.
+ */
+struct Workload {
+    uint64_t first_key;
+    uint64_t key_count;
+    bool sequential;
+    unsigned set_ratio;
+    unsigned get_ratio;
+    uint64_t requests;  ///< UINT64_MAX when bounded by deadline instead.
+    std::chrono::steady_clock::time_point deadline;
+};
+
+struct ThreadStats {
+    LatencyHistogram get_latency;
+    LatencyHistogram set_latency;
+    uint64_t get_misses = 0;
+    uint64_t errors = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    std::string first_error;
+};
+
+static uint64_t nowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @brief Length of the first complete RESP reply in data, or 0 if more bytes are needed.
+ * @throws std::runtime_error on bytes that are not RESP.
+ */
+static size_t replyLength(const char* data, size_t size, bool& miss, bool& error) {
+    if (size == 0) return 0;
+    const char* lf = static_cast<const char*>(std::memchr(data, '\n', size));
+    if (lf == nullptr) return 0;
+    const size_t header = static_cast<size_t>(lf - data) + 1;
+
+    switch (data[0]) {
+        case '+':
+        case ':':
+            return header;
+        case '-':
+            error = true;
+            return header;
+        case '$':
+        case '*': {
+            long long length = 0;
+            const auto parsed = std::from_chars(data + 1, lf - 1, length);
+            if (parsed.ec != std::errc() || parsed.ptr != lf - 1) throw std::runtime_error("malformed RESP length");
+            if (length < 0) {
+                miss = data[0] == '$';
+                return header;
+            }
+            if (data[0] == '$') {
+                const size_t total = header + static_cast<size_t>(length) + 2;
+                return size >= total ? total : 0;
+            }
+            size_t total = header;
+            for (long long i = 0; i < length; ++i) {
+                bool ignored_miss = false;
+                const size_t element = replyLength(data + total, size - total, ignored_miss, error);
+                if (element == 0) return 0;
+                total += element;
+            }
+            return total;
+        }
+        default:
+            throw std::runtime_error("unexpected reply byte '" + std::string(1, data[0]) + "'");
+    }
+}
+
+static void appendBulk(std::string& out, std::string_view bytes) {
+    char header[24];
+    header[0] = '$';
+    char* end = std::to_chars(header + 1, header + sizeof(header) - 2, bytes.size()).ptr;
+    *end++ = '\r';
+    *end++ = '\n';
+    out.append(header, static_cast<size_t>(end - header));
+    out.append(bytes);
+    out.append("\r\n", 2);
+}
+
+static int connectTo(const BenchOptions& options) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    const std::string port = std::to_string(options.port);
+    const int rc = getaddrinfo(options.host.c_str(), port.c_str(), &hints, &result);
+    if (rc != 0) throw std::runtime_error("cannot resolve " + options.host + ": " + gai_strerror(rc));
+
+    int fd = -1;
+    int err = 0;
+    for (addrinfo* ai = result; ai != nullptr && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            err = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (fd == -1) throw std::system_error(err, std::system_category(), "connect " + options.host + ":" + port);
+
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+/**
+ * @class BenchThread
+ * @brief Runs a Workload over a set of connections from one epoll loop.
+ */
+class BenchThread {
+public:
+    BenchThread(const BenchOptions& options, size_t connections, uint64_t seed)
+        : options_(options), rng_(seed), value_(options.value_max, 'x') {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ == -1) throw std::system_error(errno, std::system_category(), "epoll_create1");
+        connections_.resize(connections);
+        for (size_t i = 0; i < connections; ++i) {
+            connections_[i].fd = connectTo(options);
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = i;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connections_[i].fd, &event);
+        }
+    }
+
+    BenchThread(const BenchThread&) = delete;
+    BenchThread& operator=(const BenchThread&) = delete;
+
+    ~BenchThread() {
+        for (const Connection& conn : connections_) close(conn.fd);
+        if (epoll_fd_ != -1) close(epoll_fd_);
+    }
+
+    /**
+     * @brief Sends the workload and waits for every reply.
+     */
+    void run(const Workload& workload) {
+        workload_ = workload;
+        issued_ = 0;
+        next_key_ = 0;
+        for (size_t i = 0; i < connections_.size(); ++i) {
+            while (connections_[i].inflight.size() < options_.pipeline && issue(connections_[i])) {}
+            flush(i);
+        }
+
+        epoll_event events[BENCH_MAX_EVENTS];
+        while (inflight_ > 0) {
+            const int count = epoll_wait(epoll_fd_, events, BENCH_MAX_EVENTS, 1000);
+            if (count == -1) {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::system_category(), "epoll_wait");
+            }
+            for (int e = 0; e < count; ++e) {
+                const size_t i = static_cast<size_t>(events[e].data.u64);
+                if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) receive(i);
+                flush(i);
+            }
+        }
+    }
+
+    ThreadStats& stats() noexcept { return stats_; }
+
+private:
+    struct Pending {
+        uint64_t sent_ns;
+        bool get;
+    };
+
+    struct Connection {
+        int fd = -1;
+        std::string output;
+        size_t output_sent = 0;
+        bool write_armed = false;
+        ByteBuffer input;
+        std::deque<Pending> inflight;
+    };
+
+    const BenchOptions& options_;
+    std::mt19937_64 rng_;
+    std::string value_;
+    std::string key_;
+    int epoll_fd_ = -1;
+    std::vector<Connection> connections_;
+    Workload workload_{};
+    uint64_t issued_ = 0;
+    uint64_t next_key_ = 0;
+    size_t inflight_ = 0;
+    ThreadStats stats_;
+
+    /**
+     * @brief Queues one more request on conn unless the workload is exhausted.
+     */
+    bool issue(Connection& conn) {
+        if (issued_ >= workload_.requests) return false;
+        if (workload_.requests == UINT64_MAX && (issued_ & 63) == 0 &&
+            std::chrono::steady_clock::now() >= workload_.deadline) {
+            workload_.requests = issued_;
+            return false;
+        }
+        ++issued_;
+
+        const uint64_t key = workload_.first_key +
+                             (workload_.sequential ? next_key_++ % workload_.key_count : rng_() % workload_.key_count);
+        key_ = options_.key_prefix;
+        key_ += std::to_string(key);
+
+        const bool get = rng_() % (workload_.set_ratio + workload_.get_ratio) >= workload_.set_ratio;
+        if (get) {
+            conn.output.append("*2\r\n$3\r\nGET\r\n", 13);
+            appendBulk(conn.output, key_);
+        } else {
+            const size_t length = options_.value_min + rng_() % (options_.value_max - options_.value_min + 1);
+            conn.output.append("*3\r\n$3\r\nSET\r\n", 13);
+            appendBulk(conn.output, key_);
+            appendBulk(conn.output, std::string_view(value_).substr(0, length));
+        }
+        conn.inflight.push_back({nowNs(), get});
+        ++inflight_;
+        return true;
+    }
+
+    void flush(size_t index) {
+        Connection& conn = connections_[index];
+        while (conn.output_sent < conn.output.size()) {
+            const ssize_t sent = send(conn.fd, conn.output.data() + conn.output_sent,
+                                      conn.output.size() - conn.output_sent, MSG_NOSIGNAL);
+            if (sent == -1) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                throw std::system_error(errno, std::system_category(), "send");
+            }
+            conn.output_sent += static_cast<size_t>(sent);
+            stats_.bytes_sent += static_cast<uint64_t>(sent);
+        }
+        if (conn.output_sent == conn.output.size()) {
+            conn.output.clear();
+            conn.output_sent = 0;
+        }
+
+        const bool want_write = !conn.output.empty();
+        if (want_write != conn.write_armed) {
+            epoll_event event{};
+            event.events = EPOLLIN | (want_write ? EPOLLOUT : 0u);
+            event.data.u64 = index;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &event);
+            conn.write_armed = want_write;
+        }
+    }
+
+    void receive(size_t index) {
+        Connection& conn = connections_[index];
+        while (true) {
+            char* target = conn.input.prepare(BENCH_READ_SIZE);
+            const ssize_t received = read(conn.fd, target, conn.input.writable());
+            if (received == 0) throw std::runtime_error("server closed the connection");
+            if (received == -1) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                throw std::system_error(errno, std::system_category(), "read");
+            }
+            conn.input.commit(static_cast<size_t>(received));
+            stats_.bytes_received += static_cast<uint64_t>(received);
+        }
+
+        const uint64_t now = nowNs();
+        const std::string_view input = conn.input.view();
+        size_t pos = 0;
+        while (!conn.inflight.empty()) {
+            bool miss = false;
+            bool error = false;
+            const size_t length = replyLength(input.data() + pos, input.size() - pos, miss, error);
+            if (length == 0) break;
+
+            const Pending request = conn.inflight.front();
+            conn.inflight.pop_front();
+            --inflight_;
+            (request.get ? stats_.get_latency : stats_.set_latency).record(now - request.sent_ns);
+            if (miss) ++stats_.get_misses;
+            if (error) {
+                if (stats_.errors++ == 0) stats_.first_error.assign(input.substr(pos + 1, length - 3));
+            }
+            pos += length;
+            issue(conn);
+        }
+        conn.input.consume(pos);
+    }
+};
+
+static void parseRange(const std::string& text, size_t& low, size_t& high) {
+    const size_t dash = text.find('-');
+    low = std::stoul(text.substr(0, dash));
+    high = dash == std::string::npos ? low : std::stoul(text.substr(dash + 1));
+    if (high < low) throw std::invalid_argument("empty range '" + text + "'");
+}
+
+static void parseRatio(const std::string& text, unsigned& set_ratio, unsigned& get_ratio) {
+    const size_t colon = text.find(':');
+    if (colon == std::string::npos) throw std::invalid_argument("--ratio must be SET:GET, e.g. 1:10");
+    set_ratio = static_cast<unsigned>(std::stoul(text.substr(0, colon)));
+    get_ratio = static_cast<unsigned>(std::stoul(text.substr(colon + 1)));
+    if (set_ratio + get_ratio == 0) throw std::invalid_argument("--ratio must not be 0:0");
+}
+
+static void printRow(const char* name, const LatencyHistogram& latency, double seconds) {
+    auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    std::printf("%-6s %12lu %12.0f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+                static_cast<unsigned long>(latency.count()), static_cast<double>(latency.count()) / seconds,
+                latency.mean() / 1000.0, us(latency.percentile(50)), us(latency.percentile(99)),
+                us(latency.percentile(99.9)), us(latency.percentile(99.99)), us(latency.max()));
+}
+
+/**
+ * @brief Runs a workload on every thread at once.
+ * @return Wall-clock seconds until the last reply arrived.
+ */
+static double runAll(std::vector<std::unique_ptr<BenchThread>>& threads, const std::vector<Workload>& workloads) {
+    std::vector<std::thread> running;
+    std::vector<std::exception_ptr> failures(threads.size());
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < threads.size(); ++t) {
+        running.emplace_back([&, t] {
+            try {
+                threads[t]->run(workloads[t]);
+            } catch (...) {
+                failures[t] = std::current_exception();
+            }
+        });
+    }
+    for (auto& thread : running) thread.join();
+    for (const auto& failure : failures) {
+        if (failure) std::rethrow_exception(failure);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    try {
+        BenchOptions options;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_value = i + 1 < argc;
+            if (arg == "--host" && has_value) {
+                options.host = argv[++i];
+            } else if (arg == "--port" && has_value) {
+                options.port = static_cast<uint16_t>(std::stoul(argv[++i]));
+            } else if (arg == "--threads" && has_value) {
+                options.threads = std::max<size_t>(1, std::stoul(argv[++i]));
+            } else if (arg == "--connections" && has_value) {
+                options.connections = std::max<size_t>(1, std::stoul(argv[++i]));
+            } else if (arg == "--pipeline" && has_value) {
+                options.pipeline = std::max<size_t>(1, std::stoul(argv[++i]));
+            } else if (arg == "--requests" && has_value) {
+                options.requests = std::stoull(argv[++i]);
+            } else if (arg == "--duration" && has_value) {
+                options.duration = std::stod(argv[++i]);
+            } else if (arg == "--keyspace" && has_value) {
+                options.keyspace = std::max<uint64_t>(1, std::stoull(argv[++i]));
+            } else if (arg == "--key-prefix" && has_value) {
+                options.key_prefix = argv[++i];
+            } else if (arg == "--key-pattern" && has_value) {
+                const std::string pattern = argv[++i];
+                if (pattern != "random" && pattern != "sequential") {
+                    throw std::invalid_argument("--key-pattern must be random or sequential");
+                }
+                options.sequential = pattern == "sequential";
+            } else if (arg == "--value-size" && has_value) {
+                parseRange(argv[++i], options.value_min, options.value_max);
+            } else if (arg == "--ratio" && has_value) {
+                parseRatio(argv[++i], options.set_ratio, options.get_ratio);
+            } else if (arg == "--preload") {
+                options.preload = true;
+            } else if (arg == "--seed" && has_value) {
+                options.seed = std::stoull(argv[++i]);
+            } else {
+                std::cerr << "Usage: " << argv[0] << " [--host H] [--port P] [--threads N] [--connections N]"
+                          << " [--pipeline N] [--requests N | --duration SECONDS] [--keyspace N]"
+                          << " [--key-prefix S] [--key-pattern random|sequential] [--value-size N|MIN-MAX]"
+                          << " [--ratio SET:GET] [--preload] [--seed N]" << std::endl;
+                return 1;
+            }
+        }
+        options.connections = std::max(options.connections, options.threads);
+
+        std::vector<std::unique_ptr<BenchThread>> threads;
+        for (size_t t = 0; t < options.threads; ++t) {
+            const size_t connections = options.connections / options.threads + (t < options.connections % options.threads);
+            threads.push_back(std::make_unique<BenchThread>(options, connections, options.seed * 7919 + t));
+        }
+
+        std::vector<Workload> workloads(options.threads);
+        if (options.preload) {
+            for (size_t t = 0; t < options.threads; ++t) {
+                const uint64_t first = options.keyspace * t / options.threads;
+                const uint64_t last = options.keyspace * (t + 1) / options.threads;
+                workloads[t] = {first, std::max<uint64_t>(last - first, 1), true, 1, 0, last - first, {}};
+            }
+            const double seconds = runAll(threads, workloads);
+            std::printf("Preloaded %lu keys in %.2f s\n", static_cast<unsigned long>(options.keyspace), seconds);
+            for (auto& thread : threads) thread->stats() = ThreadStats();
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() +
+                              std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(options.duration));
+        for (size_t t = 0; t < options.threads; ++t) {
+            const uint64_t share = options.requests / options.threads + (t < options.requests % options.threads);
+            workloads[t] = {0, options.keyspace, options.sequential, options.set_ratio, options.get_ratio,
+                            options.duration > 0 ? UINT64_MAX : share, deadline};
+        }
+
+        std::printf("%zu threads, %zu connections, pipeline %zu, keyspace %lu, values %zu-%zu bytes, SET:GET %u:%u\n",
+                    options.threads, options.connections, options.pipeline,
+                    static_cast<unsigned long>(options.keyspace), options.value_min, options.value_max,
+                    options.set_ratio, options.get_ratio);
+        const double seconds = runAll(threads, workloads);
+
+        ThreadStats total;
+        for (auto& thread : threads) {
+            const ThreadStats& stats = thread->stats();
+            total.get_latency.merge(stats.get_latency);
+            total.set_latency.merge(stats.set_latency);
+            total.get_misses += stats.get_misses;
+            total.errors += stats.errors;
+            total.bytes_sent += stats.bytes_sent;
+            total.bytes_received += stats.bytes_received;
+            if (total.first_error.empty()) total.first_error = stats.first_error;
+        }
+        LatencyHistogram all;
+        all.merge(total.get_latency);
+        all.merge(total.set_latency);
+
+        std::printf("\n%-6s %12s %12s %9s %9s %9s %9s %9s %9s\n", "Type", "Ops", "Ops/sec", "Avg(us)", "p50",
+                    "p99", "p99.9", "p99.99", "Max");
+        printRow("GET", total.get_latency, seconds);
+        printRow("SET", total.set_latency, seconds);
+        printRow("Total", all, seconds);
+        std::printf("\n%.2f s, GET misses %lu, errors %lu, %.1f MB/s out, %.1f MB/s in\n", seconds,
+                    static_cast<unsigned long>(total.get_misses), static_cast<unsigned long>(total.errors),
+                    static_cast<double>(total.bytes_sent) / seconds / 1e6,
+                    static_cast<double>(total.bytes_received) / seconds / 1e6);
+        if (total.errors) std::printf("First error: %s\n", total.first_error.c_str());
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
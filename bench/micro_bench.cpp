@@ -0,0 +1,193 @@
+/**
+ * @file micro_bench.cpp
+ * @brief In-process microbenchmarks for the RESP parser, command handler and KVStore.
+ *
+ * Every case runs --rounds times over the same prepared inputs and reports
+ * the fastest round, which filters out scheduler noise better than a mean.
+ * Multi-threaded cases start their threads together and time until the
+ * last one finishes.
+ */
+#include "kv_store.h"
+#include "proto_handler.h"
+#include "resp_parser.h"
+#include "byte_buffer.h"
+#include "qsbr.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct MicroOptions {
+    size_t keys = 1000000;
+    size_t value_size = 32;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t rounds = 3;
+    std::string filter;
+};
+
+static std::atomic<uint64_t> sink{0};
+
+/**
+ * @brief Times body(thread_index) on threads threads at once; reports the best of several rounds.
+ * @param ops Operations one round performs across all threads.
+ * @param setup Untimed preparation run before each round.
+ */
+static void runCase(const MicroOptions& options, const std::string& name, size_t threads, uint64_t ops,
+                    const std::function<void(size_t)>& body, const std::function<void()>& setup = {}) {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return;
+
+    double best = 1e300;
+    for (size_t round = 0; round < options.rounds; ++round) {
+        if (setup) setup();
+        std::atomic<size_t> ready{0};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; ++t) {
+            pool.emplace_back([&, t] {
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+                body(t);
+            });
+        }
+        while (ready.load() + 1 < threads) std::this_thread::yield();
+
+        const auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        body(0);
+        for (auto& thread : pool) thread.join();
+        best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::printf("%-34s %3zu thr %12.1f ns/op %10.2f Mops/s\n", name.c_str(), threads, best * threads / ops,
+                ops / best * 1e3);
+}
+
+static std::string makeKey(size_t i) { return "key:" + std::to_string(i); }
+
+static void appendCommand(std::string& out, std::initializer_list<std::string_view> args) {
+    out += "*" + std::to_string(args.size()) + "\r\n";
+    for (std::string_view arg : args) {
+        out += "$" + std::to_string(arg.size()) + "\r\n";
+        out.append(arg);
+        out += "\r\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    MicroOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--keys" && i + 1 < argc) {
+            options.keys = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--value-size" && i + 1 < argc) {
+            options.value_size = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--rounds" && i + 1 < argc) {
+            options.rounds = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--keys N] [--value-size N] [--threads N] [--rounds N] [--filter SUBSTRING]" << std::endl;
+            return 1;
+        }
+    }
+
+    const std::string value(options.value_size, 'v');
+    std::vector<std::string> keys;
+    keys.reserve(options.keys);
+    for (size_t i = 0; i < options.keys; ++i) keys.push_back(makeKey(i));
+
+    // Lookups visit keys in a fixed scrambled order so every case misses the cache alike.
+    std::vector<uint32_t> order(options.keys);
+    for (size_t i = 0; i < options.keys; ++i) order[i] = static_cast<uint32_t>(i);
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+    // Parser and handler inputs: one pipelined buffer of 10k commands.
+    constexpr size_t kBatch = 10000;
+    std::string gets, sets;
+    for (size_t i = 0; i < kBatch; ++i) {
+        appendCommand(gets, {"GET", keys[order[i % options.keys]]});
+        appendCommand(sets, {"SET", keys[order[i % options.keys]], value});
+    }
+
+    runCase(options, "RESPParser::parseCommand GET", 1, kBatch * 20, [&](size_t) {
+        RESPCommand command;
+        for (int repeat = 0; repeat < 20; ++repeat) {
+            size_t pos = 0;
+            while (pos < gets.size()) RESPParser::parseCommand(gets, pos, command);
+            sink += command.size();
+        }
+    });
+    runCase(options, "RESPParser::parseCommand SET", 1, kBatch * 20, [&](size_t) {
+        RESPCommand command;
+        for (int repeat = 0; repeat < 20; ++repeat) {
+            size_t pos = 0;
+            while (pos < sets.size()) RESPParser::parseCommand(sets, pos, command);
+            sink += command.size();
+        }
+    });
+
+    KVStore store(DEFAULT_SHARD_COUNT, false);
+    runCase(options, "KVStore::set insert", 1, options.keys, [&](size_t) {
+        for (size_t i = 0; i < options.keys; ++i) store.set(keys[order[i]], value);
+    }, [&] { store.clear(); });
+    runCase(options, "KVStore::set overwrite", 1, options.keys, [&](size_t) {
+        for (size_t i = 0; i < options.keys; ++i) store.set(keys[order[i]], value);
+    });
+
+    const uint64_t lookups = std::min<uint64_t>(options.keys, 1000000);
+    auto getCase = [&](const std::string& name, size_t threads, bool optimistic, bool hit) {
+        runCase(options, name, threads, lookups * threads, [&, optimistic, hit](size_t t) {
+            if (optimistic) Qsbr::registerThread();
+            std::string miss_key = "absent:";
+            uint64_t bytes = 0;
+            for (uint64_t n = 0; n < lookups; ++n) {
+                const std::string& key = hit ? keys[order[(n + t * 7919) % options.keys]] : miss_key;
+                auto copy = [&](std::string_view v) { bytes += v.size(); return true; };
+                if (!optimistic || store.readOptimistic(key, copy) == ReadStatus::Fallback) {
+                    store.read(key, [&](const Record& record) { bytes += record.value_size; });
+                }
+                if (optimistic && (n & 63) == 0) Qsbr::quiescent();
+            }
+            sink += bytes;
+            if (optimistic) Qsbr::unregisterThread();
+        });
+    };
+    getCase("KVStore::read hit", 1, false, true);
+    getCase("KVStore::readOptimistic hit", 1, true, true);
+    getCase("KVStore::read miss", 1, false, false);
+    getCase("KVStore::readOptimistic miss", 1, true, false);
+    if (options.threads > 1) {
+        getCase("KVStore::read hit", options.threads, false, true);
+        getCase("KVStore::readOptimistic hit", options.threads, true, true);
+    }
+
+    RedisProtocolHandler handler(store);
+    runCase(options, "RedisProtocolHandler GET pipeline", 1, kBatch * 20, [&](size_t) {
+        Qsbr::registerThread();
+        ByteBuffer output;
+        for (int repeat = 0; repeat < 20; ++repeat) {
+            handler.handle_requests(gets, output);
+            sink += output.size();
+            output.clear();
+            Qsbr::quiescent();
+        }
+        Qsbr::unregisterThread();
+    });
+    runCase(options, "RedisProtocolHandler SET pipeline", 1, kBatch * 20, [&](size_t) {
+        ByteBuffer output;
+        for (int repeat = 0; repeat < 20; ++repeat) {
+            handler.handle_requests(sets, output);
+            sink += output.size();
+            output.clear();
+        }
+    });
+    return 0;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file parser_fuzz.cpp
+ * @brief Differential fuzz of RESPParser::parseCommand against the memchr()/from_chars() parser it replaced.
+ *
+ * Frames are generated well-formed, then truncated at a random byte or
+ * mutated by flipping, inserting or deleting bytes, mostly inside the
+ * length headers. Both parsers must agree on the status, the consumed
+ * length and every argument.
+ *
+ * The reference differs from the old parser in one deliberate way: a
+ * length header over 20 bytes is invalid even when its CR has arrived
+ * (the old parser only gave up on one that had not, so a zero-padded
+ * header of any size was accepted). The one accepted difference is a
+ * length that can never become valid (a non-digit, or more bytes than
+ * that limit): the current parser rejects it as soon as the byte arrives,
+ * the old one only once a CR did. That case is checked by giving the old
+ * parser the CRLF it was waiting for. Run with `make check`.
+ */
+#include "resp_parser.h"
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using ParseStatus = RESPParser::ParseStatus;
+
+struct FuzzOptions {
+    uint64_t cases = 2000000;
+    uint64_t seed = 1;
+};
+
+/**
+ * @brief The parser before lengths were decoded while scanning for CR, kept as the reference.
+ */
+struct ReferenceParser {
+    static ParseStatus parseLength(std::string_view input, size_t& p, int64_t& length) {
+        const void* cr = std::memchr(input.data() + p, '\r', input.size() - p);
+        if (cr == nullptr) {
+            return input.size() - p > 20 ? ParseStatus::Invalid : ParseStatus::Incomplete;
+        }
+        const size_t end = static_cast<const char*>(cr) - input.data();
+        if (end - p > 20) return ParseStatus::Invalid;
+        if (end + 1 >= input.size()) return ParseStatus::Incomplete;
+        if (input[end + 1] != '\n') return ParseStatus::Invalid;
+
+        const auto [ptr, ec] = std::from_chars(input.data() + p, input.data() + end, length);
+        if (ec != std::errc() || ptr != input.data() + end) return ParseStatus::Invalid;
+        p = end + 2;
+        return ParseStatus::Complete;
+    }
+
+    static ParseStatus parseCommand(std::string_view input, size_t& pos, std::vector<std::string_view>& args) {
+        args.clear();
+        size_t p = pos;
+        if (p >= input.size()) return ParseStatus::Incomplete;
+        if (input[p++] != '*') return ParseStatus::Invalid;
+
+        int64_t count;
+        ParseStatus status = parseLength(input, p, count);
+        if (status != ParseStatus::Complete) return status;
+        if (count > RESPParser::kMaxArgs) return ParseStatus::Invalid;
+
+        for (int64_t i = 0; i < count; ++i) {
+            if (p >= input.size()) return ParseStatus::Incomplete;
+            const char prefix = input[p++];
+            if (prefix == '$') {
+                int64_t length;
+                status = parseLength(input, p, length);
+                if (status != ParseStatus::Complete) return status;
+                if (length < 0 || length > RESPParser::kMaxBulkLength) return ParseStatus::Invalid;
+
+                const size_t len = static_cast<size_t>(length);
+                if (input.size() - p < len + 2) return ParseStatus::Incomplete;
+                if (input[p + len] != '\r' || input[p + len + 1] != '\n') return ParseStatus::Invalid;
+                args.push_back(input.substr(p, len));
+                p += len + 2;
+            } else if (prefix == '+') {
+                const size_t end = input.find("\r\n", p);
+                if (end == std::string_view::npos) return ParseStatus::Incomplete;
+                args.push_back(input.substr(p, end - p));
+                p = end + 2;
+            } else {
+                return ParseStatus::Invalid;
+            }
+        }
+        pos = p;
+        return ParseStatus::Complete;
+    }
+};
+
+static const char* statusName(ParseStatus status) {
+    switch (status) {
+        case ParseStatus::Complete: return "Complete";
+        case ParseStatus::Incomplete: return "Incomplete";
+        default: return "Invalid";
+    }
+}
+
+/**
+ * @brief A length header body: usually a plain count, sometimes long, signed or padded.
+ */
+static std::string lengthText(std::mt19937_64& rng, size_t value) {
+    switch (rng() % 16) {
+        case 0: return std::string(1 + rng() % 21, static_cast<char>('0' + rng() % 10));
+        case 1: return "-" + (rng() % 2 ? std::to_string(rng() % 3) : std::to_string(rng() >> (rng() % 64)));
+        case 2: return std::string(1 + rng() % 24, '0') + std::to_string(value);
+        case 3: return std::to_string(rng() >> (rng() % 64));
+        default: return std::to_string(value);
+    }
+}
+
+/**
+ * @brief A well-formed command frame of bulk (and occasionally simple) strings.
+ */
+static std::string makeFrame(std::mt19937_64& rng) {
+    const size_t count = rng() % 10 == 0 ? rng() % 20 : 1 + rng() % 4;
+    std::string frame = "*" + lengthText(rng, count) + "\r\n";
+    for (size_t i = 0; i < count; ++i) {
+        const size_t length = rng() % 8 == 0 ? rng() % 300 : rng() % 12;
+        std::string arg(length, 'v');
+        for (char& c : arg) c = static_cast<char>(rng() % 4 == 0 ? "\r\n$*+-0"[rng() % 7] : 'a' + rng() % 26);
+        if (rng() % 16 == 0 && arg.find("\r\n") == std::string::npos) {
+            frame += "+" + arg + "\r\n";
+        } else {
+            frame += "$" + lengthText(rng, length) + "\r\n" + arg + "\r\n";
+        }
+    }
+    return frame;
+}
+
+/**
+ * @brief Flips, inserts or deletes a byte, mostly near a header so lengths and CRLFs get hit.
+ */
+static void mutate(std::mt19937_64& rng, std::string& frame) {
+    if (frame.empty()) return;
+    size_t at = rng() % frame.size();
+    if (rng() % 2 == 0) {
+        const size_t header = frame.find_first_of("*$", at);
+        if (header != std::string::npos) at = std::min(frame.size() - 1, header + 1 + rng() % 4);
+    }
+    static constexpr char kBytes[] = "0123456789-+\r\n$*x ";
+    const char byte = rng() % 8 == 0 ? static_cast<char>(rng()) : kBytes[rng() % (sizeof(kBytes) - 1)];
+    switch (rng() % 3) {
+        case 0: frame[at] = byte; break;
+        case 1: frame.insert(frame.begin() + static_cast<std::ptrdiff_t>(at), byte); break;
+        default: frame.erase(at, 1); break;
+    }
+}
+
+int main(int argc, char** argv) {
+    FuzzOptions options;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--cases") == 0 && i + 1 < argc) {
+            options.cases = std::stoull(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = std::stoull(argv[++i]);
+        } else {
+            std::fprintf(stderr, "Usage: %s [--cases N] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::mt19937_64 rng(options.seed);
+    RESPCommand command;
+    std::vector<std::string_view> expected;
+    uint64_t counts[3] = {}, early_rejects = 0, mismatches = 0;
+
+    for (uint64_t n = 0; n < options.cases; ++n) {
+        std::string input = makeFrame(rng);
+        if (rng() % 4 == 0) input += makeFrame(rng);
+        const unsigned shape = rng() % 4;
+        if (shape == 1) {
+            input.resize(rng() % (input.size() + 1));
+        } else if (shape >= 2) {
+            for (unsigned m = 1 + rng() % 3; m > 0; --m) mutate(rng, input);
+            if (shape == 3) input.resize(rng() % (input.size() + 1));
+        }
+
+        size_t pos = 0, reference_pos = 0;
+        const ParseStatus status = RESPParser::parseCommand(input, pos, command);
+        const ParseStatus reference = ReferenceParser::parseCommand(input, reference_pos, expected);
+        bool same = status == reference && pos == reference_pos;
+        if (same && status == ParseStatus::Complete) {
+            same = command.size() == expected.size();
+            for (size_t i = 0; same && i < expected.size(); ++i) {
+                same = command[i].data() == expected[i].data() && command[i].size() == expected[i].size();
+            }
+        }
+        if (!same && status == ParseStatus::Invalid && reference == ParseStatus::Incomplete) {
+            // Rejected early: the old parser must reject it too once the header's CRLF arrives.
+            const std::string terminated = input + "\r\n";
+            size_t terminated_pos = 0;
+            same = ReferenceParser::parseCommand(terminated, terminated_pos, expected) == ParseStatus::Invalid;
+            early_rejects += same;
+        }
+        ++counts[static_cast<int>(status)];
+        if (!same && ++mismatches <= 10) {
+            std::string shown;
+            for (const char c : input) shown += c == '\r' ? std::string("\\r") : c == '\n' ? std::string("\\n") : std::string(1, c);
+            std::fprintf(stderr, "mismatch: parser %s at %zu, reference %s at %zu: \"%s\"\n", statusName(status), pos,
+                         statusName(reference), reference_pos, shown.substr(0, 200).c_str());
+        }
+    }
+
+    std::printf("cases %llu: complete %llu, incomplete %llu, invalid %llu (%llu rejected early), mismatches %llu\n",
+                static_cast<unsigned long long>(options.cases), static_cast<unsigned long long>(counts[0]),
+                static_cast<unsigned long long>(counts[1]), static_cast<unsigned long long>(counts[2]),
+                static_cast<unsigned long long>(early_rejects), static_cast<unsigned long long>(mismatches));
+    return mismatches == 0 ? 0 : 1;
+}
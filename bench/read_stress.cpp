@@ -0,0 +1,173 @@
+/**
+ * @file read_stress.cpp
+ * @brief Races lock-free GETs against writers and checks every value read is one that was written.
+ *
+ * Readers run KVStore::readOptimistic() as registered Qsbr readers, falling
+ * back to get() like the GET handler does. Writers overwrite keys in place,
+ * across size classes, with large pinnable values and with compressible
+ * values that are stored LZ4-encoded, and also delete, expire, clear() and
+ * rehomeShard(). LFU eviction is on so hits write access metadata. Each
+ * value names its key, generation and length and derives its body from
+ * them, so a torn read, a wrong encoding or a value of another key is
+ * caught. Build with `make check` to run it under ASan/UBSan.
+ */
+#include "kv_store.h"
+#include "qsbr.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct StressOptions {
+    double seconds = 3;
+    size_t readers = 3;
+    size_t writers = 2;
+    size_t keys = 64;
+};
+
+static std::string makeKey(size_t i) { return "key:" + std::to_string(i); }
+
+/**
+ * @brief A value for key: "key|generation|length|", then a body compressible or not, length bytes in all.
+ */
+static std::string makeValue(const std::string& key, uint64_t generation, size_t length) {
+    const bool compressible = generation % 2 == 0;
+    std::string value = key + "|" + std::to_string(generation) + "|" + std::to_string(length) + "|";
+    uint64_t state = generation * 0x9E3779B97F4A7C15ULL + 1;
+    while (value.size() < length) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        value.push_back(compressible ? static_cast<char>('a' + generation % 26) : static_cast<char>(state));
+    }
+    return value;
+}
+
+/**
+ * @brief True if value is exactly what makeValue() produced for key at the generation it names.
+ */
+static bool validValue(const std::string& key, std::string_view value) {
+    if (value.size() < key.size() + 1 || value.compare(0, key.size(), key) != 0 || value[key.size()] != '|') {
+        return false;
+    }
+    const size_t generation_end = value.find('|', key.size() + 1);
+    if (generation_end == std::string_view::npos) return false;
+    const size_t length_end = value.find('|', generation_end + 1);
+    if (length_end == std::string_view::npos) return false;
+    const uint64_t generation = std::stoull(std::string(value.substr(key.size() + 1, generation_end - key.size() - 1)));
+    const size_t length = std::stoul(std::string(value.substr(generation_end + 1, length_end - generation_end - 1)));
+    return value == makeValue(key, generation, length);
+}
+
+/**
+ * @brief Lengths that keep a record in its size class, move it to another, or make it large.
+ */
+static size_t pickLength(std::mt19937_64& rng) {
+    switch (rng() % 4) {
+        case 0: return 40 + rng() % 8;
+        case 1: return 64 + rng() % 600;
+        case 2: return 1200 + rng() % 4000;
+        default: return 20000 + rng() % 20000;
+    }
+}
+
+int main(int argc, char** argv) {
+    StressOptions options;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            options.seconds = std::stod(argv[++i]);
+        } else if (std::strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            options.readers = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--writers") == 0 && i + 1 < argc) {
+            options.writers = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+            options.keys = std::stoul(argv[++i]);
+        } else {
+            std::fprintf(stderr, "Usage: %s [--seconds S] [--readers N] [--writers N] [--keys N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    KVStore store(8, false);
+    store.setCompression(64);
+    store.setMaxMemory(size_t{1} << 30, EvictionPolicy::AllKeysLFU);
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < options.keys; ++i) keys.push_back(makeKey(i));
+    std::atomic<uint64_t> next_generation{1};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> hits{0}, misses{0}, fallbacks{0}, bad{0}, writes{0};
+
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < options.writers; ++w) {
+        threads.emplace_back([&, w] {
+            std::mt19937_64 rng(w + 1);
+            uint64_t done = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                const std::string& key = keys[rng() % keys.size()];
+                const unsigned op = rng() % 1000;
+                if (op < 850) {
+                    store.set(key, makeValue(key, next_generation.fetch_add(1), pickLength(rng)));
+                } else if (op < 930) {
+                    store.del(key);
+                } else if (op < 990) {
+                    const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+                    store.set(key, makeValue(key, next_generation.fetch_add(1), pickLength(rng)), now + 1);
+                } else if (op < 999) {
+                    store.rehomeShard(rng() % store.shardCount());
+                } else if (rng() % 20 == 0) {
+                    store.clear();
+                }
+                ++done;
+            }
+            writes.fetch_add(done);
+        });
+    }
+    for (size_t r = 0; r < options.readers; ++r) {
+        threads.emplace_back([&, r] {
+            Qsbr::registerThread();
+            std::mt19937_64 rng(1000 + r);
+            std::string staged;
+            while (!stop.load(std::memory_order_relaxed)) {
+                Qsbr::quiescent();
+                const std::string& key = keys[rng() % keys.size()];
+                const ReadStatus status = store.readOptimistic(key, [&](std::string_view value) {
+                    staged.assign(value.data(), value.size());
+                    return true;
+                });
+                if (status == ReadStatus::Hit) {
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    if (!validValue(key, staged)) {
+                        bad.fetch_add(1);
+                        std::fprintf(stderr, "torn optimistic read of %s (%zu bytes)\n", key.c_str(), staged.size());
+                    }
+                } else if (status == ReadStatus::Miss) {
+                    misses.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    fallbacks.fetch_add(1, std::memory_order_relaxed);
+                    const std::optional<std::string> value = store.get(key);
+                    if (value && !validValue(key, *value)) {
+                        bad.fetch_add(1);
+                        std::fprintf(stderr, "torn locked read of %s (%zu bytes)\n", key.c_str(), value->size());
+                    }
+                }
+            }
+            Qsbr::unregisterThread();
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stop = true;
+    for (auto& thread : threads) thread.join();
+
+    std::printf("writes %llu, optimistic hits %llu, misses %llu, fallbacks %llu, compressed keys %zu, bad %llu\n",
+                static_cast<unsigned long long>(writes.load()), static_cast<unsigned long long>(hits.load()),
+                static_cast<unsigned long long>(misses.load()), static_cast<unsigned long long>(fallbacks.load()),
+                store.compressedKeys(), static_cast<unsigned long long>(bad.load()));
+    return bad.load() == 0 ? 0 : 1;
+}
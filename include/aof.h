@@ -0,0 +1,531 @@
+/**
+ * @file aof.h
+ * @brief Append-only command log with group commit and background rewrite.
+ */
+#ifndef AOF_H
+#define AOF_H
+
+#include "kv_store.h"
+#include "mutation_codec.h"
+#include "resp_parser.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief When appended commands are forced to stable storage.
+ */
+enum class FsyncPolicy {
+    Always,    ///< Replies wait for fsync; concurrent writers share one (group commit).
+    Interval,  ///< Written and fsynced every interval; a crash loses at most that window.
+    OS         ///< Written every interval; the kernel decides when to flush.
+};
+
+/**
+ * @class AppendOnlyLog
+ * @brief Durable log of SET/DEL/PEXPIREAT/PERSIST commands between snapshots.
+ *
+ * Commands are RESP-encoded into one buffer per KVStore shard. The shard
+ * lock is already held when KVStore calls in, so appending contends only
+ * with the flusher and never across shards; per-key order is preserved
+ * because a key always maps to the same buffer. A background flusher
+ * drains all buffers in rounds, writes them with a single write() and
+ * fsyncs according to the policy.
+ *
+ * On disk the log is a manifest naming a base snapshot and the incremental
+ * files written since, oldest first (the Redis 7 multi-part layout):
+ *
+ *     base kvstore.aof.3.base
+ *     incr kvstore.aof.3.incr
+ *
+ * rewrite() folds the log into a new base: at a cut point it switches
+ * appends to a fresh incremental file, lists that file in the manifest,
+ * forks a snapshot of the store as the next base and only then drops the
+ * old files. Every manifest written along the way describes a complete
+ * history, so a crash at any point recovers correctly.
+ */
+class AppendOnlyLog : public MutationLog {
+private:
+    struct alignas(64) Slot {
+        std::mutex mutex;
+        std::string pending;
+    };
+
+    std::string prefix_;
+    FsyncPolicy policy_;
+    std::chrono::milliseconds interval_;
+    std::unique_ptr<Slot[]> slots_;
+    size_t slot_count_;
+
+    /**
+     * @brief An incremental file and the collected commands waiting to be appended to it.
+     */
+    struct IncrFile {
+        int fd = -1;
+        std::string buffer;      ///< Kept across rounds while writing fails.
+        uint64_t bytes = 0;      ///< Leading bytes known to be good.
+        bool torn_tail = false;  ///< A failed write left bytes past `bytes` that ftruncate could not cut.
+    };
+
+    std::mutex rewrite_mutex_;         ///< One rewrite at a time.
+    std::mutex file_mutex_;            ///< Serializes flush rounds and file switches.
+    IncrFile incr_;                    ///< The file appends go to.
+    IncrFile retiring_;                ///< The file before the last rewrite cut, until its tail is fsynced.
+    bool manifest_stale_ = false;      ///< The manifest does not list incr_ yet.
+    uint64_t generation_ = 0;
+    std::string base_;                 ///< Current base snapshot file, or empty.
+    std::vector<std::string> incrs_;   ///< Incremental files, oldest first.
+    std::atomic<uint64_t> incr_bytes_{0};  ///< incr_.bytes, for rewriteDue().
+    uint64_t base_bytes_ = 0;
+
+    std::atomic<uint64_t> round_{0};          ///< Flush round currently collecting.
+    std::atomic<uint64_t> durable_round_{0};  ///< Last round written (and fsynced if required).
+    std::atomic<int> write_error_{0};         ///< errno of the last round if it failed, else 0.
+
+    std::mutex sync_mutex_;
+    std::condition_variable flush_cv_;
+    std::condition_variable durable_cv_;
+    bool sync_requested_ = false;
+    bool running_ = false;
+    std::thread flusher_;
+
+    /**
+     * @brief Highest flush round the calling thread has to wait for.
+     */
+    static uint64_t& threadTicket() {
+        static thread_local uint64_t ticket = 0;
+        return ticket;
+    }
+
+    std::string fileName(uint64_t generation, const char* kind) const {
+        return prefix_ + "." + std::to_string(generation) + "." + kind;
+    }
+
+    std::string manifestPath() const { return prefix_ + ".manifest"; }
+
+    static uint64_t fileSize(const std::string& path) {
+        struct stat st;
+        return ::stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+    }
+
+    static bool writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written == -1) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Encodes one mutation with MutationCodec into the shard's buffer.
+     */
+    template <typename Encode>
+    void append(size_t shard, Encode&& encode) {
+        Slot& slot = slots_[shard % slot_count_];
+        std::lock_guard guard(slot.mutex);
+        encode(slot.pending);
+
+        // Read inside the slot lock: the flusher bumps round_ before collecting,
+        // so this append is collected no later than round (seen + 1).
+        uint64_t& ticket = threadTicket();
+        ticket = std::max(ticket, round_.load() + 1);
+    }
+
+    /**
+     * @brief Writes the manifest atomically (temporary file, fsync, rename).
+     */
+    void writeManifest() {
+        std::string text;
+        if (!base_.empty()) text += "base " + base_ + "\n";
+        for (const auto& incr : incrs_) text += "incr " + incr + "\n";
+
+        const std::string tmp = manifestPath() + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) throw std::system_error(errno, std::system_category(), "open manifest");
+        bool ok = writeAll(fd, text.data(), text.size()) && fsync(fd) == 0;
+        ok = (::close(fd) == 0) && ok;
+        if (!ok || std::rename(tmp.c_str(), manifestPath().c_str()) != 0) {
+            throw std::system_error(errno, std::system_category(), "write manifest");
+        }
+    }
+
+    static int openIncr(const std::string& path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1) throw std::system_error(errno, std::system_category(), "open " + path);
+        return fd;
+    }
+
+    /**
+     * @brief Appends file.buffer at the file's last good offset and fsyncs it if asked.
+     *
+     * On failure the buffer is kept for the next round and the file is cut
+     * back to its good bytes, so a retry never appends after a partial record.
+     * @return 0, or the errno of the step that failed.
+     */
+    static int writeBuffer(IncrFile& file, bool do_fsync) {
+        if (file.torn_tail && ::ftruncate(file.fd, static_cast<off_t>(file.bytes)) != 0) return errno;
+        file.torn_tail = false;
+
+        if (!writeAll(file.fd, file.buffer.data(), file.buffer.size()) || (do_fsync && fdatasync(file.fd) != 0)) {
+            const int error = errno;
+            file.torn_tail = ::ftruncate(file.fd, static_cast<off_t>(file.bytes)) != 0;
+            return error;
+        }
+        file.bytes += file.buffer.size();
+        file.buffer.clear();
+        return 0;
+    }
+
+    /**
+     * @brief Moves every slot's commands into incr_.buffer. Needs file_mutex_.
+     */
+    void collectLocked() {
+        for (size_t i = 0; i < slot_count_; ++i) {
+            std::lock_guard guard(slots_[i].mutex);
+            if (slots_[i].pending.empty()) continue;
+            if (incr_.buffer.empty()) {
+                incr_.buffer.swap(slots_[i].pending);
+            } else {
+                incr_.buffer += slots_[i].pending;
+                slots_[i].pending.clear();
+            }
+        }
+    }
+
+    /**
+     * @brief Finishes the switch a rewrite cut began: fsyncs the old file's tail, then lists the new one.
+     *
+     * Runs before anything is written to the new file, so the manifest
+     * names it before a reply can depend on it. Needs file_mutex_.
+     * @return 0, or the errno of the step that failed.
+     */
+    int finishCutLocked() {
+        if (retiring_.fd != -1) {
+            if (const int error = writeBuffer(retiring_, true)) return error;
+            ::close(retiring_.fd);
+            retiring_ = IncrFile();
+        }
+        if (manifest_stale_) {
+            try {
+                writeManifest();
+            } catch (const std::system_error& e) {
+                return e.code().value();
+            }
+            manifest_stale_ = false;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Runs finishCutLocked() now rather than at the next flush round.
+     * @throws std::system_error if the old file's tail or the manifest cannot be written.
+     */
+    void finishCut() {
+        std::lock_guard guard(file_mutex_);
+        if (const int error = finishCutLocked()) {
+            throw std::system_error(error, std::system_category(), "AOF rewrite");
+        }
+    }
+
+    /**
+     * @brief Collects every slot, writes the batch and fsyncs if asked. Needs file_mutex_.
+     *
+     * A round that fails is not published as durable and keeps its batch
+     * for the next round. Under FsyncPolicy::Always that is fatal, as in
+     * Redis: replies wait for this round, and once the store has applied a
+     * write it cannot be taken back. Under the other policies replies did
+     * not wait, so writeError() is set instead, refusing new writes until a
+     * round succeeds, like Redis's aof_last_write_status.
+     */
+    void flushRoundLocked(bool do_fsync) {
+        const uint64_t round = round_.load() + 1;
+        round_.store(round);
+        collectLocked();
+
+        int error = finishCutLocked();
+        if (error == 0 && !incr_.buffer.empty()) {
+            error = writeBuffer(incr_, do_fsync);
+            incr_bytes_.store(incr_.bytes);
+        }
+        if (error != 0 && policy_ == FsyncPolicy::Always) {
+            // _exit: other threads are still running, so static destructors must not.
+            std::cerr << "AOF write failed under the always fsync policy, exiting: " << std::strerror(error)
+                      << std::endl;
+            _exit(1);
+        }
+
+        const int previous = write_error_.exchange(error);
+        if (error != 0 && previous == 0) {
+            std::cerr << "AOF write failed, refusing writes until it succeeds: " << std::strerror(error) << std::endl;
+        } else if (error == 0 && previous != 0) {
+            std::cerr << "AOF write succeeded again, accepting writes" << std::endl;
+        }
+        if (error != 0) return;
+
+        {
+            std::lock_guard guard(sync_mutex_);
+            durable_round_.store(round);
+        }
+        durable_cv_.notify_all();
+    }
+
+    void flusherLoop() {
+        // With Always, requests for durability wake the flusher; the timeout only bounds idle latency.
+        const auto wait_time = policy_ == FsyncPolicy::Always ? std::chrono::milliseconds(10) : interval_;
+
+        std::unique_lock lock(sync_mutex_);
+        while (running_) {
+            flush_cv_.wait_for(lock, wait_time, [this] { return !running_ || sync_requested_; });
+            sync_requested_ = false;
+            lock.unlock();
+            {
+                std::lock_guard guard(file_mutex_);
+                flushRoundLocked(policy_ != FsyncPolicy::OS);
+            }
+            lock.lock();
+        }
+    }
+
+    /**
+     * @brief Applies one incremental file to the store, truncating a torn tail.
+     */
+    static void replay(const std::string& path, KVStore& store) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return;
+        const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        RESPCommand command;
+        size_t pos = 0;
+        while (pos < data.size()) {
+            const size_t start = pos;
+            const auto status = RESPParser::parseCommand(data, pos, command);
+            if (status == RESPParser::ParseStatus::Incomplete) {
+                std::cerr << "AOF " << path << ": truncating " << (data.size() - start)
+                          << " bytes of incomplete command" << std::endl;
+                if (::truncate(path.c_str(), static_cast<off_t>(start)) != 0) {
+                    throw std::system_error(errno, std::system_category(), "truncate " + path);
+                }
+                break;
+            }
+            if (status == RESPParser::ParseStatus::Invalid) {
+                throw std::runtime_error("Corrupt AOF " + path + ": " + command.error());
+            }
+
+            if (!MutationCodec::apply(store, command)) {
+                throw std::runtime_error("Corrupt AOF " + path + ": unexpected command");
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Creates a log; call recover() and then start().
+     * @param prefix Path prefix of the manifest and log files.
+     * @param policy Fsync policy.
+     * @param interval Flush period for Interval and OS policies.
+     * @param slots Number of append buffers; use the store's shard count.
+     */
+    AppendOnlyLog(std::string prefix, FsyncPolicy policy, std::chrono::milliseconds interval, size_t slots)
+        : prefix_(std::move(prefix)), policy_(policy), interval_(interval),
+          slots_(std::make_unique<Slot[]>(std::max<size_t>(slots, 1))), slot_count_(std::max<size_t>(slots, 1)) {}
+
+    ~AppendOnlyLog() override {
+        stop();
+        if (incr_.fd != -1) ::close(incr_.fd);
+        if (retiring_.fd != -1) ::close(retiring_.fd);
+    }
+
+    /**
+     * @brief Rebuilds the store from the manifest and opens the newest file for appending.
+     *
+     * Without a manifest the store's plain snapshot is loaded instead and a
+     * first rewrite makes that state the base. Must run before the store is
+     * shared with other threads.
+     * @param store Store to recover into; must not have a log installed yet.
+     * @param load Rebuild the store's contents; false when it already holds exactly what the
+     *        log describes, as after a hot restart, and only the files are reopened.
+     */
+    void recover(KVStore& store, bool load = true) {
+        std::ifstream manifest(manifestPath());
+        if (manifest) {
+            std::string kind, name;
+            while (manifest >> kind >> name) {
+                if (kind == "base") base_ = name;
+                else if (kind == "incr") incrs_.push_back(name);
+            }
+        }
+
+        if (!incrs_.empty()) {
+            if (load) {
+                if (base_.empty()) {
+                    store.clear();
+                } else if (!store.loadSnapshot(base_)) {
+                    throw std::runtime_error("Missing AOF base " + base_);
+                }
+                for (const auto& incr : incrs_) replay(incr, store);
+            }
+
+            const std::string& last = incrs_.back();
+            generation_ = std::stoull(last.substr(prefix_.size() + 1));
+            base_bytes_ = base_.empty() ? 0 : fileSize(base_);
+            incr_.bytes = fileSize(last);
+            incr_bytes_ = incr_.bytes;
+            incr_.fd = openIncr(last);
+        } else {
+            if (load) store.loadFromDisk();
+            generation_ = 1;
+            incrs_.push_back(fileName(generation_, "incr"));
+            incr_.fd = openIncr(incrs_.back());
+            writeManifest();
+            if (store.size() > 0) {
+                store.setMutationLog(this);
+                rewrite(store);
+            }
+        }
+        store.setMutationLog(this);
+    }
+
+    /**
+     * @brief Starts the background flusher.
+     */
+    void start() {
+        std::lock_guard guard(sync_mutex_);
+        if (running_) return;
+        running_ = true;
+        flusher_ = std::thread(&AppendOnlyLog::flusherLoop, this);
+    }
+
+    /**
+     * @brief Stops the flusher after writing and fsyncing everything appended so far.
+     */
+    void stop() {
+        {
+            std::lock_guard guard(sync_mutex_);
+            if (!running_) return;
+            running_ = false;
+        }
+        flush_cv_.notify_one();
+        if (flusher_.joinable()) flusher_.join();
+
+        std::lock_guard guard(file_mutex_);
+        flushRoundLocked(true);
+    }
+
+    void logSet(size_t shard, std::string_view key, std::string_view value, ValueEncoding encoding) override {
+        append(shard, [&](std::string& out) { MutationCodec::appendSet(out, key, value, encoding); });
+    }
+
+    void logDel(size_t shard, std::string_view key) override {
+        append(shard, [&](std::string& out) { MutationCodec::appendDel(out, key); });
+    }
+
+    void logExpire(size_t shard, std::string_view key, int64_t expire_at) override {
+        append(shard, [&](std::string& out) { MutationCodec::appendExpire(out, key, expire_at); });
+    }
+
+    /**
+     * @brief Under FsyncPolicy::Always, waits until this thread's appends are fsynced.
+     *
+     * Call once per batch of requests, before sending their replies: every
+     * thread waiting at the same time is released by the same fsync.
+     */
+    void sync() override {
+        uint64_t& ticket = threadTicket();
+        if (policy_ != FsyncPolicy::Always || ticket == 0) return;
+
+        std::unique_lock lock(sync_mutex_);
+        if (durable_round_.load() < ticket) {
+            sync_requested_ = true;
+            flush_cv_.notify_one();
+            durable_cv_.wait(lock, [&] { return durable_round_.load() >= ticket || !running_; });
+        }
+        ticket = 0;
+    }
+
+    int writeError() const override { return write_error_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief True when the incremental files have outgrown the base enough to rewrite.
+     */
+    bool rewriteDue() const {
+        const uint64_t incr = incr_bytes_.load();
+        return incr >= 64ULL * 1024 * 1024 && incr >= base_bytes_;
+    }
+
+    /**
+     * @brief Folds the log into a new base snapshot without blocking writers.
+     *
+     * Blocks the caller until the forked snapshot finishes; run it from a
+     * background thread. On failure the previous files stay authoritative.
+     * @param store The store this log is attached to.
+     */
+    void rewrite(KVStore& store) {
+        std::lock_guard rewrite_guard(rewrite_mutex_);
+        finishCut();
+        const uint64_t next = generation_ + 1;
+        const std::string new_base = fileName(next, "base");
+        const std::string new_incr = fileName(next, "incr");
+        std::vector<std::string> obsolete;
+        IncrFile next_file;
+        next_file.fd = openIncr(new_incr);
+
+        // The cut runs with every shard read-locked, so it only switches
+        // buffers and files: what precedes it becomes the retiring file's
+        // tail, which the next flush round writes and fsyncs once the locks
+        // are gone, before anything reaches the new file.
+        auto cut = [&] {
+            std::lock_guard guard(file_mutex_);
+            collectLocked();
+            retiring_ = std::exchange(incr_, std::exchange(next_file, IncrFile()));
+            incr_bytes_ = 0;
+
+            generation_ = next;
+            obsolete = incrs_;
+            if (!base_.empty()) obsolete.push_back(base_);
+            incrs_.push_back(new_incr);
+            manifest_stale_ = true;
+        };
+
+        try {
+            store.backgroundPersistTo(new_base, cut);
+        } catch (...) {
+            if (next_file.fd != -1) {
+                ::close(next_file.fd);
+                ::unlink(new_incr.c_str());
+            }
+            throw;
+        }
+
+        // The manifest below drops the old files, so their tails must be on disk first.
+        finishCut();
+        std::lock_guard guard(file_mutex_);
+        base_ = new_base;
+        base_bytes_ = fileSize(base_);
+        incrs_.assign(1, fileName(next, "incr"));
+        writeManifest();
+        for (const auto& file : obsolete) ::unlink(file.c_str());
+    }
+};
+
+#endif // AOF_H
@@ -3,29 +3,281 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <chrono>
 #include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/epoll.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <system_error>
 #include <sched.h>
 #include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <linux/filter.h>
+#include <cstring>
+#include "byte_buffer.h"
+#include "mpsc_queue.h"
+#include "io_ring.h"
+#include "qsbr.h"
+#include "server_stats.h"
+#include <poll.h>
 
 #define MAX_EVENTS 100
-#define BUFFER_SIZE 1024
+#define BUFFER_SIZE 16384
+#define OUTPUT_HIGH_WATER (4 * 1024 * 1024)
+#define OUTPUT_LOW_WATER (OUTPUT_HIGH_WATER / 4)
+#define MAX_IDLE_BUFFER (1024 * 1024)
+#define URING_QUEUE_DEPTH 4096
+#define URING_BUFFER_COUNT 256
+#define URING_BUFFER_GROUP 0
+#define SEND_IOV_MAX 16
+#define IDLE_SWEEP_INTERVAL_MS 1000
+#define DEFERRED_REPLY_RETAIN 4096
+#define DRAIN_QUIET_MS 100
+
+/**
+ * @brief Kernel interface a Worker uses for socket I/O.
+ */
+enum class IoBackend {
+    Epoll,   ///< Edge-triggered epoll with read()/send() per connection.
+    IoUring  ///< io_uring with multishot accept/recv, provided buffers and batched sends.
+};
+
+/**
+ * @brief How new connections are spread over the Workers.
+ */
+enum class ConnectionBalance {
+    ReusePort,   ///< The kernel's SO_REUSEPORT hash of the address 4-tuple picks a Worker's listener.
+    Cpu,         ///< A cBPF program picks the Worker pinned to the CPU that received the SYN.
+    LeastLoaded  ///< The accepting Worker hands each connection to the Worker with the fewest.
+};
+
+/**
+ * @struct Connection
+ * @brief Per-client state owned by a Worker.
+ *
+ * Responses normally go straight to output. A handler that hands a request
+ * to another thread reserves its place with deferReply(); replies produced
+ * after that are queued behind it through reply() so the client still sees
+ * responses in request order. Queued replies live in a ring of slots whose
+ * strings keep their storage (up to DEFERRED_REPLY_RETAIN bytes) for the
+ * next reply, and one that completes at the front goes straight to output.
+ */
+struct Connection {
+    int fd;
+    uint64_t id;        ///< Unique within the owning Worker; detects fd reuse.
+    ByteBuffer input;   ///< Received bytes not yet consumed by the handler.
+    ByteBuffer output;  ///< Responses not yet written to the socket.
+    bool write_armed = false;  ///< EPOLLOUT is registered because output is pending.
+    bool read_paused = false;  ///< Output passed the high-water mark; stop reading.
+    bool closing = false;      ///< Peer finished sending; close once output drains.
+    bool dirty = false;        ///< Deferred replies arrived and need flushing.
+    std::chrono::steady_clock::time_point last_active;  ///< Last time bytes moved either way.
+
+    // io_uring backend only.
+    ByteBuffer sending;         ///< Bytes owned by the in-flight send; output keeps filling meanwhile.
+    bool send_pending = false;  ///< A send SQE for this connection has not completed.
+    bool recv_armed = false;    ///< The multishot recv is still active.
+    bool shut = false;          ///< shutdown() issued; closed once no operation is in flight.
+    msghdr send_msg{};          ///< Scatter list of an in-flight SENDMSG; must outlive it.
+    iovec send_iov[SEND_IOV_MAX];
+
+    /**
+     * Both output buffers splice, so large values are sent from the store
+     * without a copy; Worker drains them with gather() and sendmsg().
+     */
+    Connection(int client_fd, uint64_t connection_id, std::chrono::steady_clock::time_point now)
+        : fd(client_fd), id(connection_id), last_active(now) {
+        output.setSplicing(true);
+        sending.setSplicing(true);
+    }
+
+    /**
+     * @brief True while some earlier request is still waiting for its reply.
+     */
+    bool hasDeferred() const noexcept { return deferred_end_ != deferred_base_; }
+
+    /**
+     * @brief Appends a response, queueing it behind any deferred replies.
+     */
+    void reply(std::string_view bytes) {
+        if (!hasDeferred()) {
+            output.append(bytes);
+            return;
+        }
+        DeferredReply& slot = pushDeferred();
+        slot.bytes.assign(bytes.data(), bytes.size());
+        slot.ready = true;
+    }
+
+    /**
+     * @brief Reserves the next response slot for a reply produced elsewhere.
+     * @return Sequence number to pass to completeReply().
+     */
+    uint64_t deferReply() {
+        pushDeferred().ready = false;
+        return deferred_end_ - 1;
+    }
+
+    /**
+     * @brief Fills a reserved slot and releases every reply that is now in order.
+     */
+    void completeReply(uint64_t seq, std::string_view bytes) {
+        if (seq != deferred_base_) {
+            DeferredReply& slot = deferred_[seq & (deferred_.size() - 1)];
+            slot.bytes.assign(bytes.data(), bytes.size());
+            slot.ready = true;
+            return;
+        }
+
+        output.append(bytes);
+        popDeferred();
+        while (hasDeferred()) {
+            DeferredReply& slot = deferred_[deferred_base_ & (deferred_.size() - 1)];
+            if (!slot.ready) break;
+            output.append(slot.bytes);
+            popDeferred();
+        }
+    }
+
+private:
+    struct DeferredReply {
+        std::string bytes;
+        bool ready = false;
+    };
+
+    std::vector<DeferredReply> deferred_;  ///< Ring indexed by sequence; its size is 0 or a power of two.
+    uint64_t deferred_base_ = 0;           ///< Sequence of the oldest reply still owed.
+    uint64_t deferred_end_ = 0;            ///< Sequence the next deferReply() or queued reply() gets.
+
+    DeferredReply& pushDeferred() {
+        if (deferred_end_ - deferred_base_ == deferred_.size()) {
+            std::vector<DeferredReply> grown(std::max<size_t>(8, deferred_.size() * 2));
+            for (uint64_t seq = deferred_base_; seq != deferred_end_; ++seq) {
+                grown[seq & (grown.size() - 1)] = std::move(deferred_[seq & (deferred_.size() - 1)]);
+            }
+            deferred_.swap(grown);
+        }
+        return deferred_[deferred_end_++ & (deferred_.size() - 1)];
+    }
+
+    void popDeferred() {
+        DeferredReply& slot = deferred_[deferred_base_++ & (deferred_.size() - 1)];
+        slot.ready = false;
+        if (slot.bytes.capacity() > DEFERRED_REPLY_RETAIN) {
+            std::string().swap(slot.bytes);
+        } else {
+            slot.bytes.clear();
+        }
+    }
+};
+
+/**
+ * @brief What a Worker has done so far; written by its own thread, readable from any.
+ */
+struct alignas(64) WorkerStats {
+    StatCounter connections_received;
+    StatCounter connections_closed;
+    StatCounter connections_timed_out;   ///< Closed after idling past the idle timeout.
+    StatCounter connections_handed_off;  ///< Accepted here but given to a less loaded Worker.
+    StatCounter bytes_in;
+    StatCounter bytes_out;
+    StatCounter loop_iterations;
+    StatCounter busy_ns;  ///< Time the event loop spent outside its wait for events.
+
+    uint64_t connections() const noexcept { return connections_received.load() - connections_closed.load(); }
+};
+
+/**
+ * @brief Request handler contract.
+ *
+ * The handler consumes as many complete requests as it can from
+ * conn.input, produces one response per request (into conn.output, or via
+ * the Connection reply helpers) and returns the number of input bytes
+ * consumed. A trailing partial request must be left unconsumed; it is
+ * handed back once more bytes arrive. A handler may also stop in front of
+ * a complete request that must not run before the connection's deferred
+ * replies are in; the rest of the input is handed back as soon as the
+ * last of them is delivered.
+ *
+ * RequestHandler is a non-owning reference to such a handler, an object
+ * with size_t handle(Connection&). bind() instantiates a direct call to
+ * that member, so the parse, dispatch and serialize path is compiled into
+ * one function per handler type and a batch of requests costs one
+ * indirect call: no type erasure, wrapping lambda or copy of the handler.
+ * The handler must outlive every Worker it is installed on.
+ */
+class RequestHandler {
+public:
+    RequestHandler() = default;
+
+    template <typename Handler>
+    static RequestHandler bind(Handler& handler) noexcept {
+        RequestHandler bound;
+        bound.handler_ = &handler;
+        bound.invoke_ = [](void* target, Connection& conn) -> size_t {
+            return static_cast<Handler*>(target)->handle(conn);
+        };
+        return bound;
+    }
+
+    size_t operator()(Connection& conn) const { return invoke_(handler_, conn); }
+
+    explicit operator bool() const noexcept { return invoke_ != nullptr; }
+
+private:
+    void* handler_ = nullptr;
+    size_t (*invoke_)(void* handler, Connection& conn) = nullptr;
+};
 
 class Worker {
 private:
+    /// Operation kinds, kept in the upper half of io_uring user_data; the lower half is the fd.
+    enum UringOp : uint64_t { UringAccept = 1, UringWake, UringRecv, UringSend, UringCancel };
+
     int server_fd_;
-    int epoll_fd_;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    size_t id_;
+    size_t core_id_;
+    IoBackend backend_;
+    std::unique_ptr<IoRing> ring_;
+    bool numa_local_ = false;
+    int numa_node_ = -1;
+    std::function<void(Worker&)> thread_init_;
+    std::function<void(Worker&)> timer_;
+    std::chrono::milliseconds timer_period_{0};
+    std::chrono::steady_clock::time_point next_timer_{};
+    std::chrono::steady_clock::time_point woke_at_{};
     std::thread thread_;
     std::atomic<bool> running_{false};
-    std::function<std::string(const std::string&)> request_handler_;
+    std::atomic<bool> draining_{false};  ///< Set by drain(), cleared by resume(); the loop follows it.
+    bool accepting_ = true;              ///< Event-loop thread only: the listener is being watched.
+    std::atomic<bool> listening_{false}; ///< An accept can still complete; cleared once the listener is disarmed.
+    RequestHandler request_handler_;
+    std::unordered_map<int, Connection> connections_;
+    uint64_t next_connection_id_ = 0;
+    WorkerStats stats_;
+    std::atomic<size_t> load_{0};  ///< Connections assigned to this worker, including ones still being handed over.
+    std::vector<Worker*> peers_;   ///< Candidates for accepted connections; empty unless LeastLoaded.
+    std::chrono::milliseconds idle_timeout_{0};
+    std::chrono::steady_clock::time_point next_idle_sweep_{};
+    std::vector<int> idle_fds_;
+
+    MpscQueue<std::function<void()>> tasks_;
+    std::atomic<bool> wake_pending_{false};
+    std::vector<int> dirty_fds_;
 
     void setNonBlocking(int fd) {
         int flags = fcntl(fd, F_GETFL, 0);
@@ -61,9 +313,27 @@ private:
         }
     }
 
+    /**
+     * @brief Takes over a listening socket inherited from the process this one replaced.
+     */
+    void adoptSocket(int fd) {
+        server_fd_ = fd;
+        setNonBlocking(server_fd_);
+        fcntl(server_fd_, F_SETFD, FD_CLOEXEC);
+    }
+
+    void setupWakeFd() {
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd_ == -1) {
+            close(server_fd_);
+            throw std::system_error(errno, std::system_category(), "eventfd");
+        }
+    }
+
     void setupEpoll() {
         epoll_fd_ = epoll_create1(0);
         if (epoll_fd_ == -1) {
+            close(wake_fd_);
             close(server_fd_);
             throw std::system_error(errno, std::system_category(), "epoll_create1");
         }
@@ -73,38 +343,687 @@ private:
         event.data.fd = server_fd_;
         if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, server_fd_, &event) == -1) {
             close(epoll_fd_);
+            close(wake_fd_);
+            close(server_fd_);
+            throw std::system_error(errno, std::system_category(), "epoll_ctl");
+        }
+        listening_ = true;
+
+        event.events = EPOLLIN;
+        event.data.fd = wake_fd_;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) == -1) {
+            close(epoll_fd_);
+            close(wake_fd_);
             close(server_fd_);
             throw std::system_error(errno, std::system_category(), "epoll_ctl");
         }
     }
 
-    void handleClient(int client_fd) {
-        char buffer[BUFFER_SIZE];
-        ssize_t bytes_read = read(client_fd, buffer, sizeof(buffer));
+    void setupRing() {
+        try {
+            ring_ = std::make_unique<IoRing>(URING_QUEUE_DEPTH);
+            ring_->setupBuffers(URING_BUFFER_GROUP, URING_BUFFER_COUNT, BUFFER_SIZE);
+        } catch (...) {
+            ring_.reset();
+            close(wake_fd_);
+            close(server_fd_);
+            throw;
+        }
+    }
+
+    void setWriteInterest(Connection& conn, bool enabled) {
+        if (conn.write_armed == enabled) return;
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLET;
+        if (enabled) event.events |= EPOLLOUT;
+        event.data.fd = conn.fd;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &event) == 0) {
+            conn.write_armed = enabled;
+        }
+    }
+
+    void closeConnection(int client_fd) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client_fd, nullptr);
+        close(client_fd);
+        connections_.erase(client_fd);
+        stats_.connections_closed.add();
+        load_.fetch_sub(1, std::memory_order_relaxed);
+    }
 
-        if (bytes_read <= 0) {
-            if (bytes_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
-                epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client_fd, nullptr);
-                close(client_fd);
+    /**
+     * @brief Picks the worker an accepted connection goes to and counts it against that worker.
+     *
+     * Ties stay here, so a balanced server hands nothing over. The count is
+     * taken before the handover, so a burst of accepts spreads out at once.
+     */
+    Worker& assignConnection() {
+        Worker* best = this;
+        size_t best_load = load_.load(std::memory_order_relaxed);
+        for (Worker* peer : peers_) {
+            const size_t load = peer->load_.load(std::memory_order_relaxed);
+            if (load < best_load) {
+                best = peer;
+                best_load = load;
             }
+        }
+        best->load_.fetch_add(1, std::memory_order_relaxed);
+        return *best;
+    }
+
+    /**
+     * @brief Serves an accepted socket here or hands it to the worker assignConnection() picks.
+     */
+    void onAccepted(int client_fd) {
+        Worker& target = assignConnection();
+        if (&target == this) {
+            adoptConnection(client_fd);
             return;
         }
+        stats_.connections_handed_off.add();
+        target.post([&target, client_fd] { target.adoptConnection(client_fd); });
+    }
 
-        std::string request(buffer, bytes_read);
-        std::string response = request_handler_(request);
-        
-        ssize_t bytes_sent = send(client_fd, response.data(), response.size(), MSG_NOSIGNAL);
-        if (bytes_sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client_fd, nullptr);
+    /**
+     * @brief Starts serving a connected socket on this worker's thread.
+     *
+     * A socket that already has data buffered is read right away: epoll
+     * reports it ready on registration and a fresh multishot recv returns it.
+     */
+    void adoptConnection(int client_fd) {
+        if (backend_ == IoBackend::IoUring) {
+            auto [it, inserted] = connections_.emplace(client_fd, Connection(client_fd, next_connection_id_++, woke_at_));
+            (void)inserted;
+            stats_.connections_received.add();
+            uringArmRecv(it->second);
+            return;
+        }
+
+        setNonBlocking(client_fd);
+        epoll_event client_event{};
+        client_event.events = EPOLLIN | EPOLLET;
+        client_event.data.fd = client_fd;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &client_event) == -1) {
             close(client_fd);
+            load_.fetch_sub(1, std::memory_order_relaxed);
+            throw std::system_error(errno, std::system_category(), "epoll_ctl");
+        }
+        connections_.emplace(client_fd, Connection(client_fd, next_connection_id_++, woke_at_));
+        stats_.connections_received.add();
+    }
+
+    /**
+     * @brief Closes connections no bytes moved on for the idle timeout, checking once per sweep interval.
+     *
+     * A connection still owed a deferred reply is waiting on the server,
+     * not idle, and is kept.
+     */
+    void reapIdle() {
+        if (idle_timeout_.count() == 0 || woke_at_ < next_idle_sweep_) return;
+        next_idle_sweep_ = woke_at_ + std::min(idle_timeout_, std::chrono::milliseconds(IDLE_SWEEP_INTERVAL_MS));
+
+        const auto cutoff = woke_at_ - idle_timeout_;
+        idle_fds_.clear();
+        for (const auto& [fd, conn] : connections_) {
+            if (conn.last_active < cutoff && !conn.hasDeferred() && !conn.shut) idle_fds_.push_back(fd);
+        }
+        for (const int fd : idle_fds_) {
+            stats_.connections_timed_out.add();
+            if (backend_ == IoBackend::IoUring) {
+                uringRetire(connections_.at(fd));
+            } else {
+                closeConnection(fd);
+            }
+        }
+    }
+
+    /**
+     * @brief Follows drain() and resume(); while draining, closes each connection once it is answered.
+     *
+     * A connection is answered when nothing is left to send, no deferred
+     * reply or partial request is pending, no bytes moved for DRAIN_QUIET_MS
+     * and none are waiting in the socket, so a request racing the close is
+     * unlikely. Listening stops first, so new clients queue in the kernel
+     * for whichever process keeps the socket.
+     */
+    void applyDrain() {
+        const bool draining = draining_.load(std::memory_order_relaxed);
+        if (draining == accepting_) setAccepting(!draining);
+        if (!draining) return;
+
+        const auto cutoff = woke_at_ - std::chrono::milliseconds(DRAIN_QUIET_MS);
+        idle_fds_.clear();
+        for (const auto& [fd, conn] : connections_) {
+            int unread = 0;
+            if (conn.last_active < cutoff && conn.input.empty() && conn.output.empty() && conn.sending.empty() &&
+                !conn.send_pending && !conn.hasDeferred() && !conn.shut &&
+                ioctl(fd, FIONREAD, &unread) == 0 && unread == 0) {
+                idle_fds_.push_back(fd);
+            }
+        }
+        for (const int fd : idle_fds_) {
+            if (backend_ == IoBackend::IoUring) {
+                uringRetire(connections_.at(fd));
+            } else {
+                closeConnection(fd);
+            }
+        }
+    }
+
+    void setAccepting(bool enabled) {
+        accepting_ = enabled;
+        if (backend_ == IoBackend::IoUring) {
+            if (enabled) {
+                uringArmAccept();
+            } else {
+                io_uring_sqe* sqe = ring_->getSqe();
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = uringTag(UringAccept, server_fd_);
+                sqe->user_data = uringTag(UringCancel, server_fd_);
+            }
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = server_fd_;
+        if (epoll_ctl(epoll_fd_, enabled ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, server_fd_, &event) == -1) {
+            std::cerr << "Worker " << id_ << ": epoll_ctl listener: " << std::strerror(errno) << std::endl;
+        }
+        listening_ = enabled;
+    }
+
+    /**
+     * @brief Writes as much pending output as the socket accepts.
+     * @return False if the connection failed and was closed.
+     */
+    bool flushOutput(Connection& conn) {
+        iovec iov[SEND_IOV_MAX];
+        while (!conn.output.empty()) {
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = conn.output.gather(iov, SEND_IOV_MAX);
+            ssize_t bytes_sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+            if (bytes_sent > 0) {
+                conn.output.consume(static_cast<size_t>(bytes_sent));
+                conn.last_active = woke_at_;
+                stats_.bytes_out.add(static_cast<uint64_t>(bytes_sent));
+                continue;
+            }
+            if (bytes_sent == -1 && errno == EINTR) continue;
+            if (bytes_sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            closeConnection(conn.fd);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Decides what to wait for after a batch of reads or writes.
+     *
+     * Unsent output keeps EPOLLOUT armed; once everything is written the
+     * connection goes back to read-only interest and oversized buffers from
+     * a large request or response are released.
+     */
+    void afterIo(Connection& conn) {
+        if (!conn.output.empty()) {
+            setWriteInterest(conn, true);
+            return;
+        }
+        if (conn.closing) {
+            if (!conn.hasDeferred()) closeConnection(conn.fd);
+            return;
+        }
+        setWriteInterest(conn, false);
+        conn.input.releaseIfLarger(MAX_IDLE_BUFFER);
+        conn.output.releaseIfLarger(MAX_IDLE_BUFFER);
+    }
+
+    /**
+     * @brief Drains the socket until EAGAIN, dispatching every complete request.
+     *
+     * Edge-triggered epoll only reports new data once, so everything the
+     * kernel has buffered must be read here. Responses for the whole batch
+     * are accumulated and written with a single send at the end. Reading
+     * stops early while the pending output is above OUTPUT_HIGH_WATER; the
+     * unread bytes stay in the kernel until handleWritable() resumes us.
+     */
+    void handleClient(int client_fd) {
+        auto it = connections_.find(client_fd);
+        if (it == connections_.end()) return;
+        Connection& conn = it->second;
+        if (conn.read_paused || conn.closing) return;
+
+        while (true) {
+            char* dst = conn.input.prepare(BUFFER_SIZE);
+            ssize_t bytes_read = read(client_fd, dst, conn.input.writable());
+
+            if (bytes_read > 0) {
+                conn.input.commit(static_cast<size_t>(bytes_read));
+                conn.last_active = woke_at_;
+                stats_.bytes_in.add(static_cast<uint64_t>(bytes_read));
+                conn.input.consume(request_handler_(conn));
+
+                if (conn.output.size() >= OUTPUT_HIGH_WATER) {
+                    if (!flushOutput(conn)) return;
+                    if (conn.output.size() >= OUTPUT_HIGH_WATER) {
+                        conn.read_paused = true;
+                        break;
+                    }
+                }
+                continue;
+            }
+            if (bytes_read == 0) {
+                conn.closing = true;
+                break;
+            }
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            closeConnection(client_fd);
+            return;
+        }
+
+        if (!flushOutput(conn)) return;
+        afterIo(conn);
+    }
+
+    /**
+     * @brief Continues a partial write once the socket has send space again.
+     */
+    void handleWritable(int client_fd) {
+        auto it = connections_.find(client_fd);
+        if (it == connections_.end()) return;
+        Connection& conn = it->second;
+
+        if (!flushOutput(conn)) return;
+        if (conn.read_paused && conn.output.size() <= OUTPUT_LOW_WATER) {
+            conn.read_paused = false;
+            handleClient(client_fd);
+            return;
+        }
+        afterIo(conn);
+    }
+
+    /**
+     * @brief Runs tasks posted by other threads, then flushes connections they touched.
+     */
+    void runTasks() {
+        uint64_t counter;
+        while (read(wake_fd_, &counter, sizeof(counter)) > 0) {}
+        wake_pending_.store(false);
+
+        std::function<void()> task;
+        while (tasks_.pop(task)) {
+            task();
+        }
+
+        // The io_uring loop flushes dirty connections itself after every batch of completions.
+        if (backend_ == IoBackend::IoUring) return;
+
+        for (int fd : dirty_fds_) {
+            auto it = connections_.find(fd);
+            if (it == connections_.end()) continue;
+            it->second.dirty = false;
+            handleWritable(fd);
+        }
+        dirty_fds_.clear();
+    }
+
+    static uint64_t uringTag(UringOp op, int fd) noexcept {
+        return (uint64_t{op} << 32) | static_cast<uint32_t>(fd);
+    }
+
+    void uringArmAccept() {
+        io_uring_sqe* sqe = ring_->getSqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = server_fd_;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = uringTag(UringAccept, server_fd_);
+        listening_ = true;
+    }
+
+    void uringArmWake() {
+        io_uring_sqe* sqe = ring_->getSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = wake_fd_;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = uringTag(UringWake, wake_fd_);
+    }
+
+    void uringArmRecv(Connection& conn) {
+        io_uring_sqe* sqe = ring_->getSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn.fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = uringTag(UringRecv, conn.fd);
+        conn.recv_armed = true;
+    }
+
+    void uringCancelRecv(Connection& conn) {
+        io_uring_sqe* sqe = ring_->getSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = uringTag(UringRecv, conn.fd);
+        sqe->user_data = uringTag(UringCancel, conn.fd);
+    }
+
+    /**
+     * @brief Starts a send of everything buffered, unless one is already in flight.
+     *
+     * The in-flight bytes move to conn.sending so handlers can keep
+     * appending to conn.output, whose storage may move, while the kernel
+     * reads from a stable buffer. Contiguous bytes go out with SEND; a
+     * buffer with spliced values needs SENDMSG over its iovecs.
+     */
+    void uringSend(Connection& conn) {
+        if (conn.send_pending || conn.shut) return;
+        if (conn.sending.empty()) {
+            if (conn.output.empty()) return;
+            std::swap(conn.output, conn.sending);
+        }
+
+        const size_t iov_count = conn.sending.gather(conn.send_iov, SEND_IOV_MAX);
+        io_uring_sqe* sqe = ring_->getSqe();
+        sqe->fd = conn.fd;
+        if (iov_count == 1) {
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = reinterpret_cast<uint64_t>(conn.send_iov[0].iov_base);
+            sqe->len = static_cast<uint32_t>(std::min<size_t>(conn.send_iov[0].iov_len, UINT32_MAX));
+        } else {
+            conn.send_msg = msghdr{};
+            conn.send_msg.msg_iov = conn.send_iov;
+            conn.send_msg.msg_iovlen = iov_count;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->addr = reinterpret_cast<uint64_t>(&conn.send_msg);
+            sqe->len = 1;
+        }
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = uringTag(UringSend, conn.fd);
+        conn.send_pending = true;
+    }
+
+    /**
+     * @brief Shuts a connection down and closes it once the kernel no longer references it.
+     *
+     * The fd stays open until its recv and send have completed, so it cannot
+     * be reused while completions tagged with it are still outstanding.
+     */
+    void uringRetire(Connection& conn) {
+        if (!conn.shut) {
+            conn.shut = true;
+            shutdown(conn.fd, SHUT_RDWR);
+            if (conn.recv_armed) uringCancelRecv(conn);
+        }
+        if (conn.recv_armed || conn.send_pending) return;
+
+        const int fd = conn.fd;
+        close(fd);
+        connections_.erase(fd);
+        stats_.connections_closed.add();
+        load_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void markDirty(Connection& conn) {
+        if (!conn.dirty) {
+            conn.dirty = true;
+            dirty_fds_.push_back(conn.fd);
         }
     }
 
+    /**
+     * @brief Runs the handler over buffered input, pausing reads above OUTPUT_HIGH_WATER.
+     */
+    void uringProcessInput(Connection& conn) {
+        if (conn.read_paused || conn.shut || conn.input.empty()) return;
+        conn.input.consume(request_handler_(conn));
+        markDirty(conn);
+
+        if (conn.output.size() + conn.sending.size() >= OUTPUT_HIGH_WATER) {
+            // Multishot recv cannot be paused; cancel it and re-arm once output drains.
+            conn.read_paused = true;
+            if (conn.recv_armed) uringCancelRecv(conn);
+        }
+    }
+
+    void uringOnRecv(Connection& conn, const io_uring_cqe& cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) conn.recv_armed = false;
+        if (cqe.res > 0 && !conn.shut) {
+            conn.last_active = woke_at_;
+            stats_.bytes_in.add(static_cast<uint64_t>(cqe.res));
+            conn.input.append(ring_->buffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT)),
+                              static_cast<size_t>(cqe.res));
+            uringProcessInput(conn);
+        } else if (cqe.res == 0) {
+            conn.closing = true;
+            markDirty(conn);
+        } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            uringRetire(conn);
+            return;
+        }
+
+        if (conn.shut) {
+            uringRetire(conn);
+        } else if (!conn.recv_armed && !conn.closing && !conn.read_paused) {
+            uringArmRecv(conn);
+        }
+    }
+
+    void uringOnSend(Connection& conn, const io_uring_cqe& cqe) {
+        conn.send_pending = false;
+        if (cqe.res < 0 || conn.shut) {
+            uringRetire(conn);
+            return;
+        }
+
+        conn.sending.consume(static_cast<size_t>(cqe.res));
+        conn.last_active = woke_at_;
+        stats_.bytes_out.add(static_cast<uint64_t>(cqe.res));
+        markDirty(conn);
+        if (conn.read_paused && conn.output.size() + conn.sending.size() <= OUTPUT_LOW_WATER) {
+            conn.read_paused = false;
+            uringProcessInput(conn);
+            if (!conn.read_paused && !conn.recv_armed && !conn.closing) uringArmRecv(conn);
+        }
+    }
+
+    void uringOnAccept(const io_uring_cqe& cqe) {
+        if (cqe.res >= 0) {
+            onAccepted(cqe.res);
+        } else if (cqe.res != -ECANCELED) {
+            std::cerr << "Worker " << id_ << ": accept: " << std::strerror(-cqe.res) << std::endl;
+        }
+        if (cqe.flags & IORING_CQE_F_MORE) return;
+        if (accepting_) {
+            uringArmAccept();
+        } else {
+            listening_ = false;
+        }
+    }
+
+    void uringDispatch(const io_uring_cqe& cqe) {
+        const UringOp op = static_cast<UringOp>(cqe.user_data >> 32);
+        const int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+
+        if (op == UringAccept) {
+            uringOnAccept(cqe);
+            return;
+        }
+        if (op == UringWake) {
+            runTasks();
+            if (!(cqe.flags & IORING_CQE_F_MORE)) uringArmWake();
+            return;
+        }
+        if (op == UringCancel) return;
+
+        auto it = connections_.find(fd);
+        if (it == connections_.end()) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                ring_->recycleBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            return;
+        }
+        if (op == UringRecv) {
+            uringOnRecv(it->second, cqe);
+            // The data was copied out (or dropped), so the buffer can go straight back.
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                ring_->recycleBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+        } else if (op == UringSend) {
+            uringOnSend(it->second, cqe);
+        }
+    }
+
+    /**
+     * @brief Queues sends for every connection touched in this batch; they go out in one submit.
+     */
+    void uringFlushDirty() {
+        for (size_t i = 0; i < dirty_fds_.size(); ++i) {
+            auto it = connections_.find(dirty_fds_[i]);
+            if (it == connections_.end()) continue;
+            Connection& conn = it->second;
+            conn.dirty = false;
+
+            uringSend(conn);
+            if (conn.send_pending || conn.shut) continue;
+            if (conn.closing) {
+                if (!conn.hasDeferred()) uringRetire(conn);
+                continue;
+            }
+            conn.input.releaseIfLarger(MAX_IDLE_BUFFER);
+            conn.output.releaseIfLarger(MAX_IDLE_BUFFER);
+            conn.sending.releaseIfLarger(MAX_IDLE_BUFFER);
+        }
+        dirty_fds_.clear();
+    }
+
+    /**
+     * @brief io_uring event loop: one io_uring_enter per batch of completions.
+     *
+     * Accept and recv are multishot, so a steady connection costs no
+     * submissions at all on the read side; received bytes land in the
+     * shared provided-buffer ring and are copied into the connection's
+     * input. All sends produced while handling a batch are submitted
+     * together with the next wait.
+     */
+    void uringLoop() {
+        ring_->enable();
+        if (accepting_) uringArmAccept();
+        uringArmWake();
+
+        while (running_) {
+            Qsbr::quiescent();
+            reapIdle();
+            applyDrain();
+            const int timeout = runTimer();
+            beginWait();
+            Qsbr::offline();
+            const int submitted = ring_->submitAndWait(1, timeout);
+            Qsbr::online();
+            endWait();
+            if (submitted == -1 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+                std::cerr << "Worker " << id_ << ": io_uring_enter: " << std::strerror(errno) << std::endl;
+                break;
+            }
+            ring_->forEachCompletion([this](const io_uring_cqe& cqe) { uringDispatch(cqe); });
+            uringFlushDirty();
+        }
+    }
+
+    /**
+     * @brief Accounts the time since the loop last woke up as busy; call before blocking.
+     */
+    void beginWait() {
+        const auto now = std::chrono::steady_clock::now();
+        stats_.busy_ns.add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - woke_at_).count()));
+    }
+
+    void endWait() {
+        woke_at_ = std::chrono::steady_clock::now();
+        stats_.loop_iterations.add();
+    }
+
+    /**
+     * @brief Runs the periodic callback if it is due.
+     * @return How long the loop may block before the callback is due again, in ms (at most 100).
+     */
+    int runTimer() {
+        if (!timer_) return 100;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_timer_) {
+            timer_(*this);
+            now = std::chrono::steady_clock::now();
+            next_timer_ = now + timer_period_;
+        }
+        const auto wait = std::chrono::ceil<std::chrono::milliseconds>(next_timer_ - now).count();
+        return static_cast<int>(std::clamp<decltype(wait)>(wait, 0, 100));
+    }
+
+    /**
+     * @brief Pins the calling (event-loop) thread and applies the NUMA policy.
+     *
+     * With numa_local_ set, the thread's allocations prefer the node of the
+     * core it is pinned to, so connection buffers and anything the thread
+     * initializes (see AsyncServer::setThreadInit) live in local memory.
+     */
+    void setupThread() {
+        if (core_id_ != -1UL) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(core_id_, &cpuset);
+            int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+            if (err != 0) {
+                std::cerr << "Worker " << id_ << ": cannot pin to CPU " << core_id_
+                          << ": " << std::strerror(err) << std::endl;
+            }
+        }
+
+        unsigned cpu = 0, node = 0;
+        if (getcpu(&cpu, &node) == 0) numa_node_ = static_cast<int>(node);
+
+        if (numa_local_ && numa_node_ >= 0) {
+            unsigned long nodemask = 1UL << numa_node_;
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8) != 0) {
+                std::cerr << "Worker " << id_ << ": set_mempolicy: " << std::strerror(errno) << std::endl;
+            }
+        }
+
+        current() = this;
+        if (thread_init_) thread_init_(*this);
+    }
+
+    /**
+     * @brief Runs the loop as a Qsbr reader, quiescent between iterations and offline while blocked.
+     */
     void eventLoop() {
+        setupThread();
+        Qsbr::registerThread();
+        woke_at_ = std::chrono::steady_clock::now();
+        if (backend_ == IoBackend::IoUring) {
+            uringLoop();
+        } else {
+            epollLoop();
+        }
+        Qsbr::unregisterThread();
+    }
+
+    void epollLoop() {
         epoll_event events[MAX_EVENTS];
-        
+
         while (running_) {
-            int num_events = epoll_wait(epoll_fd_, events, MAX_EVENTS, 100);
+            Qsbr::quiescent();
+            reapIdle();
+            applyDrain();
+            const int timeout = runTimer();
+            beginWait();
+            Qsbr::offline();
+            int num_events = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
+            Qsbr::online();
+            endWait();
             if (num_events == -1) {
                 if (errno == EINTR) continue;
                 break;
@@ -125,19 +1044,15 @@ private:
                             throw std::system_error(errno, std::system_category(), "accept");
                         }
 
-                        setNonBlocking(client_fd);
-                        
-                        epoll_event client_event{};
-                        client_event.events = EPOLLIN | EPOLLET;
-                        client_event.data.fd = client_fd;
-                        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &client_event) == -1) {
-                            close(client_fd);
-                            throw std::system_error(errno, std::system_category(), "epoll_ctl");
-                        }
+                        onAccepted(client_fd);
                     }
+                } else if (events[i].data.fd == wake_fd_) {
+                    runTasks();
                 } else {
                     // Handle client I/O
-                    handleClient(events[i].data.fd);
+                    const int client_fd = events[i].data.fd;
+                    if (events[i].events & EPOLLOUT) handleWritable(client_fd);
+                    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) handleClient(client_fd);
                 }
             }
         }
@@ -147,18 +1062,25 @@ public:
     /**
      * @brief Constructs a Worker instance.
      * @param port Port number for the server.
-     * @param core_id CPU core ID for affinity.
+     * @param core_id CPU the event-loop thread is pinned to, or -1 for no pinning.
+     * @param worker_id Index of this worker within its AsyncServer.
+     * @param backend Kernel interface for socket I/O.
+     * @param listen_fd Listening socket to adopt instead of binding port, or -1.
+     * @throws std::system_error if the socket or the chosen backend cannot be set up.
      */
-    Worker(uint16_t port, size_t core_id) {
-        setupSocket(port);
-        setupEpoll();
-        
-        // Set thread affinity if requested
-        if (core_id != -1UL) {
-            cpu_set_t cpuset;
-            CPU_ZERO(&cpuset);
-            CPU_SET(core_id % std::thread::hardware_concurrency(), &cpuset);
-            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    Worker(uint16_t port, size_t core_id, size_t worker_id = 0, IoBackend backend = IoBackend::Epoll,
+           int listen_fd = -1)
+        : id_(worker_id), core_id_(core_id), backend_(backend) {
+        if (listen_fd != -1) {
+            adoptSocket(listen_fd);
+        } else {
+            setupSocket(port);
+        }
+        setupWakeFd();
+        if (backend_ == IoBackend::IoUring) {
+            setupRing();
+        } else {
+            setupEpoll();
         }
     }
     /**
@@ -166,6 +1088,9 @@ public:
      */
     ~Worker() {
         stop();
+        ring_.reset();
+        for (auto& [fd, conn] : connections_) close(fd);
+        if (wake_fd_ != -1) close(wake_fd_);
         if (epoll_fd_ != -1) close(epoll_fd_);
         if (server_fd_ != -1) close(server_fd_);
     }
@@ -189,11 +1114,163 @@ public:
     }
 
     /**
-     * @brief Sets the request handler function.
-     * @param handler Function to process client requests.
+     * @brief Stops accepting and closes connections as they are answered; see connections() in stats().
      */
-    void setRequestHandler(std::function<std::string(const std::string&)> handler) {
-        request_handler_ = std::move(handler);
+    void drain() {
+        draining_ = true;
+        post([] {});
+    }
+
+    /**
+     * @brief Undoes drain(): accepts new connections again.
+     */
+    void resume() {
+        draining_ = false;
+        post([] {});
+    }
+
+    /**
+     * @brief False once a drain() has taken effect and no further connection can be accepted.
+     */
+    bool listening() const noexcept { return listening_.load(); }
+
+    /**
+     * @brief The listening socket, for handing over to a replacement process.
+     */
+    int listenFd() const noexcept { return server_fd_; }
+
+    /**
+     * @brief Sets the handler that processes buffered client requests.
+     * @param handler See RequestHandler::bind().
+     */
+    void setRequestHandler(RequestHandler handler) noexcept { request_handler_ = handler; }
+
+    /**
+     * @brief Returns this worker's index within its AsyncServer.
+     */
+    size_t id() const noexcept { return id_; }
+
+    /**
+     * @brief Connection, traffic and event-loop counters; safe to read from any thread.
+     */
+    const WorkerStats& stats() const noexcept { return stats_; }
+
+    /**
+     * @brief NUMA node the event-loop thread runs on, or -1 before start().
+     */
+    int numaNode() const noexcept { return numa_node_; }
+
+    /**
+     * @brief CPU the event-loop thread is pinned to, or -1 for none.
+     */
+    size_t coreId() const noexcept { return core_id_; }
+
+    /**
+     * @brief Closes connections that neither sent nor received anything for timeout; 0 disables.
+     *
+     * Checked about once a second, so a connection may outlive the timeout by up to that long.
+     */
+    void setIdleTimeout(std::chrono::milliseconds timeout) { idle_timeout_ = timeout; }
+
+    /**
+     * @brief Hands each accepted connection to whichever of peers has the fewest; set before start().
+     * @param peers Every worker of the server, this one included; empty keeps connections where accepted.
+     */
+    void setPeers(std::vector<Worker*> peers) { peers_ = std::move(peers); }
+
+    /**
+     * @brief Steers new connections of the SO_REUSEPORT group to the worker pinned to the receiving CPU.
+     *
+     * The cBPF program returns the listener index of the worker pinned to
+     * the CPU that processed the SYN; listeners are indexed in the order
+     * workers were created. A CPU no worker is pinned to maps to CPU
+     * modulo the group size. Attaching to one listener covers the group.
+     * @param worker_cores Core of each worker in creation order, as coreId() returns.
+     * @throws std::system_error if the kernel rejects the program.
+     */
+    void attachCpuFilter(const std::vector<size_t>& worker_cores) {
+        std::vector<sock_filter> code;
+        code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)));
+        for (size_t i = 0; i < worker_cores.size(); ++i) {
+            if (worker_cores[i] == -1UL) continue;
+            code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(worker_cores[i]), 0, 1));
+            code.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(i)));
+        }
+        code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<uint32_t>(worker_cores.size())));
+        code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+
+        sock_fprog program{static_cast<unsigned short>(code.size()), code.data()};
+        if (setsockopt(server_fd_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+            throw std::system_error(errno, std::system_category(), "SO_ATTACH_REUSEPORT_CBPF");
+        }
+    }
+
+    /**
+     * @brief Makes the event-loop thread prefer memory on its own NUMA node.
+     * Takes effect at the next start().
+     */
+    void setNumaLocal(bool enabled) { numa_local_ = enabled; }
+
+    /**
+     * @brief Sets a callback run on the event-loop thread after pinning, before any I/O.
+     */
+    void setThreadInit(std::function<void(Worker&)> init) { thread_init_ = std::move(init); }
+
+    /**
+     * @brief Sets a callback the event loop runs about every period, between batches of I/O.
+     *
+     * Keep it short: connections on this worker wait while it runs.
+     */
+    void setTimer(std::chrono::milliseconds period, std::function<void(Worker&)> callback) {
+        timer_period_ = period;
+        timer_ = std::move(callback);
+    }
+
+    /**
+     * @brief The Worker whose event loop is running on the calling thread, if any.
+     */
+    static Worker*& current() {
+        static thread_local Worker* worker = nullptr;
+        return worker;
+    }
+
+    /**
+     * @brief Runs a task on this worker's event-loop thread. Safe from any thread.
+     *
+     * The eventfd is only written when the worker is not already due to wake,
+     * so a burst of posts costs one syscall.
+     */
+    void post(std::function<void()> task) {
+        tasks_.push(std::move(task));
+        if (!wake_pending_.exchange(true)) {
+            const uint64_t one = 1;
+            ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    /**
+     * @brief Delivers a reply reserved with Connection::deferReply().
+     *
+     * Must run on this worker's thread (typically from a posted task). The
+     * reply is dropped if the connection has closed in the meantime; output
+     * is flushed once the current batch of tasks finishes.
+     */
+    void completeReply(int fd, uint64_t connection_id, uint64_t seq, std::string_view bytes) {
+        auto it = connections_.find(fd);
+        if (it == connections_.end() || it->second.id != connection_id) return;
+
+        Connection& conn = it->second;
+        conn.completeReply(seq, bytes);
+        if (!conn.hasDeferred() && !conn.input.empty()) {
+            // The handler may have stopped at a request that waited for these replies.
+            if (backend_ == IoBackend::IoUring) {
+                uringProcessInput(conn);
+            } else if (!conn.read_paused) {
+                conn.input.consume(request_handler_(conn));
+            }
+        }
+        markDirty(conn);
     }
 };
 
@@ -211,13 +1288,23 @@ public:
      * @brief Constructs an AsyncServer instance.
      * @param port Port number for the server.
      * @param num_workers Number of worker threads (default: hardware concurrency).
+     * @param cpus CPUs to pin workers to, assigned round-robin; empty pins worker i to CPU i.
+     * @param backend Kernel interface every worker uses for socket I/O.
+     * @param listeners Listening sockets inherited on a hot restart; worker i adopts listeners[i],
+     *        workers beyond them bind their own and unused ones are closed.
      */
-    AsyncServer(uint16_t port, size_t num_workers = std::thread::hardware_concurrency()) {
+    AsyncServer(uint16_t port, size_t num_workers = std::thread::hardware_concurrency(),
+                const std::vector<size_t>& cpus = {}, IoBackend backend = IoBackend::Epoll,
+                const std::vector<int>& listeners = {}) {
         if (num_workers == 0) num_workers = 1;
-        
+        const size_t num_cpus = std::max(1u, std::thread::hardware_concurrency());
+
         for (size_t i = 0; i < num_workers; ++i) {
-            workers_.emplace_back(std::make_unique<Worker>(port, i));
+            const size_t core_id = cpus.empty() ? i % num_cpus : cpus[i % cpus.size()];
+            const int listen_fd = i < listeners.size() ? listeners[i] : -1;
+            workers_.emplace_back(std::make_unique<Worker>(port, core_id, i, backend, listen_fd));
         }
+        for (size_t i = num_workers; i < listeners.size(); ++i) close(listeners[i]);
     }
 
     /**
@@ -252,14 +1339,109 @@ public:
     }
 
     /**
-     * @brief Sets the request handler function for all workers.
-     * @param handler Function to process client requests.
+     * @brief Stops accepting and waits for every open connection to be answered and closed.
+     * @return False if connections were still open after timeout; stop() cuts them off.
      */
-    void setRequestHandler(std::function<std::string(const std::string&)> handler) {
+    bool drain(std::chrono::milliseconds timeout) {
+        for (auto& worker : workers_) worker->drain();
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true) {
+            uint64_t open = 0;
+            for (auto& worker : workers_) open += worker->listening() + worker->stats().connections();
+            if (open == 0) return true;
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    /**
+     * @brief Accepts connections again after drain().
+     */
+    void resume() {
+        for (auto& worker : workers_) worker->resume();
+    }
+
+    /**
+     * @brief Every worker's listening socket, in worker order; see the listeners constructor parameter.
+     */
+    std::vector<int> listenFds() const {
+        std::vector<int> fds;
+        for (const auto& worker : workers_) fds.push_back(worker->listenFd());
+        return fds;
+    }
+
+    /**
+     * @brief Sets the handler that processes buffered client requests, on all workers.
+     * @param handler See RequestHandler::bind().
+     */
+    void setRequestHandler(RequestHandler handler) noexcept {
         for (auto& worker : workers_) {
             worker->setRequestHandler(handler);
         }
     }
+
+    /**
+     * @brief Makes every worker allocate from its local NUMA node.
+     */
+    void setNumaLocal(bool enabled) {
+        for (auto& worker : workers_) {
+            worker->setNumaLocal(enabled);
+        }
+    }
+
+    /**
+     * @brief Closes client connections idle for longer than timeout, on every worker; 0 disables.
+     */
+    void setIdleTimeout(std::chrono::milliseconds timeout) {
+        for (auto& worker : workers_) {
+            worker->setIdleTimeout(timeout);
+        }
+    }
+
+    /**
+     * @brief Chooses how new connections are spread over the workers; call before start().
+     * @throws std::system_error if the kernel rejects the Cpu program.
+     */
+    void setBalance(ConnectionBalance balance) {
+        std::vector<Worker*> peers;
+        std::vector<size_t> cores;
+        for (auto& worker : workers_) {
+            peers.push_back(worker.get());
+            cores.push_back(worker->coreId());
+        }
+        if (balance == ConnectionBalance::Cpu) workers_.front()->attachCpuFilter(cores);
+        for (auto& worker : workers_) {
+            worker->setPeers(balance == ConnectionBalance::LeastLoaded ? peers : std::vector<Worker*>());
+        }
+    }
+
+    /**
+     * @brief Sets a callback each worker runs on its own thread before serving clients.
+     */
+    void setThreadInit(const std::function<void(Worker&)>& init) {
+        for (auto& worker : workers_) {
+            worker->setThreadInit(init);
+        }
+    }
+
+    /**
+     * @brief Sets a periodic callback every worker runs on its own event-loop thread.
+     */
+    void setTimer(std::chrono::milliseconds period, const std::function<void(Worker&)>& callback) {
+        for (auto& worker : workers_) {
+            worker->setTimer(period, callback);
+        }
+    }
+
+    /**
+     * @brief Returns the number of workers.
+     */
+    size_t workerCount() const noexcept { return workers_.size(); }
+
+    /**
+     * @brief Returns the worker with the given index.
+     */
+    Worker& worker(size_t index) { return *workers_[index]; }
 };
 
 #endif // TCP_SERVER_H
\ No newline at end of file
@@ -0,0 +1,99 @@
+/**
+ * @file blocking_socket.h
+ * @brief Blocking TCP helpers for the links servers open to each other (replication, cluster).
+ */
+#ifndef BLOCKING_SOCKET_H
+#define BLOCKING_SOCKET_H
+
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/**
+ * @class BlockingSocket
+ * @brief Connect, send and receive on blocking sockets, off the Workers' event loops.
+ */
+class BlockingSocket {
+public:
+    /**
+     * @brief Connects to host:port, trying every address it resolves to.
+     * @return The connected socket, with TCP_NODELAY and timeout_ms send and receive timeouts.
+     * @throws std::runtime_error if the host does not resolve or no address accepts.
+     */
+    static int connectTo(const std::string& host, uint16_t port, int timeout_ms) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        const std::string service = std::to_string(port);
+        if (const int err = getaddrinfo(host.c_str(), service.c_str(), &hints, &found); err != 0) {
+            throw std::runtime_error("cannot resolve " + host + ": " + gai_strerror(err));
+        }
+
+        int fd = -1;
+        for (const addrinfo* ai = found; ai != nullptr && fd == -1; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd != -1 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+        if (fd == -1) throw std::runtime_error("cannot connect to " + host + ":" + service);
+        setTimeouts(fd, timeout_ms);
+        return fd;
+    }
+
+    static void setTimeouts(int fd, int timeout_ms) {
+        timeval timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+
+    static bool sendAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            const ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (sent == -1) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data.remove_prefix(static_cast<size_t>(sent));
+        }
+        return true;
+    }
+
+    /**
+     * @brief Appends up to max_bytes received to input.
+     * @throws std::runtime_error if the peer closed the connection or stayed silent past the timeout.
+     * @throws std::system_error on other receive errors.
+     */
+    static void receiveInto(int fd, std::string& input, size_t max_bytes, const char* peer) {
+        const size_t old_size = input.size();
+        input.resize(old_size + max_bytes);
+        const ssize_t n = ::recv(fd, input.data() + old_size, max_bytes, 0);
+        input.resize(old_size + static_cast<size_t>(n > 0 ? n : 0));
+        if (n == 0) throw std::runtime_error(std::string(peer) + " closed the connection");
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) throw std::runtime_error(std::string("timed out reading from ") + peer);
+            throw std::system_error(errno, std::system_category(), std::string("recv from ") + peer);
+        }
+    }
+
+    static bool parseUnsigned(std::string_view text, uint64_t& value) {
+        const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return !text.empty() && ec == std::errc() && end == text.data() + text.size();
+    }
+};
+
+#endif // BLOCKING_SOCKET_H
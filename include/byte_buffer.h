@@ -0,0 +1,293 @@
+/**
+ * @file byte_buffer.h
+ * @brief A growable contiguous byte buffer used for connection input and output.
+ */
+#ifndef BYTE_BUFFER_H
+#define BYTE_BUFFER_H
+
+#include "free_list.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+
+#define BYTE_BUFFER_BLOCK 4096
+#define BYTE_BUFFER_POOL_BLOCKS 256
+
+/**
+ * @class PinnedBytes
+ * @brief Read-only bytes owned elsewhere, kept valid until this handle is destroyed.
+ *
+ * The owner supplies a release callback that runs exactly once, from
+ * whichever thread drops the last handle.
+ */
+class PinnedBytes {
+public:
+    using Release = void (*)(void* owner);
+
+    PinnedBytes() = default;
+    PinnedBytes(std::string_view bytes, Release release, void* owner) noexcept
+        : bytes_(bytes), release_(release), owner_(owner) {}
+
+    PinnedBytes(PinnedBytes&& other) noexcept
+        : bytes_(other.bytes_), release_(std::exchange(other.release_, nullptr)), owner_(other.owner_) {}
+
+    PinnedBytes& operator=(PinnedBytes&& other) noexcept {
+        if (this != &other) {
+            reset();
+            bytes_ = other.bytes_;
+            release_ = std::exchange(other.release_, nullptr);
+            owner_ = other.owner_;
+        }
+        return *this;
+    }
+
+    ~PinnedBytes() { reset(); }
+
+    std::string_view view() const noexcept { return bytes_; }
+
+    void reset() noexcept {
+        if (release_) std::exchange(release_, nullptr)(owner_);
+        bytes_ = {};
+    }
+
+private:
+    std::string_view bytes_;
+    Release release_ = nullptr;
+    void* owner_ = nullptr;
+};
+
+/**
+ * @class ByteBuffer
+ * @brief Contiguous buffer with a consumed prefix and an uncommitted tail.
+ *
+ * Readable bytes live in [head_, tail_). Producers reserve space with
+ * prepare(), write into it and commit() what they wrote; consumers read
+ * view() and consume() the bytes they are done with. Memory is compacted
+ * or grown only when prepare() runs out of tail room, so steady-state
+ * use performs no allocation. First allocations are BYTE_BUFFER_BLOCK bytes
+ * and come from a per-thread pool they return to when the buffer is
+ * released or destroyed, so opening and closing connections, or recycling
+ * a scratch buffer, does not reach malloc either.
+ *
+ * A buffer with splicing enabled can also queue PinnedBytes by reference
+ * between its own bytes, so a large response can reach the socket without
+ * being copied in. Such a buffer is drained through gather() and
+ * consume(), which walk own and pinned bytes in stream order; view() then
+ * only covers the own bytes before the first splice. Without splicing,
+ * appendPinned() copies.
+ */
+class ByteBuffer {
+private:
+    struct Splice {
+        uint64_t at;        ///< Pinned bytes follow own byte number `at` of the stream.
+        PinnedBytes bytes;
+        size_t sent = 0;    ///< Leading bytes already consumed.
+    };
+
+    using BlockPool = FreeList<char, BYTE_BUFFER_POOL_BLOCKS, std::default_delete<char[]>>;
+
+    /**
+     * @brief Frees storage, returning pool-sized blocks to the calling thread's pool.
+     */
+    struct Storage {
+        size_t size;
+        Storage() noexcept : size(0) {}
+        explicit Storage(size_t bytes) noexcept : size(bytes) {}
+        void operator()(char* bytes) const noexcept {
+            if (size == BYTE_BUFFER_BLOCK) {
+                BlockPool::give(bytes);
+            } else {
+                delete[] bytes;
+            }
+        }
+    };
+
+    static std::unique_ptr<char[], Storage> allocate(size_t size) {
+        char* bytes = size == BYTE_BUFFER_BLOCK ? BlockPool::take() : nullptr;
+        if (bytes == nullptr) bytes = new char[size];
+        return std::unique_ptr<char[], Storage>(bytes, Storage(size));
+    }
+
+    std::unique_ptr<char[], Storage> data_;
+    size_t capacity_ = 0;
+    size_t head_ = 0;
+    size_t tail_ = 0;
+
+    bool splicing_ = false;
+    std::vector<Splice> splices_;
+    size_t splice_head_ = 0;    ///< First unconsumed entry of splices_.
+    size_t spliced_bytes_ = 0;  ///< Unconsumed pinned bytes.
+    uint64_t consumed_ = 0;     ///< Own bytes consumed since the last clear().
+
+    void consumeOwn(size_t n) noexcept {
+        head_ += n;
+        consumed_ += n;
+        if (head_ >= tail_) head_ = tail_ = 0;
+    }
+
+    /**
+     * @brief Own bytes readable before the first pending splice, or SIZE_MAX if there is none.
+     */
+    size_t ownBeforeSplice() const noexcept {
+        if (splice_head_ == splices_.size()) return SIZE_MAX;
+        return static_cast<size_t>(splices_[splice_head_].at - consumed_);
+    }
+
+public:
+    ByteBuffer() = default;
+    ByteBuffer(ByteBuffer&&) noexcept = default;
+    ByteBuffer& operator=(ByteBuffer&&) noexcept = default;
+
+    /**
+     * @brief Returns the readable bytes; with splices pending, only those before the first one.
+     */
+    std::string_view view() const noexcept {
+        return std::string_view(data_.get() + head_, std::min(tail_ - head_, ownBeforeSplice()));
+    }
+
+    /**
+     * @brief Readable bytes, pinned ones included.
+     */
+    size_t size() const noexcept { return tail_ - head_ + spliced_bytes_; }
+    bool empty() const noexcept { return size() == 0; }
+
+    /**
+     * @brief Lets appendPinned() queue bytes by reference instead of copying them.
+     */
+    void setSplicing(bool enabled) noexcept { splicing_ = enabled; }
+    bool splicing() const noexcept { return splicing_; }
+
+    /**
+     * @brief Appends bytes owned elsewhere: by reference when splicing, else by copy.
+     */
+    void appendPinned(PinnedBytes bytes) {
+        const size_t n = bytes.view().size();
+        if (!splicing_ || n == 0) {
+            append(bytes.view());
+            return;
+        }
+        splices_.push_back({consumed_ + (tail_ - head_), std::move(bytes)});
+        spliced_bytes_ += n;
+    }
+
+    /**
+     * @brief Describes the readable bytes, in order, as up to max_iov iovecs.
+     * @return Number of iovecs filled; 0 only when the buffer is empty.
+     */
+    size_t gather(iovec* iov, size_t max_iov) const noexcept {
+        size_t count = 0;
+        size_t pos = head_;
+        uint64_t stream = consumed_;
+        for (size_t i = splice_head_; i < splices_.size() && count < max_iov; ++i) {
+            const Splice& splice = splices_[i];
+            const size_t own = static_cast<size_t>(splice.at - stream);
+            if (own > 0) {
+                iov[count++] = {data_.get() + pos, own};
+                pos += own;
+                stream += own;
+                if (count == max_iov) return count;
+            }
+            const std::string_view rest = splice.bytes.view().substr(splice.sent);
+            iov[count++] = {const_cast<char*>(rest.data()), rest.size()};
+        }
+        if (count < max_iov && pos < tail_) iov[count++] = {data_.get() + pos, tail_ - pos};
+        return count;
+    }
+
+    /**
+     * @brief Returns the number of bytes that can be written after prepare().
+     */
+    size_t writable() const noexcept { return capacity_ - tail_; }
+
+    /**
+     * @brief Ensures at least min_free writable bytes after the readable region.
+     * @param min_free Minimum number of bytes the caller intends to write.
+     * @return Pointer to the first writable byte.
+     */
+    char* prepare(size_t min_free) {
+        if (capacity_ - tail_ >= min_free) {
+            return data_.get() + tail_;
+        }
+
+        const size_t used = tail_ - head_;
+        if (head_ > 0 && capacity_ - used >= min_free) {
+            std::memmove(data_.get(), data_.get() + head_, used);
+        } else {
+            size_t new_capacity = capacity_ ? capacity_ * 2 : BYTE_BUFFER_BLOCK;
+            while (new_capacity - used < min_free) new_capacity *= 2;
+
+            std::unique_ptr<char[], Storage> grown = allocate(new_capacity);
+            if (used) std::memcpy(grown.get(), data_.get() + head_, used);
+            data_ = std::move(grown);
+            capacity_ = new_capacity;
+        }
+        head_ = 0;
+        tail_ = used;
+        return data_.get() + tail_;
+    }
+
+    /**
+     * @brief Marks n bytes written after prepare() as readable.
+     */
+    void commit(size_t n) noexcept { tail_ += n; }
+
+    /**
+     * @brief Drops n bytes from the front of the readable region, releasing consumed pins.
+     */
+    void consume(size_t n) noexcept {
+        while (n > 0 && splice_head_ < splices_.size()) {
+            const size_t own = ownBeforeSplice();
+            if (own > 0) {
+                const size_t take = std::min(n, own);
+                consumeOwn(take);
+                n -= take;
+                continue;
+            }
+            Splice& splice = splices_[splice_head_];
+            const size_t take = std::min(n, splice.bytes.view().size() - splice.sent);
+            splice.sent += take;
+            spliced_bytes_ -= take;
+            n -= take;
+            if (splice.sent == splice.bytes.view().size()) {
+                splice.bytes.reset();
+                if (++splice_head_ == splices_.size()) {
+                    splices_.clear();
+                    splice_head_ = 0;
+                }
+            }
+        }
+        if (n > 0) consumeOwn(n);
+    }
+
+    void append(const char* bytes, size_t n) {
+        std::memcpy(prepare(n), bytes, n);
+        tail_ += n;
+    }
+
+    void append(std::string_view bytes) { append(bytes.data(), bytes.size()); }
+
+    void clear() noexcept {
+        head_ = tail_ = 0;
+        splices_.clear();
+        splice_head_ = spliced_bytes_ = 0;
+        consumed_ = 0;
+    }
+
+    /**
+     * @brief Frees the storage of an empty buffer that grew beyond max_retained.
+     */
+    void releaseIfLarger(size_t max_retained) noexcept {
+        if (empty() && capacity_ > max_retained) {
+            data_.reset();
+            capacity_ = head_ = tail_ = 0;
+        }
+    }
+};
+
+#endif // BYTE_BUFFER_H
@@ -0,0 +1,542 @@
+/**
+ * @file cluster.h
+ * @brief Hash-slot cluster mode: slot ownership, redirects and online slot migration.
+ */
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "blocking_socket.h"
+#include "kv_store.h"
+#include "server_stats.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#define CLUSTER_SLOTS 16384
+#define CLUSTER_NO_NODE 0xFFFF
+#define CLUSTER_MIGRATE_BATCH 128
+#define CLUSTER_LINK_TIMEOUT_MS 10000
+
+/**
+ * @class Cluster
+ * @brief This node's view of which node serves each of the 16384 hash slots.
+ *
+ * Keys map to slots as in Redis Cluster: CRC16 of the key, or of the part
+ * inside the first non-empty {...}, modulo 16384. The slot map is read on
+ * every keyed command with relaxed loads and only changes under mutex_.
+ *
+ * The map comes from a config file with one line per node:
+ *
+ *     127.0.0.1:7001 myself 0-8191
+ *     127.0.0.1:7002 8192-16383
+ *
+ * Nodes are named by the address clients reach them at; there is no
+ * gossip, so every node starts from the same file and ownership changes
+ * are pushed to all of them by whoever makes them (see migrate()). The file
+ * is rewritten whenever this node's map changes.
+ *
+ * A slot moves online with migrate(): the target is told it is importing
+ * the slot, then the slot's keys are copied over in batches with plain
+ * SETs. Each batch holds only its own shard's lock while it is sent and
+ * deleted, so clients of other shards are never blocked, and clients of
+ * that shard wait for one round trip at most. While a slot migrates, keys
+ * still here are served here and missing ones are redirected with ASK.
+ */
+class Cluster {
+public:
+    /**
+     * @brief What to do with a command whose keys all hash to one slot.
+     */
+    enum class Route {
+        Serve,  ///< This node serves the slot, or is importing it.
+        Moved,  ///< Another node serves it; reply MOVED.
+        Ask,    ///< The slot is migrating away; keys not here are at the target.
+        Down    ///< No node serves it.
+    };
+
+    struct SlotRange {
+        uint16_t first;
+        uint16_t last;
+        std::string host;
+        uint16_t port;
+    };
+
+    /**
+     * @param store Store whose keys migrate() moves.
+     * @param config_path Slot map to load and rewrite on changes.
+     * @throws std::runtime_error if the file is missing or malformed.
+     */
+    Cluster(KVStore& store, std::string config_path)
+        : store_(store), config_path_(std::move(config_path)),
+          owner_(new std::atomic<uint16_t>[CLUSTER_SLOTS]), migrating_(new std::atomic<uint16_t>[CLUSTER_SLOTS]),
+          importing_(new std::atomic<uint16_t>[CLUSTER_SLOTS]) {
+        for (size_t slot = 0; slot < CLUSTER_SLOTS; ++slot) {
+            owner_[slot] = CLUSTER_NO_NODE;
+            migrating_[slot] = CLUSTER_NO_NODE;
+            importing_[slot] = CLUSTER_NO_NODE;
+        }
+        load();
+    }
+
+    ~Cluster() {
+        if (migration_.joinable()) migration_.join();
+    }
+
+    /**
+     * @brief The slot a key belongs to, honouring {hash tags}.
+     */
+    static uint16_t keySlot(std::string_view key) noexcept {
+        const size_t open = key.find('{');
+        if (open != std::string_view::npos) {
+            const size_t close = key.find('}', open + 1);
+            if (close != std::string_view::npos && close > open + 1) key = key.substr(open + 1, close - open - 1);
+        }
+        uint16_t crc = 0;
+        for (const char c : key) {
+            crc = static_cast<uint16_t>((crc << 8) ^ kCrc16Table[((crc >> 8) ^ static_cast<uint8_t>(c)) & 0xFF]);
+        }
+        return crc & (CLUSTER_SLOTS - 1);
+    }
+
+    /**
+     * @param address Receives host:port for Moved and Ask.
+     */
+    Route route(uint16_t slot, std::string& address) const {
+        const uint16_t owner = owner_[slot].load(std::memory_order_relaxed);
+        if (owner == self_) {
+            const uint16_t target = migrating_[slot].load(std::memory_order_relaxed);
+            if (target == CLUSTER_NO_NODE) return Route::Serve;
+            address = addressOf(target);
+            return Route::Ask;
+        }
+        if (importing_[slot].load(std::memory_order_relaxed) != CLUSTER_NO_NODE) return Route::Serve;
+        if (owner == CLUSTER_NO_NODE) return Route::Down;
+        address = addressOf(owner);
+        return Route::Moved;
+    }
+
+    /**
+     * @brief Contiguous runs of slots with the same owner, for CLUSTER SLOTS.
+     */
+    std::vector<SlotRange> slotRanges() const {
+        std::lock_guard guard(mutex_);
+        std::vector<SlotRange> ranges;
+        for (size_t slot = 0; slot < CLUSTER_SLOTS;) {
+            const uint16_t owner = owner_[slot].load(std::memory_order_relaxed);
+            size_t last = slot;
+            while (last + 1 < CLUSTER_SLOTS && owner_[last + 1].load(std::memory_order_relaxed) == owner) ++last;
+            if (owner != CLUSTER_NO_NODE) {
+                ranges.push_back({static_cast<uint16_t>(slot), static_cast<uint16_t>(last), nodes_[owner].host,
+                                  nodes_[owner].port});
+            }
+            slot = last + 1;
+        }
+        return ranges;
+    }
+
+    /**
+     * @brief CLUSTER NODES in the Redis layout, with addresses standing in for node IDs.
+     */
+    std::string nodesText() const {
+        std::lock_guard guard(mutex_);
+        std::string text;
+        for (size_t node = 0; node < nodes_.size(); ++node) {
+            const std::string address = nodes_[node].address();
+            text += address + " " + address + (node == self_ ? " myself,master" : " master") + " - 0 0 0 connected";
+            text += rangesOf(node);
+            for (size_t slot = 0; node == self_ && slot < CLUSTER_SLOTS; ++slot) {
+                const uint16_t target = migrating_[slot].load(std::memory_order_relaxed);
+                const uint16_t source = importing_[slot].load(std::memory_order_relaxed);
+                if (target != CLUSTER_NO_NODE) text += " [" + std::to_string(slot) + "->-" + nodes_[target].address() + "]";
+                if (source != CLUSTER_NO_NODE) text += " [" + std::to_string(slot) + "-<-" + nodes_[source].address() + "]";
+            }
+            text += "\n";
+        }
+        return text;
+    }
+
+    /**
+     * @brief CLUSTER INFO, plus the progress of the last migrate().
+     */
+    std::string infoText() const {
+        std::lock_guard guard(mutex_);
+        size_t assigned = 0;
+        std::vector<bool> serving(nodes_.size(), false);
+        for (size_t slot = 0; slot < CLUSTER_SLOTS; ++slot) {
+            const uint16_t owner = owner_[slot].load(std::memory_order_relaxed);
+            if (owner == CLUSTER_NO_NODE) continue;
+            ++assigned;
+            serving[owner] = true;
+        }
+        std::string out;
+        ServerInfo::field(out, "cluster_state", assigned == CLUSTER_SLOTS ? "ok" : "fail");
+        ServerInfo::field(out, "cluster_slots_assigned", static_cast<uint64_t>(assigned));
+        ServerInfo::field(out, "cluster_slots_ok", static_cast<uint64_t>(assigned));
+        ServerInfo::field(out, "cluster_known_nodes", static_cast<uint64_t>(nodes_.size()));
+        ServerInfo::field(out, "cluster_size", static_cast<uint64_t>(std::count(serving.begin(), serving.end(), true)));
+        writeMigrationLocked(out);
+        return out;
+    }
+
+    std::string myId() const {
+        std::lock_guard guard(mutex_);
+        return nodes_[self_].address();
+    }
+
+    /**
+     * @brief Appends the Cluster section of INFO.
+     */
+    void writeInfo(std::string& out) const {
+        std::lock_guard guard(mutex_);
+        ServerInfo::field(out, "cluster_enabled", uint64_t{1});
+        writeMigrationLocked(out);
+    }
+
+    /**
+     * @brief CLUSTER SETSLOT slot IMPORTING|MIGRATING|NODE address, or STABLE.
+     *
+     * NODE assigns the slot and clears this node's migration state for it;
+     * an unknown address is added to the node list.
+     * @throws std::invalid_argument on an unknown state or when MIGRATING a slot not served here.
+     */
+    void setSlot(uint16_t slot, std::string_view state, std::string_view address) {
+        std::lock_guard guard(mutex_);
+        if (equalsIgnoreCase(state, "STABLE")) {
+            migrating_[slot].store(CLUSTER_NO_NODE, std::memory_order_relaxed);
+            importing_[slot].store(CLUSTER_NO_NODE, std::memory_order_relaxed);
+            return;
+        }
+        const uint16_t node = nodeLocked(address);
+        if (equalsIgnoreCase(state, "IMPORTING")) {
+            importing_[slot].store(node, std::memory_order_relaxed);
+        } else if (equalsIgnoreCase(state, "MIGRATING")) {
+            if (owner_[slot].load(std::memory_order_relaxed) != self_) {
+                throw std::invalid_argument("I'm not the owner of hash slot " + std::to_string(slot));
+            }
+            migrating_[slot].store(node, std::memory_order_relaxed);
+        } else if (equalsIgnoreCase(state, "NODE")) {
+            owner_[slot].store(node, std::memory_order_relaxed);
+            migrating_[slot].store(CLUSTER_NO_NODE, std::memory_order_relaxed);
+            importing_[slot].store(CLUSTER_NO_NODE, std::memory_order_relaxed);
+            saveLocked();
+        } else {
+            throw std::invalid_argument("Invalid CLUSTER SETSLOT action or number of arguments");
+        }
+    }
+
+    /**
+     * @brief Starts moving a slot served here to address in the background.
+     *
+     * The handover is announced to every known node once the slot is
+     * empty here. If a batch fails the slot stays migrating, so its keys
+     * remain reachable through ASK, and calling migrate() again resumes.
+     * @throws std::invalid_argument if a migration is running, the slot is
+     *         not served here or address is this node.
+     */
+    void migrate(uint16_t slot, std::string_view address) {
+        std::lock_guard guard(mutex_);
+        if (migration_running_) throw std::invalid_argument("a slot migration is already in progress");
+        if (owner_[slot].load(std::memory_order_relaxed) != self_) {
+            throw std::invalid_argument("I'm not the owner of hash slot " + std::to_string(slot));
+        }
+        const uint16_t target = nodeLocked(address);
+        if (target == self_) throw std::invalid_argument("can't migrate a slot to myself");
+
+        if (migration_.joinable()) migration_.join();
+        migration_running_ = true;
+        migration_slot_ = slot;
+        migration_target_ = target;
+        migration_keys_ = 0;
+        migration_error_.clear();
+        migration_ = std::thread(&Cluster::runMigration, this, slot, target);
+    }
+
+    /**
+     * @brief Live keys of a slot on this node. Scans every shard.
+     */
+    size_t countKeysInSlot(uint16_t slot) {
+        std::vector<std::string> keys;
+        for (size_t shard = 0; shard < store_.shardCount(); ++shard) {
+            store_.collectKeys(shard, [slot](std::string_view key) { return keySlot(key) == slot; }, keys);
+        }
+        return keys.size();
+    }
+
+private:
+    struct Node {
+        std::string host;
+        uint16_t port;
+
+        std::string address() const { return host + ":" + std::to_string(port); }
+    };
+
+    /**
+     * @brief A connection to another node's client port with pipelined calls.
+     */
+    class Link {
+    public:
+        explicit Link(const Node& node) : fd_(BlockingSocket::connectTo(node.host, node.port, CLUSTER_LINK_TIMEOUT_MS)) {}
+        ~Link() { ::close(fd_); }
+        Link(const Link&) = delete;
+        Link& operator=(const Link&) = delete;
+
+        /**
+         * @brief Sends pipelined commands and waits for all their replies.
+         * @throws std::runtime_error if the peer fails or answers any of them with an error.
+         */
+        void call(std::string_view request, size_t replies) {
+            if (!BlockingSocket::sendAll(fd_, request)) throw std::system_error(errno, std::system_category(), "send");
+            std::string error;
+            for (size_t i = 0; i < replies; ++i) {
+                size_t end;
+                while ((end = input_.find("\r\n")) == std::string::npos) {
+                    BlockingSocket::receiveInto(fd_, input_, 4096, "cluster node");
+                }
+                if (input_[0] != '+' && error.empty()) error = input_.substr(0, end);
+                input_.erase(0, end + 2);
+            }
+            if (!error.empty()) throw std::runtime_error("node replied " + error);
+        }
+
+    private:
+        int fd_;
+        std::string input_;
+    };
+
+    static constexpr std::array<uint16_t, 256> kCrc16Table = [] {
+        std::array<uint16_t, 256> table{};
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            uint32_t crc = byte << 8;
+            for (int bit = 0; bit < 8; ++bit) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+            table[byte] = static_cast<uint16_t>(crc);
+        }
+        return table;
+    }();
+
+    KVStore& store_;
+    const std::string config_path_;
+    mutable std::mutex mutex_;  ///< Guards nodes_, map changes, the config file and migration status.
+    std::vector<Node> nodes_;
+    uint16_t self_ = CLUSTER_NO_NODE;
+    std::unique_ptr<std::atomic<uint16_t>[]> owner_;
+    std::unique_ptr<std::atomic<uint16_t>[]> migrating_;  ///< Target of a slot moving away, per slot.
+    std::unique_ptr<std::atomic<uint16_t>[]> importing_;  ///< Source of a slot moving here, per slot.
+
+    std::thread migration_;
+    bool migration_running_ = false;
+    uint16_t migration_slot_ = 0;
+    uint16_t migration_target_ = CLUSTER_NO_NODE;
+    std::atomic<uint64_t> migration_keys_{0};
+    std::string migration_error_;
+
+    static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+                   return std::toupper(static_cast<unsigned char>(x)) == std::toupper(static_cast<unsigned char>(y));
+               });
+    }
+
+    static Node parseAddress(std::string_view address) {
+        const size_t colon = address.rfind(':');
+        uint64_t port = 0;
+        if (colon == std::string_view::npos || colon == 0 ||
+            !BlockingSocket::parseUnsigned(address.substr(colon + 1), port) || port == 0 || port > 65535) {
+            throw std::invalid_argument("invalid node address '" + std::string(address) + "'");
+        }
+        return {std::string(address.substr(0, colon)), static_cast<uint16_t>(port)};
+    }
+
+    std::string addressOf(uint16_t node) const {
+        std::lock_guard guard(mutex_);
+        return nodes_[node].address();
+    }
+
+    uint16_t nodeLocked(std::string_view address) {
+        const Node parsed = parseAddress(address);
+        for (size_t node = 0; node < nodes_.size(); ++node) {
+            if (nodes_[node].host == parsed.host && nodes_[node].port == parsed.port) return static_cast<uint16_t>(node);
+        }
+        if (nodes_.size() >= CLUSTER_NO_NODE) throw std::invalid_argument("too many cluster nodes");
+        nodes_.push_back(parsed);
+        return static_cast<uint16_t>(nodes_.size() - 1);
+    }
+
+    std::string rangesOf(size_t node) const {
+        std::string text;
+        for (size_t slot = 0; slot < CLUSTER_SLOTS;) {
+            if (owner_[slot].load(std::memory_order_relaxed) != node) {
+                ++slot;
+                continue;
+            }
+            size_t last = slot;
+            while (last + 1 < CLUSTER_SLOTS && owner_[last + 1].load(std::memory_order_relaxed) == node) ++last;
+            text += " " + std::to_string(slot);
+            if (last != slot) text += "-" + std::to_string(last);
+            slot = last + 1;
+        }
+        return text;
+    }
+
+    void writeMigrationLocked(std::string& out) const {
+        if (migration_target_ == CLUSTER_NO_NODE) return;
+        ServerInfo::field(out, "migration_slot", uint64_t{migration_slot_});
+        ServerInfo::field(out, "migration_target", nodes_[migration_target_].address());
+        ServerInfo::field(out, "migration_status",
+                          migration_running_ ? "running" : migration_error_.empty() ? "done" : "failed");
+        ServerInfo::field(out, "migration_moved_keys", migration_keys_.load());
+        if (!migration_error_.empty()) ServerInfo::field(out, "migration_last_error", migration_error_);
+    }
+
+    void load() {
+        std::ifstream in(config_path_);
+        if (!in) throw std::runtime_error("cannot open cluster config " + config_path_);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string address;
+            if (!(fields >> address) || address[0] == '#') continue;
+            const uint16_t node = nodeLocked(address);
+
+            std::string item;
+            while (fields >> item) {
+                if (item == "myself") {
+                    if (self_ != CLUSTER_NO_NODE) throw std::runtime_error("cluster config names two nodes myself");
+                    self_ = node;
+                    continue;
+                }
+                const size_t dash = item.find('-');
+                uint64_t first = 0, last = 0;
+                if (!BlockingSocket::parseUnsigned(std::string_view(item).substr(0, dash), first) ||
+                    !BlockingSocket::parseUnsigned(dash == std::string::npos ? std::string_view(item)
+                                                                               : std::string_view(item).substr(dash + 1),
+                                                   last) ||
+                    first > last || last >= CLUSTER_SLOTS) {
+                    throw std::runtime_error("invalid slot range '" + item + "' in " + config_path_);
+                }
+                for (uint64_t slot = first; slot <= last; ++slot) owner_[slot].store(node, std::memory_order_relaxed);
+            }
+        }
+        if (self_ == CLUSTER_NO_NODE) throw std::runtime_error("cluster config " + config_path_ + " has no myself node");
+    }
+
+    /**
+     * @brief Rewrites the config file from the current map (temporary file and rename).
+     */
+    void saveLocked() const {
+        std::string text;
+        for (size_t node = 0; node < nodes_.size(); ++node) {
+            text += nodes_[node].address() + (node == self_ ? " myself" : "") + rangesOf(node) + "\n";
+        }
+        const std::string tmp = config_path_ + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << text;
+            if (!out.flush()) {
+                std::cerr << "Cluster: cannot write " << tmp << std::endl;
+                return;
+            }
+        }
+        if (std::rename(tmp.c_str(), config_path_.c_str()) != 0) {
+            std::cerr << "Cluster: cannot replace " << config_path_ << std::endl;
+        }
+    }
+
+    static void appendCommand(std::string& out, std::initializer_list<std::string_view> args) {
+        out += "*" + std::to_string(args.size()) + "\r\n";
+        for (std::string_view arg : args) {
+            out += "$" + std::to_string(arg.size()) + "\r\n";
+            out.append(arg);
+            out += "\r\n";
+        }
+    }
+
+    /**
+     * @brief Copies batches of the slot's keys to the target until none are left, then hands the slot over.
+     */
+    void runMigration(uint16_t slot, uint16_t target) {
+        std::string self, to;
+        Node target_node;
+        std::vector<Node> others;
+        {
+            std::lock_guard guard(mutex_);
+            self = nodes_[self_].address();
+            target_node = nodes_[target];
+            to = target_node.address();
+            for (size_t node = 0; node < nodes_.size(); ++node) {
+                if (node != self_ && node != target) others.push_back(nodes_[node]);
+            }
+        }
+        const std::string slot_text = std::to_string(slot);
+
+        try {
+            Link link(target_node);
+            std::string request;
+            appendCommand(request, {"CLUSTER", "SETSLOT", slot_text, "IMPORTING", self});
+            link.call(request, 1);
+            setSlot(slot, "MIGRATING", to);
+
+            std::vector<std::string> keys;
+            bool found = true;
+            while (found) {
+                found = false;
+                for (size_t shard = 0; shard < store_.shardCount(); ++shard) {
+                    keys.clear();
+                    store_.collectKeys(shard, [slot](std::string_view key) { return keySlot(key) == slot; }, keys);
+                    found = found || !keys.empty();
+                    for (size_t first = 0; first < keys.size(); first += CLUSTER_MIGRATE_BATCH) {
+                        const size_t count = std::min<size_t>(CLUSTER_MIGRATE_BATCH, keys.size() - first);
+                        migration_keys_ += store_.moveKeys(shard, keys.data() + first, count,
+                                                           [&](const std::vector<const Record*>& records) {
+                            request.clear();
+                            const int64_t now = KVStore::nowMs();
+                            for (const Record* record : records) {
+                                if (record->expire_at == 0) {
+                                    appendCommand(request, {"SET", record->key(), KVStore::valueOf(*record)});
+                                } else {
+                                    const std::string ttl = std::to_string(std::max<int64_t>(record->expire_at - now, 1));
+                                    appendCommand(request, {"SET", record->key(), KVStore::valueOf(*record), "PX", ttl});
+                                }
+                            }
+                            link.call(request, records.size());
+                            return true;
+                        });
+                    }
+                }
+            }
+
+            // The target first, so there is never a moment when neither side serves the slot.
+            request.clear();
+            appendCommand(request, {"CLUSTER", "SETSLOT", slot_text, "NODE", to});
+            link.call(request, 1);
+            setSlot(slot, "NODE", to);
+            for (const Node& node : others) {
+                try {
+                    Link(node).call(request, 1);
+                } catch (const std::exception& e) {
+                    std::cerr << "Cluster: cannot tell " << node.address() << " about slot " << slot << ": "
+                              << e.what() << std::endl;
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Cluster: migrating slot " << slot << " to " << to << " failed: " << e.what() << std::endl;
+            std::lock_guard guard(mutex_);
+            migration_error_ = e.what();
+        }
+        std::lock_guard guard(mutex_);
+        migration_running_ = false;
+    }
+};
+
+#endif // CLUSTER_H
@@ -0,0 +1,95 @@
+/**
+ * @file command_table.h
+ * @brief Case-insensitive command lookup through a perfect hash built at compile time.
+ */
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+/**
+ * @class CommandTable
+ * @brief Maps command names to entries with one hash, one probe and one compare.
+ *
+ * Construction searches for a seed under which no two names collide in a
+ * power-of-two slot array at least four times larger than the command
+ * set, so a lookup never walks a chain and costs the same however many
+ * commands exist. Declare the table constexpr to run that search at
+ * compile time; a name set without a perfect seed then fails to compile.
+ *
+ * Hashing folds ASCII case by setting bit 5 of every byte, which maps
+ * "get" and "GET" (but also some pairs of non-letters) to the same slot;
+ * the candidate is then confirmed with a real case-insensitive compare.
+ * @tparam Entry Type with a std::string_view member name, in upper case.
+ */
+template <typename Entry, size_t N>
+class CommandTable {
+public:
+    static constexpr size_t kSlots = [] {
+        size_t slots = 1;
+        while (slots < 4 * N) slots <<= 1;
+        return slots;
+    }();
+    static_assert(N < 255, "slot indexes are stored in a byte");
+
+    constexpr explicit CommandTable(const std::array<Entry, N>& entries) : entries_(entries) {
+        for (uint64_t seed = 1; seed < 1u << 16; ++seed) {
+            if (place(seed)) {
+                seed_ = seed;
+                return;
+            }
+        }
+        throw std::logic_error("no perfect hash seed for the command table");
+    }
+
+    /**
+     * @brief Returns the entry for name in any letter case, or nullptr.
+     */
+    constexpr const Entry* find(std::string_view name) const noexcept {
+        const uint8_t index = slots_[hash(name, seed_) & (kSlots - 1)];
+        if (index == 0) return nullptr;
+        const Entry& entry = entries_[index - 1];
+        return equalsIgnoreCase(name, entry.name) ? &entry : nullptr;
+    }
+
+    constexpr const std::array<Entry, N>& entries() const noexcept { return entries_; }
+
+private:
+    std::array<Entry, N> entries_;
+    std::array<uint8_t, kSlots> slots_{};  ///< Entry index + 1 per slot; 0 is empty.
+    uint64_t seed_ = 0;
+
+    static constexpr uint64_t hash(std::string_view name, uint64_t seed) noexcept {
+        uint64_t h = 0xCBF29CE484222325ULL ^ (seed * 0x9E3779B97F4A7C15ULL) ^ name.size();
+        for (const char c : name) {
+            h = (h ^ (static_cast<uint8_t>(c) | 0x20)) * 0x100000001B3ULL;
+        }
+        return h ^ (h >> 29);
+    }
+
+    static constexpr bool equalsIgnoreCase(std::string_view text, std::string_view upper) noexcept {
+        if (text.size() != upper.size()) return false;
+        for (size_t i = 0; i < text.size(); ++i) {
+            char c = text[i];
+            if (c >= 'a' && c <= 'z') c = static_cast<char>(c - 'a' + 'A');
+            if (c != upper[i]) return false;
+        }
+        return true;
+    }
+
+    constexpr bool place(uint64_t seed) {
+        slots_ = {};
+        for (size_t i = 0; i < N; ++i) {
+            uint8_t& slot = slots_[hash(entries_[i].name, seed) & (kSlots - 1)];
+            if (slot != 0) return false;
+            slot = static_cast<uint8_t>(i + 1);
+        }
+        return true;
+    }
+};
+
+#endif // COMMAND_TABLE_H
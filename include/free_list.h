@@ -0,0 +1,70 @@
+/**
+ * @file free_list.h
+ * @brief Bounded per-thread caches of freed objects, to keep the hot path off malloc.
+ */
+#ifndef FREE_LIST_H
+#define FREE_LIST_H
+
+#include <cstddef>
+#include <memory>
+
+/**
+ * @class FreeList
+ * @brief A thread's stash of up to Capacity heap objects of one kind, handed back out before new ones are allocated.
+ *
+ * Each thread has its own list, so take() and give() are a few plain
+ * loads and stores with no atomics or locks. An object may be taken on
+ * one thread and given on another; it then simply joins that thread's
+ * list, and a full list frees the surplus, so producer and consumer
+ * threads that trade objects one way stay bounded.
+ *
+ * The list itself is trivially destructible, so it stays usable while
+ * other thread_local objects are torn down; a guard frees what is cached
+ * at thread exit and closes the list, after which give() refuses.
+ * @tparam Deleter Frees an object the list refuses or drops, e.g. std::default_delete<char[]>.
+ */
+template <typename T, size_t Capacity, typename Deleter = std::default_delete<T>>
+class FreeList {
+public:
+    /**
+     * @return A cached object, or nullptr if the calling thread has none.
+     */
+    static T* take() noexcept {
+        Cache& cache = cache_;
+        return cache.count ? cache.items[--cache.count] : nullptr;
+    }
+
+    /**
+     * @brief Caches object for the calling thread, or frees it if the list is full or closed.
+     */
+    static void give(T* object) noexcept {
+        Cache& cache = cache_;
+        if (cache.count == Capacity || cache.closed) {
+            Deleter()(object);
+            return;
+        }
+        static thread_local Drain drain;
+        (void)drain;
+        cache.items[cache.count++] = object;
+    }
+
+private:
+    struct Cache {
+        T* items[Capacity];
+        size_t count;
+        bool closed;
+    };
+
+    /// Built on the first give(); thread_locals built before it are destroyed after it and find the list closed.
+    struct Drain {
+        ~Drain() {
+            Cache& cache = cache_;
+            cache.closed = true;
+            while (cache.count) Deleter()(cache.items[--cache.count]);
+        }
+    };
+
+    static inline thread_local Cache cache_{};
+};
+
+#endif // FREE_LIST_H
@@ -0,0 +1,99 @@
+/**
+ * @file glob_pattern.h
+ * @brief Redis-style glob matching for SCAN MATCH.
+ */
+#ifndef GLOB_PATTERN_H
+#define GLOB_PATTERN_H
+
+#include <cstddef>
+#include <string_view>
+#include <utility>
+
+/**
+ * @class GlobPattern
+ * @brief Matches keys against *, ?, [set], [^set], [a-z] and \\ escapes, as Redis' stringmatch does.
+ *
+ * Runs in O(pattern * text) time without recursion: on a mismatch the
+ * match restarts one byte further after the most recent '*', which is
+ * enough because a later '*' can absorb anything an earlier one could.
+ */
+class GlobPattern {
+public:
+    static bool matches(std::string_view pattern, std::string_view text) noexcept {
+        constexpr size_t kNone = static_cast<size_t>(-1);
+        size_t p = 0, t = 0;
+        size_t star = kNone, resume = 0;  // Pattern position after the last '*', and the text it resumes at.
+        while (t < text.size()) {
+            if (p < pattern.size()) {
+                if (pattern[p] == '*') {
+                    star = ++p;
+                    resume = t;
+                    continue;
+                }
+                size_t next;
+                if (matchOne(pattern, p, text[t], next)) {
+                    p = next;
+                    ++t;
+                    continue;
+                }
+            }
+            if (star == kNone) return false;
+            p = star;
+            t = ++resume;
+        }
+        while (p < pattern.size() && pattern[p] == '*') ++p;
+        return p == pattern.size();
+    }
+
+private:
+    /**
+     * @brief Matches one text byte against the pattern element at p.
+     * @param next Receives the position after that element.
+     */
+    static bool matchOne(std::string_view pattern, size_t p, char c, size_t& next) noexcept {
+        switch (pattern[p]) {
+            case '?':
+                next = p + 1;
+                return true;
+            case '[':
+                return matchSet(pattern, p + 1, static_cast<unsigned char>(c), next);
+            case '\\':
+                if (p + 1 < pattern.size()) {
+                    next = p + 2;
+                    return pattern[p + 1] == c;
+                }
+                [[fallthrough]];
+            default:
+                next = p + 1;
+                return pattern[p] == c;
+        }
+    }
+
+    /**
+     * @brief Matches c against the set starting at p, just after '['; an unclosed set ends with the pattern.
+     */
+    static bool matchSet(std::string_view pattern, size_t p, unsigned char c, size_t& next) noexcept {
+        const bool negate = p < pattern.size() && pattern[p] == '^';
+        if (negate) ++p;
+        bool found = false;
+        while (p < pattern.size() && pattern[p] != ']') {
+            if (pattern[p] == '\\' && p + 1 < pattern.size()) {
+                found |= static_cast<unsigned char>(pattern[p + 1]) == c;
+                p += 2;
+            } else if (p + 2 < pattern.size() && pattern[p + 1] == '-' && pattern[p + 2] != ']') {
+                unsigned char low = static_cast<unsigned char>(pattern[p]);
+                unsigned char high = static_cast<unsigned char>(pattern[p + 2]);
+                if (low > high) std::swap(low, high);
+                found |= c >= low && c <= high;
+                p += 3;
+            } else {
+                found |= static_cast<unsigned char>(pattern[p]) == c;
+                ++p;
+            }
+        }
+        next = p < pattern.size() ? p + 1 : p;
+        return found != negate;
+    }
+};
+
+#endif // GLOB_PATTERN_H
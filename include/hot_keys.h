@@ -0,0 +1,225 @@
+/**
+ * @file hot_keys.h
+ * @brief Per-thread hot-key detection with a count-min sketch, and a read cache for the keys it finds.
+ */
+#ifndef HOT_KEYS_H
+#define HOT_KEYS_H
+
+#include "kv_store.h"
+#include "server_stats.h"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define HOTKEY_SAMPLE_INTERVAL 8
+#define HOTKEY_SKETCH_WIDTH 1024
+#define HOTKEY_SKETCH_DEPTH 4
+#define HOTKEY_TOP 16
+#define HOTKEY_DECAY_SAMPLES (1 << 16)
+#define HOTKEY_MIN_ESTIMATE 4
+#define HOTKEY_SHARE_DIVISOR 512
+#define HOTKEY_CACHE_MAX_VALUE 1024
+#define HOTKEY_CACHE_REFRESH 64
+
+/**
+ * @class HotKeyTracker
+ * @brief Estimates how often keys are read, from one in HOTKEY_SAMPLE_INTERVAL reads, and keeps the top few.
+ *
+ * Sampled reads go into a count-min sketch of HOTKEY_SKETCH_DEPTH rows
+ * with conservative update, each row indexed by a different 16-bit slice
+ * of the key's hash, so an estimate never undercounts and overcounts only
+ * by collisions. Every HOTKEY_DECAY_SAMPLES samples all counts are halved,
+ * so the estimates follow recent traffic. The HOTKEY_TOP highest are kept
+ * by name for INFO. Written by its own thread only; topKeys() may be
+ * called from any thread.
+ */
+class HotKeyTracker {
+public:
+    struct Top {
+        std::string key;
+        uint64_t hash;
+        uint32_t estimate;  ///< Sampled reads, decayed.
+    };
+
+    HotKeyTracker() : counts_(HOTKEY_SKETCH_DEPTH * HOTKEY_SKETCH_WIDTH, 0) {}
+
+    /**
+     * @brief Counts a read; true for the one in HOTKEY_SAMPLE_INTERVAL that should be sampled.
+     */
+    bool sampleDue() noexcept {
+        if (++since_sample_ < HOTKEY_SAMPLE_INTERVAL) return false;
+        since_sample_ = 0;
+        return true;
+    }
+
+    /**
+     * @param hash StringHash of key.
+     */
+    void record(std::string_view key, uint64_t hash) {
+        uint32_t* cells[HOTKEY_SKETCH_DEPTH];
+        uint32_t estimate = UINT32_MAX;
+        for (size_t row = 0; row < HOTKEY_SKETCH_DEPTH; ++row) {
+            cells[row] = &counts_[row * HOTKEY_SKETCH_WIDTH + ((hash >> (16 * row)) & (HOTKEY_SKETCH_WIDTH - 1))];
+            estimate = std::min(estimate, *cells[row]);
+        }
+        // Conservative update: only the counters at the minimum can be exact, so only they grow.
+        for (uint32_t* cell : cells) {
+            if (*cell == estimate) ++*cell;
+        }
+        ++estimate;
+        updateTop(key, hash, estimate);
+        if (++window_samples_ == HOTKEY_DECAY_SAMPLES) decay();
+    }
+
+    /**
+     * @brief True if the key accounts for at least 1 / HOTKEY_SHARE_DIVISOR of recent samples.
+     */
+    bool hot(uint64_t hash) const noexcept {
+        uint32_t estimate = UINT32_MAX;
+        for (size_t row = 0; row < HOTKEY_SKETCH_DEPTH; ++row) {
+            estimate = std::min(estimate, counts_[row * HOTKEY_SKETCH_WIDTH + ((hash >> (16 * row)) & (HOTKEY_SKETCH_WIDTH - 1))]);
+        }
+        return estimate >= std::max<uint32_t>(HOTKEY_MIN_ESTIMATE, window_samples_ / HOTKEY_SHARE_DIVISOR);
+    }
+
+    /**
+     * @brief Appends a copy of the current top keys to out.
+     */
+    void topKeys(std::vector<Top>& out) const {
+        std::lock_guard guard(mutex_);
+        out.insert(out.end(), top_.begin(), top_.end());
+    }
+
+private:
+    std::vector<uint32_t> counts_;
+    uint32_t since_sample_ = 0;
+    uint32_t window_samples_ = 0;
+    mutable std::mutex mutex_;  ///< Guards top_ against topKeys().
+    std::vector<Top> top_;
+    uint32_t top_floor_ = 0;    ///< Lowest estimate in a full top_; smaller ones skip the lock.
+
+    void updateTop(std::string_view key, uint64_t hash, uint32_t estimate) {
+        if (top_.size() == HOTKEY_TOP && estimate <= top_floor_) return;
+
+        std::lock_guard guard(mutex_);
+        auto it = std::find_if(top_.begin(), top_.end(),
+                               [&](const Top& top) { return top.hash == hash && top.key == key; });
+        if (it != top_.end()) {
+            it->estimate = estimate;
+        } else if (top_.size() < HOTKEY_TOP) {
+            top_.push_back({std::string(key), hash, estimate});
+        } else {
+            Top& lowest = *std::min_element(top_.begin(), top_.end(),
+                                            [](const Top& a, const Top& b) { return a.estimate < b.estimate; });
+            lowest.key.assign(key.data(), key.size());
+            lowest.hash = hash;
+            lowest.estimate = estimate;
+        }
+        updateFloor();
+    }
+
+    void updateFloor() noexcept {
+        top_floor_ = 0;
+        if (top_.size() < HOTKEY_TOP) return;
+        top_floor_ = UINT32_MAX;
+        for (const Top& top : top_) top_floor_ = std::min(top_floor_, top.estimate);
+    }
+
+    void decay() {
+        for (uint32_t& count : counts_) count >>= 1;
+        window_samples_ = 0;
+        std::lock_guard guard(mutex_);
+        for (Top& top : top_) top.estimate >>= 1;
+        updateFloor();
+    }
+};
+
+/**
+ * @class HotKeyCache
+ * @brief A thread's direct-mapped copy of hot values, valid while their shard has not been written since.
+ *
+ * An entry remembers the shard's write sequence (KVStore::shardVersion())
+ * it was read under. Every write section bumps that sequence, so a SET,
+ * DEL, expiry change, eviction or flush anywhere in the shard invalidates
+ * the entry; no write path has to know the cache exists. A value with a
+ * TTL is also dropped once it expires. Hits skip the store's access
+ * metadata, so every HOTKEY_CACHE_REFRESH-th hit is dropped to let one
+ * read through and keep LRU/LFU aware of the key.
+ */
+class HotKeyCache {
+public:
+    /**
+     * @brief Sets the number of entries, rounded up to a power of two; 0 disables the cache.
+     */
+    void resize(size_t entries) {
+        size_t slots = entries ? 1 : 0;
+        while (slots < entries) slots <<= 1;
+        entries_.assign(slots, Entry());
+        configured_ = entries;
+    }
+
+    size_t configured() const noexcept { return configured_; }
+
+    /**
+     * @return The cached value, or nullptr if key is not cached or its copy is no longer current.
+     */
+    const std::string* find(std::string_view key, uint64_t hash, const KVStore& store) {
+        if (entries_.empty()) return nullptr;
+        Entry& entry = entries_[hash & (entries_.size() - 1)];
+        if (!entry.used || entry.hash != hash || entry.key != key) return nullptr;
+
+        if (store.shardVersion(entry.shard) != entry.version ||
+            (entry.expire_at != 0 && entry.expire_at <= KVStore::nowMs())) {
+            entry.used = false;
+            stale.add();
+            return nullptr;
+        }
+        if (++entry.hits == HOTKEY_CACHE_REFRESH) {
+            entry.used = false;
+            return nullptr;
+        }
+        hits.add();
+        return &entry.value;
+    }
+
+    /**
+     * @brief Caches a value read under the given shard version, replacing whatever shared its slot.
+     */
+    void fill(std::string_view key, uint64_t hash, std::string_view value, size_t shard, uint64_t version,
+              int64_t expire_at) {
+        if (entries_.empty()) return;
+        Entry& entry = entries_[hash & (entries_.size() - 1)];
+        entry.key.assign(key.data(), key.size());
+        entry.value.assign(value.data(), value.size());
+        entry.hash = hash;
+        entry.shard = shard;
+        entry.version = version;
+        entry.expire_at = expire_at;
+        entry.hits = 0;
+        entry.used = true;
+        fills.add();
+    }
+
+    StatCounter hits;
+    StatCounter fills;
+    StatCounter stale;  ///< Entries found invalidated by a write or expired.
+
+private:
+    struct Entry {
+        std::string key;
+        std::string value;
+        uint64_t hash = 0;
+        size_t shard = 0;
+        uint64_t version = 0;
+        int64_t expire_at = 0;
+        uint32_t hits = 0;
+        bool used = false;
+    };
+    std::vector<Entry> entries_;
+    size_t configured_ = 0;
+};
+
+#endif // HOT_KEYS_H
@@ -0,0 +1,225 @@
+/**
+ * @file hot_restart.h
+ * @brief Hands the listening sockets and the dataset over to a new server process.
+ */
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+#include "kv_store.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define HOT_RESTART_LISTEN_FDS "BLINKDB_LISTEN_FDS"
+#define HOT_RESTART_DATASET_FD "BLINKDB_DATASET_FD"
+#define HOT_RESTART_READY_FD "BLINKDB_READY_FD"
+#define HOT_RESTART_READY_TIMEOUT_MS 60000
+
+extern char** environ;
+
+/**
+ * @class HotRestart
+ * @brief Both sides of an upgrade without downtime: spawning the replacement and picking up what it inherits.
+ *
+ * The old process stops serving, writes its dataset into a memfd and execs
+ * the binary at its own path with the listening sockets, the memfd and the
+ * write end of a pipe left open, their numbers passed in the environment.
+ * The new process adopts the sockets, maps the dataset straight from the
+ * memfd and writes one byte to the pipe once it serves; only then does the
+ * old process exit. Clients connecting in between wait in the listen
+ * queues the two processes share instead of being refused. If the new
+ * process dies or stays silent, the old one kills it and carries on.
+ */
+class HotRestart {
+public:
+    /**
+     * @brief Listening sockets passed by the previous process, in worker order; empty on a normal start.
+     */
+    static std::vector<int> inheritedListeners() {
+        std::vector<int> fds;
+        const char* list = std::getenv(HOT_RESTART_LISTEN_FDS);
+        if (!list) return fds;
+        for (const char* p = list; *p;) {
+            char* end;
+            const long fd = std::strtol(p, &end, 10);
+            if (end == p) throw std::invalid_argument(HOT_RESTART_LISTEN_FDS " is malformed");
+            fds.push_back(static_cast<int>(fd));
+            p = *end == ',' ? end + 1 : end;
+        }
+        return fds;
+    }
+
+    /**
+     * @brief memfd holding the previous process's dataset in snapshot format, or -1.
+     */
+    static int inheritedDataset() { return fdFromEnv(HOT_RESTART_DATASET_FD); }
+
+    /**
+     * @brief Loads the inherited dataset into store and closes it.
+     * @return False on a normal start, when nothing was inherited.
+     * @throws std::runtime_error if the dataset is corrupt.
+     */
+    static bool loadDataset(KVStore& store) {
+        const int fd = inheritedDataset();
+        if (fd == -1) return false;
+        const bool loaded = store.loadSnapshot("/proc/self/fd/" + std::to_string(fd));
+        ::close(fd);
+        if (!loaded) throw std::runtime_error("Cannot read the inherited dataset");
+        return true;
+    }
+
+    /**
+     * @brief Tells the previous process this one is serving, so it can exit; no-op on a normal start.
+     */
+    static void notifyReady() {
+        const int fd = fdFromEnv(HOT_RESTART_READY_FD);
+        if (fd != -1) {
+            const char byte = 1;
+            while (::write(fd, &byte, 1) == -1 && errno == EINTR) {}
+            ::close(fd);
+        }
+        unsetenv(HOT_RESTART_LISTEN_FDS);
+        unsetenv(HOT_RESTART_DATASET_FD);
+        unsetenv(HOT_RESTART_READY_FD);
+    }
+
+    /**
+     * @brief Writes store into a new memfd for spawn().
+     * @throws std::system_error if the memfd cannot be created.
+     * @throws std::runtime_error if the snapshot cannot be written.
+     */
+    static int saveDataset(KVStore& store) {
+        const int fd = memfd_create("blinkdb-dataset", MFD_CLOEXEC);
+        if (fd == -1) throw std::system_error(errno, std::system_category(), "memfd_create");
+        try {
+            store.persistTo(fd);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        return fd;
+    }
+
+    /**
+     * @brief Execs this program again with argv, handing it listeners and dataset_fd, and waits until it serves.
+     *
+     * Every other descriptor is closed in the child, so it holds no client
+     * connection or log file of this process. The binary is looked up by
+     * path, so a file installed over it since startup is what runs.
+     * @return True once the new process reported ready; false if it failed or
+     *         timed out, in which case it has been killed and reaped.
+     * @throws std::system_error if the pipe or the fork cannot be created.
+     */
+    static bool spawn(char** argv, const std::vector<int>& listeners, int dataset_fd,
+                      std::chrono::milliseconds timeout) {
+        const std::string exe = executablePath();
+        int ready[2];
+        if (pipe2(ready, O_CLOEXEC) == -1) throw std::system_error(errno, std::system_category(), "pipe2");
+
+        std::string fd_list;
+        for (const int fd : listeners) fd_list += (fd_list.empty() ? "" : ",") + std::to_string(fd);
+        std::vector<std::string> env;
+        for (char** entry = environ; *entry; ++entry) {
+            if (!ownVariable(*entry)) env.emplace_back(*entry);
+        }
+        env.push_back(std::string(HOT_RESTART_LISTEN_FDS "=") + fd_list);
+        env.push_back(std::string(HOT_RESTART_DATASET_FD "=") + std::to_string(dataset_fd));
+        env.push_back(std::string(HOT_RESTART_READY_FD "=") + std::to_string(ready[1]));
+        std::vector<char*> envp;
+        for (auto& entry : env) envp.push_back(entry.data());
+        envp.push_back(nullptr);
+
+        std::vector<int> keep = listeners;
+        keep.push_back(dataset_fd);
+        keep.push_back(ready[1]);
+        std::sort(keep.begin(), keep.end());
+        keep.erase(std::unique(keep.begin(), keep.end()), keep.end());
+        rlimit limit{};
+        getrlimit(RLIMIT_NOFILE, &limit);
+        const unsigned max_fd = limit.rlim_cur == RLIM_INFINITY ? 1u << 20 : static_cast<unsigned>(limit.rlim_cur);
+
+        const pid_t pid = fork();
+        if (pid == -1) {
+            const int err = errno;
+            ::close(ready[0]);
+            ::close(ready[1]);
+            throw std::system_error(err, std::system_category(), "fork");
+        }
+        if (pid == 0) {
+            // Only async-signal-safe calls between fork() and exec.
+            unsigned next = 3;
+            for (const int fd : keep) {
+                fcntl(fd, F_SETFD, 0);
+                if (static_cast<unsigned>(fd) > next) closeRange(next, static_cast<unsigned>(fd) - 1, max_fd);
+                next = static_cast<unsigned>(fd) + 1;
+            }
+            closeRange(next, ~0u, max_fd);
+            execve(exe.c_str(), argv, envp.data());
+            _exit(127);
+        }
+
+        ::close(ready[1]);
+        pollfd pfd{ready[0], POLLIN, 0};
+        int polled;
+        do {
+            polled = poll(&pfd, 1, static_cast<int>(timeout.count()));
+        } while (polled == -1 && errno == EINTR);
+        char byte = 0;
+        const bool ok = polled == 1 && ::read(ready[0], &byte, 1) == 1;
+        ::close(ready[0]);
+        if (!ok) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        return ok;
+    }
+
+private:
+    static int fdFromEnv(const char* name) {
+        const char* value = std::getenv(name);
+        return value ? std::atoi(value) : -1;
+    }
+
+    static bool ownVariable(const char* entry) {
+        for (const char* name : {HOT_RESTART_LISTEN_FDS, HOT_RESTART_DATASET_FD, HOT_RESTART_READY_FD}) {
+            const size_t length = std::strlen(name);
+            if (std::strncmp(entry, name, length) == 0 && entry[length] == '=') return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief The running binary's path, without the " (deleted)" Linux appends once it was replaced.
+     */
+    static std::string executablePath() {
+        char path[4096];
+        const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        if (length == -1) throw std::system_error(errno, std::system_category(), "readlink /proc/self/exe");
+        std::string exe(path, static_cast<size_t>(length));
+        const std::string deleted = " (deleted)";
+        if (exe.size() > deleted.size() && exe.compare(exe.size() - deleted.size(), deleted.size(), deleted) == 0) {
+            exe.resize(exe.size() - deleted.size());
+        }
+        return exe;
+    }
+
+    static void closeRange(unsigned first, unsigned last, unsigned max_fd) noexcept {
+        if (close_range(first, last, 0) == 0) return;
+        for (unsigned fd = first; fd <= last && fd < max_fd; ++fd) ::close(static_cast<int>(fd));
+    }
+};
+
+#endif // HOT_RESTART_H
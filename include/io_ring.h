@@ -0,0 +1,245 @@
+/**
+ * @file io_ring.h
+ * @brief Minimal io_uring wrapper over the raw syscalls, with a provided-buffer ring.
+ */
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <system_error>
+
+/**
+ * @class IoRing
+ * @brief One submission/completion queue pair plus one group of provided receive buffers.
+ *
+ * The ring is created disabled and single-issuer; whichever thread calls
+ * enable() becomes its only submitter, which lets the kernel defer
+ * completion work until that thread asks for events. Kernels without
+ * those flags get a plain ring. Queue indices follow the io_uring ABI:
+ * the kernel advances the SQ head and CQ tail, we advance the rest.
+ */
+class IoRing {
+private:
+    int fd_ = -1;
+    bool disabled_ = false;
+
+    void* sq_map_ = MAP_FAILED;
+    size_t sq_map_size_ = 0;
+    void* cq_map_ = MAP_FAILED;
+    size_t cq_map_size_ = 0;
+    io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sqe_tail_ = 0;  ///< Next SQE to hand out; published to sq_tail_ on submit.
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    io_uring_buf_ring* buf_ring_ = static_cast<io_uring_buf_ring*>(MAP_FAILED);
+    size_t buf_ring_size_ = 0;
+    std::unique_ptr<char[]> buffers_;
+    unsigned buf_count_ = 0;
+    unsigned buf_size_ = 0;
+    uint16_t buf_tail_ = 0;
+
+    static int setup(unsigned entries, io_uring_params& params) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    }
+
+    void release() noexcept {
+        if (fd_ != -1) close(fd_);
+        if (buf_ring_ != MAP_FAILED) munmap(buf_ring_, buf_ring_size_);
+        if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+        if (cq_map_ != MAP_FAILED && cq_map_ != sq_map_) munmap(cq_map_, cq_map_size_);
+        if (sq_map_ != MAP_FAILED) munmap(sq_map_, sq_map_size_);
+    }
+
+    [[noreturn]] void fail(int err, const char* what) {
+        release();
+        throw std::system_error(err, std::system_category(), what);
+    }
+
+    int enter(unsigned to_submit, unsigned wait_nr, unsigned flags, const void* arg, size_t arg_size) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr, flags, arg, arg_size));
+    }
+
+public:
+    /**
+     * @brief Creates a ring with room for entries in-flight submissions.
+     * @throws std::system_error if the kernel has no usable io_uring.
+     */
+    explicit IoRing(unsigned entries) {
+        io_uring_params params{};
+        params.flags = IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER |
+                       IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_COOP_TASKRUN;
+        fd_ = setup(entries, params);
+        if (fd_ == -1 && errno == EINVAL) {
+            params = io_uring_params{};
+            fd_ = setup(entries, params);
+        }
+        if (fd_ == -1) fail(errno, "io_uring_setup");
+        disabled_ = (params.flags & IORING_SETUP_R_DISABLED) != 0;
+
+        if (!(params.features & IORING_FEAT_EXT_ARG)) fail(ENOSYS, "io_uring_setup");
+
+        sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+        }
+
+        sq_map_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd_, IORING_OFF_SQ_RING);
+        if (sq_map_ == MAP_FAILED) fail(errno, "mmap");
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_map_ = sq_map_;
+        } else {
+            cq_map_ = mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           fd_, IORING_OFF_CQ_RING);
+            if (cq_map_ == MAP_FAILED) fail(errno, "mmap");
+        }
+
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) fail(errno, "mmap");
+
+        char* sq = static_cast<char*>(sq_map_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sqe_tail_ = *sq_tail_;
+
+        // SQE i always sits in slot i, so the indirection array is filled once.
+        unsigned* sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries_; ++i) sq_array[i] = i;
+
+        char* cq = static_cast<char*>(cq_map_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    ~IoRing() { release(); }
+
+    /**
+     * @brief Registers count receive buffers of size bytes each as buffer group group.
+     *
+     * Receives submitted with IOSQE_BUFFER_SELECT pick a free buffer at
+     * completion time, so idle connections pin no receive memory.
+     * @param count Number of buffers; a power of two no larger than 32768.
+     * @throws std::system_error if registration fails (kernels before 5.19).
+     */
+    void setupBuffers(uint16_t group, unsigned count, unsigned size) {
+        // The kernel maps the ring in whole pages; a shorter mapping registers but never
+        // shows any buffers.
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        buf_ring_size_ = (count * sizeof(io_uring_buf) + page - 1) / page * page;
+        void* ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) throw std::system_error(errno, std::system_category(), "mmap");
+        buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+            throw std::system_error(errno, std::system_category(), "io_uring_register(PBUF_RING)");
+        }
+
+        buffers_.reset(new char[size_t{count} * size]);
+        buf_count_ = count;
+        buf_size_ = size;
+        for (unsigned bid = 0; bid < count; ++bid) recycleBuffer(static_cast<uint16_t>(bid));
+    }
+
+    char* buffer(uint16_t bid) const noexcept { return buffers_.get() + size_t{bid} * buf_size_; }
+
+    /**
+     * @brief Hands a provided buffer back to the kernel once its data has been consumed.
+     */
+    void recycleBuffer(uint16_t bid) noexcept {
+        // Not buf_ring_->bufs[]: in C++ the uapi flex-array macro shifts it by 8 bytes.
+        io_uring_buf& slot = reinterpret_cast<io_uring_buf*>(buf_ring_)[buf_tail_ & (buf_count_ - 1)];
+        slot.addr = reinterpret_cast<uint64_t>(buffer(bid));
+        slot.len = buf_size_;
+        slot.bid = bid;
+        __atomic_store_n(&buf_ring_->tail, ++buf_tail_, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Makes the calling thread the ring's submitter. Call once, before any submission.
+     */
+    void enable() {
+        if (!disabled_) return;
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) != 0) {
+            throw std::system_error(errno, std::system_category(), "io_uring_register(ENABLE_RINGS)");
+        }
+        disabled_ = false;
+    }
+
+    /**
+     * @brief Returns a zeroed SQE, submitting queued ones first if the queue is full.
+     */
+    io_uring_sqe* getSqe() {
+        while (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            submitAndWait(0, 0);
+        }
+        io_uring_sqe* sqe = &sqes_[sqe_tail_++ & sq_mask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    /**
+     * @brief Submits every queued SQE in one syscall and waits for completions.
+     * @param wait_nr Completions to wait for; 0 only submits.
+     * @param timeout_ms Upper bound on the wait.
+     * @return The io_uring_enter result; -1 with errno ETIME or EINTR is a normal wakeup.
+     */
+    int submitAndWait(unsigned wait_nr, long timeout_ms) {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        const unsigned to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (wait_nr == 0) return enter(to_submit, 0, 0, nullptr, 0);
+
+        __kernel_timespec ts{};
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        io_uring_getevents_arg arg{};
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        return enter(to_submit, wait_nr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    /**
+     * @brief Calls f for every available completion and releases them to the kernel.
+     */
+    template <typename F>
+    void forEachCompletion(F&& f) {
+        unsigned head = *cq_head_;
+        const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            f(cqes_[head & cq_mask_]);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+};
+
+#endif // IO_RING_H
@@ -6,107 +6,1955 @@
 #define KV_STORE_H
 
 #include "ankerl/unordered_dense.h"
+#include "snapshot_format.h"
+#include "record_arena.h"
+#include "qsbr.h"
+#include "lz4_block.h"
 #include <vector>
 #include <shared_mutex>
 #include <atomic>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <memory>
 #include <mutex>
 #include <fstream>
 #include <iostream>
+#include <functional>
+#include <system_error>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <cmath>
+#include <charconv>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#define DEFAULT_SHARD_COUNT 64
+#define DEFAULT_EVICTION_SAMPLES 5
+#define LFU_INIT_VAL 5
+#define LFU_LOG_FACTOR 10
+#define OPTIMISTIC_READ_ATTEMPTS 4
+#define NUMERIC_MAX_CHARS (5 * 1024)
+#define SCAN_LOCK_BATCH 128
+#define SCAN_POSITION_BITS 40
+#define COMPRESSION_MIN_SAVING 8  ///< Compressed values must save at least 1/8 of their size.
+
+/**
+ * @brief What KVStore does when a write would exceed its memory limit.
+ */
+enum class EvictionPolicy {
+    NoEviction,  ///< Reject writes that add data; reads and deletes still work.
+    AllKeysLRU,  ///< Evict the least recently used of a few sampled keys.
+    AllKeysLFU   ///< Evict the least frequently used of a few sampled keys.
+};
+
+/**
+ * @brief Outcome of KVStore::readOptimistic().
+ */
+enum class ReadStatus {
+    Hit,      ///< The staged value is consistent.
+    Miss,     ///< The key was consistently absent.
+    Fallback  ///< Nothing conclusive; repeat the lookup with read().
+};
+
+/**
+ * @brief Outcome of KVStore::incrBy() and incrByFloat().
+ */
+enum class NumericStatus {
+    Ok,
+    NotNumber,   ///< The stored value is not an integer (or float).
+    Overflow,    ///< The result does not fit, or is NaN or infinite.
+    OutOfMemory  ///< A new key did not fit under NoEviction.
+};
+
+/**
+ * @struct StringHash
+ * @brief Transparent string hash so lookups by string_view need no temporary std::string.
+ */
+struct StringHash {
+    using is_transparent = void;
+    using is_avalanching = void;
+
+    uint64_t operator()(std::string_view key) const noexcept {
+        return ankerl::unordered_dense::hash<std::string_view>{}(key);
+    }
+};
+
+/**
+ * @class MutationLog
+ * @brief Receives every mutation applied to a KVStore.
+ *
+ * Callbacks run while the mutated shard's exclusive lock is held, so for
+ * any one key they arrive in the order the mutations were applied.
+ */
+class MutationLog {
+public:
+    virtual ~MutationLog() = default;
+    /**
+     * @brief Records a key's new value as stored, so a compressed value is logged compressed.
+     * @param value The stored bytes, in the given encoding.
+     */
+    virtual void logSet(size_t shard, std::string_view key, std::string_view value, ValueEncoding encoding) = 0;
+    virtual void logDel(size_t shard, std::string_view key) = 0;
+
+    /**
+     * @brief Records a key's new absolute expiry time.
+     * @param expire_at Unix time in milliseconds, or 0 when the expiry was removed.
+     */
+    virtual void logExpire(size_t shard, std::string_view key, int64_t expire_at) = 0;
+
+    /**
+     * @brief Blocks until the calling thread's logged mutations are as durable as policy requires.
+     */
+    virtual void sync() {}
+
+    /**
+     * @brief errno of a write failure the log has not yet recovered from, or 0.
+     */
+    virtual int writeError() const { return 0; }
+};
 
  /**
  * @class KVStore
  * @brief A thread-safe key-value store with optional persistence.
+ *
+ * The keyspace is split across a power-of-two number of shards, each an
+ * independently locked map, so writers to different shards never contend.
+ * A shard's table holds one pointer per key to a packed Record (header,
+ * key, value) allocated from the shard's RecordArena; lookups hash the
+ * caller's string_view directly.
+ *
+ * Keys may carry an absolute expiry time stored inline with the value.
+ * Expired keys are invisible to readers, removed by the first writer or
+ * reader that finds them and reclaimed in the background by
+ * expireCycle(), which samples a bounded number of entries per call.
+ *
+ * With setMaxMemory() the store is memory-bounded. The limit is split
+ * evenly across shards, so a writer checks and evicts only within the
+ * shard it already holds. Every entry carries 32 bits of access metadata
+ * in the Redis layout: a 24-bit coarse clock for LRU, or a 16-bit minute
+ * stamp plus an 8-bit logarithmic counter for LFU. Readers update it with
+ * a relaxed store, only when the value actually changes, so GET still
+ * takes just the shared lock.
+ *
+ * Threads registered with Qsbr can skip even that: readOptimistic() is a
+ * seqlock read that validates against a per-shard sequence counter which
+ * every exclusive lock bumps, so a hit costs two loads of a shared cache
+ * line and no atomic read-modify-write. Since such a reader may be inside
+ * a table or record while a writer changes it, nothing it can reach is
+ * freed under it: tables are never resized in place but replaced by a
+ * larger generation, and replaced tables, arena slabs and large records
+ * are handed to Qsbr::retire().
+ *
+ * With setCompression(), values from a size threshold up are stored
+ * LZ4-compressed when that saves space, tagged with their encoding. They
+ * are compressed before the shard lock is taken, decompressed by readers
+ * (see valueOf()), and go to snapshots and the mutation log compressed.
  */
 class KVStore {
 private:
-    ankerl::unordered_dense::map<std::string, std::string> data;
-    std::shared_mutex mutex;
+    /**
+     * @brief Hashes a Record by its key, and any string_view the same way.
+     */
+    struct RecordHash {
+        using is_transparent = void;
+        using is_avalanching = void;
+
+        uint64_t operator()(std::string_view key) const noexcept { return StringHash{}(key); }
+        uint64_t operator()(const Record* record) const noexcept { return StringHash{}(record->key()); }
+    };
+
+    struct RecordEqual {
+        using is_transparent = void;
+
+        bool operator()(const Record* a, const Record* b) const noexcept { return a->key() == b->key(); }
+        bool operator()(std::string_view a, const Record* b) const noexcept { return matches(b, a); }
+        bool operator()(const Record* a, std::string_view b) const noexcept { return matches(a, b); }
+
+        /**
+         * @brief Key comparison that stays inside the record even if a writer is rewriting it.
+         */
+        static bool matches(const Record* record, std::string_view key) noexcept {
+            const uint32_t key_size = __atomic_load_n(&record->key_size, __ATOMIC_RELAXED);
+            const uint32_t capacity = __atomic_load_n(&record->capacity, __ATOMIC_RELAXED);
+            return key_size == key.size() && sizeof(Record) + key_size <= capacity &&
+                   std::memcmp(record->bytes(), key.data(), key_size) == 0;
+        }
+    };
+
+    using Map = ankerl::unordered_dense::set<Record*, RecordHash, RecordEqual>;
+
+    /// Table bytes per entry: one value-vector slot and 1 / 0.8 buckets at the default load factor.
+    static constexpr size_t kEntryOverhead = sizeof(Map::value_type) + sizeof(Map::bucket_type) * 5 / 4;
+
+    struct alignas(64) Shard {
+        std::shared_mutex mutex;
+        std::atomic<uint64_t> seq{0};      ///< Odd while an exclusive lock is held; see readOptimistic().
+        std::atomic<Map*> table{new Map};  ///< Current table generation; replaced rather than resized.
+        RecordArena arena;
+        std::atomic<size_t> volatile_count{0};  ///< Entries with an expiry; written under the lock.
+        std::atomic<size_t> compressed_count{0};  ///< Entries stored compressed; written under the lock.
+        size_t sweep_cursor = 0;                ///< Next position expireCycle() samples, counting down.
+        uint64_t rng = 0x9E3779B97F4A7C15ULL;   ///< Eviction sampling state; used under the exclusive lock.
+        std::atomic<uint64_t> lock_waits{0};    ///< Acquisitions that found the lock taken.
+        std::atomic<uint64_t> lock_wait_ns{0};  ///< Time those acquisitions spent blocked.
+
+        /**
+         * @brief Bytes attributed to this shard: live records plus table overhead per entry.
+         *
+         * Free slab space, and slack capacity in the value vector and bucket
+         * array, is not counted; it is reused by later inserts and would
+         * otherwise make eviction unable to ever get back under the limit.
+         */
+        size_t memoryUsage() const noexcept { return arena.usedBytes() + data().size() * kEntryOverhead; }
+
+        Shard() = default;
+        ~Shard() { delete table.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Takes the exclusive lock and opens a write section; Shard is a Lockable.
+         *
+         * Only an acquisition that has to wait is timed, so uncontended
+         * locking costs one try_lock as before.
+         */
+        void lock() {
+            if (!mutex.try_lock()) waitFor([this] { mutex.lock(); });
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            // Optimistic readers that see any of the writes below must also see the odd count.
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void unlock() {
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            mutex.unlock();
+        }
+
+        /**
+         * @brief Takes the shared lock; with lock() this makes Shard a SharedLockable.
+         */
+        void lock_shared() {
+            if (!mutex.try_lock_shared()) waitFor([this] { mutex.lock_shared(); });
+        }
+
+        void unlock_shared() { mutex.unlock_shared(); }
+
+        template <typename Acquire>
+        void waitFor(Acquire&& acquire) {
+            const auto start = std::chrono::steady_clock::now();
+            acquire();
+            const auto waited = std::chrono::steady_clock::now() - start;
+            lock_waits.fetch_add(1, std::memory_order_relaxed);
+            lock_wait_ns.fetch_add(
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count()),
+                std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief True if no write section began since seq was read as start.
+         */
+        bool validate(uint64_t start) const noexcept {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return seq.load(std::memory_order_relaxed) == start;
+        }
+
+        /**
+         * @brief The current table; hold mutex to use it.
+         */
+        Map& data() noexcept { return *table.load(std::memory_order_relaxed); }
+        const Map& data() const noexcept { return *table.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Entries the current table takes before an insert would reallocate it.
+         */
+        size_t capacity() const noexcept {
+            const Map& map = data();
+            const auto buckets = static_cast<size_t>(static_cast<float>(map.bucket_count()) * map.max_load_factor());
+            return std::min(buckets, map.values().capacity());
+        }
+
+        /**
+         * @brief Ensures entries keys fit without the table reallocating under lock-free readers.
+         *
+         * A table that is too small is copied into a new generation of
+         * exactly that capacity, which is published for readers; the old one
+         * is retired once no reader can still be probing it.
+         */
+        void reserve(size_t entries) {
+            if (entries <= capacity()) return;
+            auto next = std::make_unique<Map>();
+            next->reserve(entries);
+            for (Record* record : data()) next->insert(record);
+            publish(next.release());
+        }
+
+        /**
+         * @brief Installs a new table generation, retiring the old one.
+         */
+        void publish(Map* next) {
+            Map* old = table.exchange(next, std::memory_order_acq_rel);
+            Qsbr::retire(old, [](void* map) { delete static_cast<Map*>(map); });
+        }
+
+        /**
+         * @brief Inserts or overwrites a key, keeping the expiry bookkeeping exact.
+         *
+         * An overwrite reuses the record in place when the new value lands in
+         * the same size class and no response has the old value pinned, and
+         * otherwise swaps in a fresh record.
+         * @param value Stored bytes in the given encoding.
+         */
+        Record& upsert(std::string_view key, std::string_view value, int64_t expire_at,
+                       ValueEncoding encoding = ValueEncoding::Raw) {
+            // Records and snapshots flag compressed values in the top bit of value_size.
+            if (key.size() > UINT32_MAX || value.size() >= SNAPSHOT_VALUE_LZ4) {
+                throw std::length_error("key or value too large");
+            }
+            auto it = data().find(key);
+            Record* record;
+            if (it == data().end()) {
+                // Grow ahead of the insert, in doublings, so it never reallocates in place.
+                if (data().size() >= capacity()) reserve(std::max<size_t>(data().size() * 2, 16));
+                record = arena.create(key, value);
+                try {
+                    data().insert(record);
+                } catch (...) {
+                    arena.destroy(record);
+                    throw;
+                }
+            } else if (RecordArena::capacityFor(Record::sizeFor(key.size(), value.size())) == (*it)->capacity &&
+                       !RecordArena::pinned(**it)) {
+                record = *it;
+                std::memcpy(record->bytes() + record->key_size, value.data(), value.size());
+                record->setValueSize(value.size());
+            } else {
+                Record* old = *it;
+                record = arena.create(key, value);
+                record->expire_at = old->expire_at;
+                record->setEncoding(old->encoding());
+                // Same key, so the slot's hash and position stay valid.
+                const_cast<Record*&>(*it) = record;
+                arena.destroy(old);
+            }
+            setExpiry(*record, expire_at);
+            setEncoding(*record, encoding);
+            return *record;
+        }
+
+        /**
+         * @brief Drops every record, returning the arena's memory once readers are done with it.
+         */
+        void reset() {
+            publish(new Map);
+            arena.reset();
+            volatile_count.store(0, std::memory_order_relaxed);
+            compressed_count.store(0, std::memory_order_relaxed);
+            sweep_cursor = 0;
+        }
+
+        uint64_t nextRandom() noexcept {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            return rng;
+        }
+
+        void setExpiry(Record& record, int64_t expire_at) noexcept {
+            if ((record.expire_at != 0) != (expire_at != 0)) {
+                volatile_count.store(volatile_count.load(std::memory_order_relaxed) + (expire_at ? 1 : -1),
+                                     std::memory_order_relaxed);
+            }
+            record.expire_at = expire_at;
+        }
+
+        void setEncoding(Record& record, ValueEncoding encoding) noexcept {
+            if ((record.encoding() != ValueEncoding::Raw) != (encoding != ValueEncoding::Raw)) {
+                compressed_count.store(compressed_count.load(std::memory_order_relaxed) +
+                                           (encoding != ValueEncoding::Raw ? 1 : -1),
+                                       std::memory_order_relaxed);
+            }
+            record.setEncoding(encoding);
+        }
+
+        void erase(Map::iterator it) {
+            Record* record = *it;
+            if (record->expire_at != 0) setExpiry(*record, 0);
+            if (record->encoding() != ValueEncoding::Raw) setEncoding(*record, ValueEncoding::Raw);
+            data().erase(it);
+            arena.destroy(record);
+        }
+    };
+
+    static bool expired(const Record& record, int64_t now) noexcept {
+        return record.expire_at != 0 && record.expire_at <= now;
+    }
+
+    static bool expired(const Record& record) noexcept {
+        return record.expire_at != 0 && record.expire_at <= nowMs();
+    }
+
+    /**
+     * @brief Drops an expired key once the caller holds the shard exclusively.
+     * @return The live entry, or end() if the key is missing or was expired.
+     */
+    Map::iterator findLive(size_t index, Shard& shard, std::string_view key) {
+        auto it = shard.data().find(key);
+        if (it == shard.data().end() || !expired(**it)) return it;
+        if (log) log->logDel(index, key);
+        shard.erase(it);
+        expired_keys.fetch_add(1, std::memory_order_relaxed);
+        return shard.data().end();
+    }
+
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_count;
     std::string filename = "kvstore.dat";
+    std::mutex snapshot_mutex;
+    MutationLog* log = nullptr;
+
+    size_t max_memory = 0;  ///< 0 disables the limit.
+    size_t compression_threshold = 0;  ///< Smallest value setCompression() compresses; 0 disables it.
+    EvictionPolicy eviction_policy = EvictionPolicy::NoEviction;
+    size_t eviction_samples = DEFAULT_EVICTION_SAMPLES;
+    std::atomic<uint32_t> clock_seconds{0};  ///< Coarse clock for access metadata; see tick().
+    std::atomic<uint64_t> evicted_keys{0};
+    std::atomic<uint64_t> expired_keys{0};
+
+    /**
+     * @brief Outcome of the snapshots taken so far; see snapshotStats().
+     */
+    struct SnapshotCounters {
+        std::atomic<uint64_t> completed{0};
+        std::atomic<uint64_t> failed{0};
+        std::atomic<bool> in_progress{false};
+        std::atomic<bool> last_ok{true};
+        std::atomic<int64_t> last_finished_ms{0};  ///< Unix time of the last successful snapshot.
+        std::atomic<uint64_t> last_duration_ns{0};
+        std::atomic<uint64_t> last_fork_ns{0};
+    } snapshot_counters;
+
+    /**
+     * @brief Times one snapshot and records whether it succeeded; the caller holds snapshot_mutex.
+     */
+    class SnapshotScope {
+    public:
+        explicit SnapshotScope(SnapshotCounters& counters) : counters_(counters) {
+            counters_.in_progress.store(true, std::memory_order_relaxed);
+        }
+        ~SnapshotScope() {
+            const auto elapsed = std::chrono::steady_clock::now() - start_;
+            counters_.last_duration_ns.store(
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+                std::memory_order_relaxed);
+            counters_.last_ok.store(ok_, std::memory_order_relaxed);
+            if (ok_) {
+                counters_.last_finished_ms.store(nowMs(), std::memory_order_relaxed);
+                counters_.completed.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                counters_.failed.fetch_add(1, std::memory_order_relaxed);
+            }
+            counters_.in_progress.store(false, std::memory_order_relaxed);
+        }
+        void succeeded() noexcept { ok_ = true; }
+
+    private:
+        SnapshotCounters& counters_;
+        std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+        bool ok_ = false;
+    };
+
+    uint32_t lfuMinutes() const noexcept {
+        return (clock_seconds.load(std::memory_order_relaxed) / 60) & 0xFFFF;
+    }
+
+    /**
+     * @brief Returns an LFU counter after decaying it by one per minute since its last access.
+     */
+    uint32_t lfuDecayed(uint32_t access) const noexcept {
+        const uint32_t counter = access & 0xFF;
+        const uint32_t elapsed = (lfuMinutes() - (access >> 8)) & 0xFFFF;
+        return elapsed >= counter ? 0 : counter - elapsed;
+    }
+
+    /**
+     * @brief Access metadata for an entry that was just written.
+     */
+    uint32_t freshAccess() const noexcept {
+        if (eviction_policy == EvictionPolicy::AllKeysLFU) return (lfuMinutes() << 8) | LFU_INIT_VAL;
+        return clock_seconds.load(std::memory_order_relaxed) & 0xFFFFFF;
+    }
+
+    /**
+     * @brief Records a read. Safe under the shared lock: racing readers may drop an update.
+     */
+    void touch(Record& record) const noexcept {
+        if (max_memory == 0 || eviction_policy == EvictionPolicy::NoEviction) return;
+
+        const uint32_t old_access = __atomic_load_n(&record.access, __ATOMIC_RELAXED);
+        uint32_t access;
+        if (eviction_policy == EvictionPolicy::AllKeysLRU) {
+            access = clock_seconds.load(std::memory_order_relaxed) & 0xFFFFFF;
+        } else {
+            uint32_t counter = lfuDecayed(old_access);
+            if (counter < 255) {
+                // Logarithmic increment: p = 1 / ((counter - init) * factor + 1).
+                static thread_local uint64_t rng = 0x2545F4914F6CDD1DULL ^ reinterpret_cast<uintptr_t>(&rng);
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+                const uint32_t base = counter > LFU_INIT_VAL ? counter - LFU_INIT_VAL : 0;
+                if ((rng >> 11) * (1.0 / 9007199254740992.0) * (base * LFU_LOG_FACTOR + 1) < 1.0) ++counter;
+            }
+            access = (lfuMinutes() << 8) | counter;
+        }
+        // Skipping unchanged stores keeps hot entries from bouncing between readers' caches.
+        if (access != old_access) __atomic_store_n(&record.access, access, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * @brief Compresses a value that reaches the threshold, if that saves at least 1/COMPRESSION_MIN_SAVING.
+     * @param encoding Receives the encoding of the returned bytes.
+     * @return value itself, or its compressed form in a per-thread buffer the next call overwrites.
+     */
+    std::string_view encodeValue(std::string_view value, ValueEncoding& encoding) const {
+        encoding = ValueEncoding::Raw;
+        if (compression_threshold == 0 || value.size() < compression_threshold ||
+            value.size() >= SNAPSHOT_VALUE_LZ4) {
+            return value;
+        }
+        static thread_local std::string compressed;
+        const uint32_t raw_size = static_cast<uint32_t>(value.size());
+        if (compressed.size() < sizeof(raw_size) + Lz4::compressBound(value.size())) {
+            compressed.resize(sizeof(raw_size) + Lz4::compressBound(value.size()));
+        }
+        std::memcpy(&compressed[0], &raw_size, sizeof(raw_size));
+        // Bounding the output lets incompressible values give up early.
+        const size_t limit = value.size() - value.size() / COMPRESSION_MIN_SAVING - sizeof(raw_size);
+        const size_t size = Lz4::compress(value.data(), value.size(), &compressed[sizeof(raw_size)], limit);
+        if (size == 0) return value;
+        encoding = ValueEncoding::Lz4;
+        return std::string_view(compressed.data(), sizeof(raw_size) + size);
+    }
+
+    /**
+     * @brief Decompresses an Lz4-encoded value into out.
+     * @return False if stored is not a valid compressed value.
+     */
+    static bool decompress(std::string_view stored, std::string& out) {
+        uint32_t raw_size;
+        if (stored.size() < sizeof(raw_size)) return false;
+        std::memcpy(&raw_size, stored.data(), sizeof(raw_size));
+        // No LZ4 block expands more than 255-fold; refuse to allocate for a corrupt size.
+        if (raw_size / 255 > stored.size()) return false;
+        out.resize(raw_size);
+        return Lz4::decompress(stored.data() + sizeof(raw_size), stored.size() - sizeof(raw_size), &out[0], raw_size);
+    }
+
+    /**
+     * @brief Evicts from a shard the caller holds exclusively until it fits its share of max_memory.
+     * @return False if the shard is still over its share, so the write must be refused.
+     */
+    bool makeRoom(size_t index, Shard& shard) {
+        if (max_memory == 0) return true;
+        const size_t budget = max_memory / shard_count;
+        while (shard.memoryUsage() > budget) {
+            if (eviction_policy == EvictionPolicy::NoEviction || shard.data().empty()) return false;
+            evictOne(index, shard);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Evicts the best of eviction_samples randomly sampled entries.
+     *
+     * Already expired entries win outright; otherwise the one idle longest
+     * (LRU) or with the lowest decayed counter (LFU) goes.
+     */
+    void evictOne(size_t index, Shard& shard) {
+        const int64_t now = nowMs();
+        const uint32_t clock = clock_seconds.load(std::memory_order_relaxed) & 0xFFFFFF;
+        size_t victim = 0;
+        uint64_t victim_score = 0;
+        for (size_t n = 0; n < eviction_samples; ++n) {
+            const size_t pos = shard.nextRandom() % shard.data().size();
+            const Record& record = *shard.data().values()[pos];
+            const uint32_t access = __atomic_load_n(&record.access, __ATOMIC_RELAXED);
+
+            uint64_t score;
+            if (expired(record, now)) {
+                score = UINT64_MAX;
+            } else if (eviction_policy == EvictionPolicy::AllKeysLRU) {
+                score = (clock - access) & 0xFFFFFF;
+            } else {
+                score = 255 - lfuDecayed(access);
+            }
+            if (n == 0 || score > victim_score) {
+                victim = pos;
+                victim_score = score;
+            }
+        }
+
+        auto it = shard.data().begin() + static_cast<std::ptrdiff_t>(victim);
+        if (log) log->logDel(index, (*it)->key());
+        shard.erase(it);
+        evicted_keys.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Shard& shardFor(std::string_view key) {
+        return shards[shardOf(key)];
+    }
+
+    struct BatchEntry {
+        size_t shard;
+        size_t index;
+    };
+
+    /**
+     * @brief Runs f on every key of a batch while holding each involved shard's lock.
+     *
+     * Shards are locked in ascending order, the same order snapshots use,
+     * and stay locked until the whole batch is done, so the batch is atomic
+     * with respect to single-key operations. Within a shard, keys are
+     * visited in batch order.
+     * @param keys keys[i * stride] is the i-th key.
+     * @param f Called as f(shard_index, shard, i).
+     */
+    template <bool Exclusive, typename F>
+    void forEachKeyLocked(const std::string_view* keys, size_t count, size_t stride, F&& f) {
+        forEachKeyLocked<Exclusive>(keys, count, stride, std::forward<F>(f), [](size_t, Shard&) { return true; });
+    }
+
+    /**
+     * @brief forEachKeyLocked() with a per-shard check that can veto the whole batch.
+     * @param prepare Called as prepare(shard_index, shard) once per involved shard, after
+     *        every lock is held and before any f; if one returns false nothing else runs.
+     * @return False if the batch was vetoed.
+     */
+    template <bool Exclusive, typename F, typename Prepare>
+    bool forEachKeyLocked(const std::string_view* keys, size_t count, size_t stride, F&& f, Prepare&& prepare) {
+        static thread_local std::vector<BatchEntry> plan;
+        plan.clear();
+        for (size_t i = 0; i < count; ++i) plan.push_back({shardOf(keys[i * stride]), i});
+        std::sort(plan.begin(), plan.end(), [](const BatchEntry& a, const BatchEntry& b) {
+            return a.shard != b.shard ? a.shard < b.shard : a.index < b.index;
+        });
+
+        struct Unlocker {
+            KVStore& store;
+            size_t locked_through = 0;  ///< plan[0, locked_through) covers every locked shard.
+            ~Unlocker() {
+                for (size_t i = 0; i < locked_through; ++i) {
+                    if (i > 0 && plan[i].shard == plan[i - 1].shard) continue;
+                    if (Exclusive) store.shards[plan[i].shard].unlock();
+                    else store.shards[plan[i].shard].unlock_shared();
+                }
+            }
+        } unlocker{*this};
+
+        for (size_t i = 0; i < plan.size(); ++i) {
+            if (i == 0 || plan[i].shard != plan[i - 1].shard) {
+                if (Exclusive) shards[plan[i].shard].lock();
+                else shards[plan[i].shard].lock_shared();
+            }
+            unlocker.locked_through = i + 1;
+        }
+        for (size_t i = 0; i < plan.size(); ++i) {
+            if (i > 0 && plan[i].shard == plan[i - 1].shard) continue;
+            if (!prepare(plan[i].shard, shards[plan[i].shard])) return false;
+        }
+        for (const BatchEntry& entry : plan) {
+            f(entry.shard, shards[entry.shard], entry.index);
+        }
+        return true;
+    }
+
+public:
     /**
      * @brief Constructs a KVStore and loads data from disk if available.
+     * @param num_shards Number of independently locked shards, rounded up to a power of two.
+     * @param load Load kvstore.dat; pass false when recovery is driven elsewhere (see AppendOnlyLog).
+     */
+    explicit KVStore(size_t num_shards = DEFAULT_SHARD_COUNT, bool load = true) {
+        shard_count = 1;
+        while (shard_count < num_shards) shard_count <<= 1;
+        shards = std::make_unique<Shard[]>(shard_count);
+        if (load) loadFromDisk();
+    }
+
+    /**
+     * @brief Loads kvstore.dat if available.
      */
     void loadFromDisk() {
-        std::ifstream inFile(filename, std::ios::binary);
-        if (!inFile) return;
+        loadSnapshot(filename);
+    }
 
-        std::unique_lock lock(mutex);
-        data.clear();
-        
-        size_t size;
-        while (inFile.read(reinterpret_cast<char*>(&size), size > 0)) {
-            std::string key(size, '\0');
-            inFile.read(&key[0], size);
-            
-            inFile.read(reinterpret_cast<char*>(&size), size);
-            std::string value(size, '\0');
-            inFile.read(&value[0], size);
-            
-            data[key] = value;
+    /**
+     * @brief Removes every key. Mutations are not logged.
+     */
+    void clear() {
+        for (size_t i = 0; i < shard_count; ++i) {
+            std::unique_lock lock(shards[i]);
+            shards[i].reset();
         }
     }
 
-public:
-    KVStore() {
-        loadFromDisk();
+    /**
+     * @brief Replaces the contents of the store with a snapshot file.
+     *
+     * The file is mapped and its blocks are loaded in parallel, one thread
+     * per block up to the number of CPUs, each map reserved upfront from the
+     * block's stored key count. When the snapshot was written with the same
+     * shard count, block i is exactly shard i and is filled under a single
+     * lock; otherwise every record is routed to its shard. Files in the old
+     * unversioned format are still read. Mutations are not logged.
+     * @param path Snapshot written by persistToDisk() or backgroundPersistTo().
+     * @return False if the file could not be opened.
+     * @throws std::runtime_error if the snapshot is truncated or fails its checksums.
+     */
+    bool loadSnapshot(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            const int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::system_category(), "fstat " + path);
+        }
+        const size_t file_size = static_cast<size_t>(st.st_size);
+
+        SnapshotHeader header;
+        if (file_size < sizeof(header) ||
+            pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+            std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+            ::close(fd);
+            return loadLegacySnapshot(path);
+        }
+
+        void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        const int map_errno = errno;
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::system_error(map_errno, std::system_category(), "mmap " + path);
+        }
+        madvise(mapping, file_size, MADV_WILLNEED);
+
+        const bool ok = loadMapped(static_cast<const char*>(mapping), file_size, header);
+        munmap(mapping, file_size);
+        if (!ok) {
+            clear();
+            throw std::runtime_error("Corrupt snapshot " + path);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Replaces the contents of the store with a snapshot held in memory.
+     *
+     * Takes the same versioned format as loadSnapshot(), e.g. the image a
+     * replica assembles from backgroundStreamTo(). Mutations are not logged.
+     * @throws std::runtime_error if the image is not a snapshot or fails its checksums.
+     */
+    void loadSnapshotImage(const char* data, size_t size) {
+        SnapshotHeader header;
+        if (size < sizeof(header)) throw std::runtime_error("Truncated snapshot image");
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+            !loadMapped(data, size, header)) {
+            clear();
+            throw std::runtime_error("Corrupt snapshot image");
+        }
+    }
+
+    /**
+     * @brief Installs the log that receives every subsequent mutation.
+     * @param mutation_log Log to notify, or nullptr to stop logging.
+     */
+    void setMutationLog(MutationLog* mutation_log) { log = mutation_log; }
+
+    /**
+     * @brief Waits until this thread's mutations are durable under the log's policy.
+     */
+    void syncLog() {
+        if (log) log->sync();
+    }
+
+    /**
+     * @brief errno of the write failure the log is stuck on, or 0; writes should be refused meanwhile.
+     */
+    int logWriteError() const { return log ? log->writeError() : 0; }
+
+    /**
+     * @brief Returns the total number of keys.
+     */
+    size_t size() {
+        size_t total = 0;
+        for (size_t i = 0; i < shard_count; ++i) {
+            std::shared_lock lock(shards[i]);
+            total += shards[i].data().size();
+        }
+        return total;
+    }
+
+    /**
+     * @brief Returns the number of shards.
+     */
+    size_t shardCount() const noexcept { return shard_count; }
+
+    /**
+     * @brief A shard's write sequence: it changes whenever a write section begins or ends in the shard.
+     *
+     * A value copied under readVersioned() is still current while this
+     * returns the version it was read under.
+     * @param index Shard index, as returned by shardOf().
+     */
+    uint64_t shardVersion(size_t index) const noexcept {
+        return shards[index].seq.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Returns the index of the shard owning a key.
+     *
+     * Uses hash bits 8 and up: the map itself takes its bucket index from the
+     * top bits and its fingerprint from the low byte.
+     */
+    size_t shardOf(std::string_view key) const noexcept {
+        return (StringHash{}(key) >> 8) & (shard_count - 1);
+    }
+
+    /**
+     * @brief Reallocates a shard's table and records from the calling thread.
+     *
+     * New pages come from the caller's NUMA node (first touch, or the
+     * preferred node a NUMA-local Worker sets), so a worker can pull the
+     * partition it serves into local memory after it has been loaded elsewhere.
+     * @param index Shard index, as returned by shardOf().
+     */
+    void rehomeShard(size_t index) {
+        Shard& shard = shards[index];
+        std::unique_lock lock(shard);
+        auto local = std::make_unique<Map>();
+        RecordArena arena;
+        local->reserve(shard.data().size());
+        for (const Record* record : shard.data()) {
+            local->insert(arena.copy(*record));
+        }
+        shard.publish(local.release());
+        shard.arena = std::move(arena);
+    }
+
+    /**
+     * @brief Returns the current Unix time in milliseconds.
+     */
+    static int64_t nowMs() noexcept {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Bounds memory use; call before the store is shared.
+     * @param bytes Limit on memoryUsage(), split evenly across shards; 0 removes it.
+     * @param policy What to do once a shard reaches its share.
+     * @param samples Keys sampled per eviction; more is closer to exact LRU/LFU but slower.
+     */
+    void setMaxMemory(size_t bytes, EvictionPolicy policy, size_t samples = DEFAULT_EVICTION_SAMPLES) {
+        max_memory = bytes;
+        eviction_policy = policy;
+        eviction_samples = std::max<size_t>(samples, 1);
+        tick();
+    }
+
+    /**
+     * @brief Advances the coarse clock used for LRU/LFU metadata; call a few times per second.
+     */
+    void tick() noexcept {
+        clock_seconds.store(static_cast<uint32_t>(nowMs() / 1000), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Bytes attributed to stored data: keys, values and per-entry table overhead.
+     */
+    size_t memoryUsage() {
+        size_t total = 0;
+        for (size_t i = 0; i < shard_count; ++i) {
+            std::shared_lock lock(shards[i]);
+            total += shards[i].memoryUsage();
+        }
+        return total;
+    }
+
+    size_t maxMemory() const noexcept { return max_memory; }
+
+    /**
+     * @brief Stores values of at least min_size bytes LZ4-compressed when that saves space; call before the store is shared.
+     *
+     * Values already stored keep their encoding until they are next written.
+     * @param min_size Threshold in bytes, at least 64; 0 stores every new value as is.
+     */
+    void setCompression(size_t min_size) noexcept {
+        compression_threshold = min_size == 0 ? 0 : std::max<size_t>(min_size, 64);
+    }
+
+    size_t compressionThreshold() const noexcept { return compression_threshold; }
+
+    /**
+     * @brief Number of values stored compressed, without locking.
+     */
+    size_t compressedKeys() const noexcept {
+        size_t total = 0;
+        for (size_t i = 0; i < shard_count; ++i) total += shards[i].compressed_count.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    /**
+     * @brief A record's value, decompressed if it is stored compressed.
+     *
+     * Call with the record's shard locked. A decompressed value lives in a
+     * per-thread buffer that the thread's next call overwrites.
+     */
+    static std::string_view valueOf(const Record& record) {
+        if (record.encoding() == ValueEncoding::Raw) return record.value();
+        static thread_local std::string decoded;
+        // Compressed values are checked on the way in (see setEncoded() and the snapshot checksums).
+        if (!decompress(record.value(), decoded)) decoded.clear();
+        return decoded;
+    }
+
+    /**
+     * @brief Number of keys evicted to stay under the memory limit.
+     */
+    uint64_t evictedKeys() const noexcept { return evicted_keys.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Number of expired keys removed, lazily or by expireCycle().
+     */
+    uint64_t expiredKeys() const noexcept { return expired_keys.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Number of keys that carry an expiry, without locking.
+     */
+    size_t expiringKeys() const noexcept {
+        size_t total = 0;
+        for (size_t i = 0; i < shard_count; ++i) total += shards[i].volatile_count.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    /**
+     * @brief Shard lock acquisitions that had to wait for another thread, summed over shards.
+     */
+    struct LockStats {
+        uint64_t waits = 0;
+        uint64_t wait_ns = 0;
+    };
+
+    LockStats lockStats() const noexcept {
+        LockStats stats;
+        for (size_t i = 0; i < shard_count; ++i) {
+            stats.waits += shards[i].lock_waits.load(std::memory_order_relaxed);
+            stats.wait_ns += shards[i].lock_wait_ns.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+    /**
+     * @brief What persistToDisk() and the forked snapshots have done so far.
+     */
+    struct SnapshotStats {
+        uint64_t completed = 0;
+        uint64_t failed = 0;
+        bool in_progress = false;
+        bool last_ok = true;
+        int64_t last_finished_ms = 0;   ///< Unix time of the last success, 0 if none.
+        uint64_t last_duration_ns = 0;  ///< Wall time of the last attempt.
+        uint64_t last_fork_ns = 0;      ///< How long the last fork() blocked the caller, shards locked.
+    };
+
+    SnapshotStats snapshotStats() const noexcept {
+        SnapshotStats stats;
+        stats.completed = snapshot_counters.completed.load(std::memory_order_relaxed);
+        stats.failed = snapshot_counters.failed.load(std::memory_order_relaxed);
+        stats.in_progress = snapshot_counters.in_progress.load(std::memory_order_relaxed);
+        stats.last_ok = snapshot_counters.last_ok.load(std::memory_order_relaxed);
+        stats.last_finished_ms = snapshot_counters.last_finished_ms.load(std::memory_order_relaxed);
+        stats.last_duration_ns = snapshot_counters.last_duration_ns.load(std::memory_order_relaxed);
+        stats.last_fork_ns = snapshot_counters.last_fork_ns.load(std::memory_order_relaxed);
+        return stats;
     }
 
     /**
-     * @brief Stores a key-value pair.
+     * @brief Stores a key-value pair, replacing any previous expiry.
      * @param key The key to store.
      * @param value The value associated with the key.
+     * @param expire_at Absolute expiry in Unix milliseconds, or 0 to never expire.
+     * @return False if the shard is full and the eviction policy is NoEviction.
+     */
+    bool set(std::string_view key, std::string_view value, int64_t expire_at = 0) {
+        ValueEncoding encoding;
+        const std::string_view stored = encodeValue(value, encoding);
+        return setStored(key, stored, encoding, expire_at);
+    }
+
+    /**
+     * @brief Stores a value that is already encoded, e.g. one replayed from a log in compressed form.
+     * @param stored Value bytes in the given encoding.
+     * @return False if the shard is full and the eviction policy is NoEviction.
+     * @throws std::invalid_argument if stored does not decode.
      */
-    void set(const std::string& key, const std::string& value) {
-        std::unique_lock lock(mutex);
-        data[key] = value;
+    bool setEncoded(std::string_view key, std::string_view stored, ValueEncoding encoding) {
+        static thread_local std::string check;
+        if (encoding != ValueEncoding::Raw && (encoding != ValueEncoding::Lz4 || !decompress(stored, check))) {
+            throw std::invalid_argument("corrupt compressed value");
+        }
+        return setStored(key, stored, encoding, 0);
+    }
+
+    /**
+     * @brief Integers as Redis accepts them for INCR: optional '-', no '+', spaces or leading zeros.
+     */
+    static bool parseInteger(std::string_view text, int64_t& value) {
+        if (text.empty() || text.size() > 20) return false;
+        if (text.size() > 1 && (text[0] == '0' || (text[0] == '-' && text[1] == '0'))) return false;
+        const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return ec == std::errc() && end == text.data() + text.size();
+    }
+
+    /**
+     * @brief Numbers as INCRBYFLOAT accepts them: anything strtold reads whole, except NaN and overflow.
+     */
+    static bool parseLongDouble(std::string_view text, long double& value) {
+        if (text.empty() || text.size() >= NUMERIC_MAX_CHARS || std::isspace(static_cast<unsigned char>(text[0]))) {
+            return false;
+        }
+        char copy[NUMERIC_MAX_CHARS];
+        std::memcpy(copy, text.data(), text.size());
+        copy[text.size()] = '\0';
+        char* end = nullptr;
+        errno = 0;
+        value = std::strtold(copy, &end);
+        return end == copy + text.size() && errno != ERANGE && !std::isnan(value);
+    }
+
+    /**
+     * @brief Adds delta to the integer stored at key, creating it as 0 if missing, as INCRBY does.
+     *
+     * Reads, computes and writes back under one exclusive shard lock, so
+     * concurrent increments never lose an update. Values stay decimal text
+     * and are rewritten in place while the number of digits stays in the
+     * record's size class; any expiry is kept.
+     * @param result Receives the new value on Ok.
+     */
+    NumericStatus incrBy(std::string_view key, int64_t delta, int64_t& result) {
+        return updateNumber(key, [&](const std::string_view* current, char* text, size_t& length) {
+            int64_t value = 0;
+            if (current && !parseInteger(*current, value)) return NumericStatus::NotNumber;
+            if (__builtin_add_overflow(value, delta, &result)) return NumericStatus::Overflow;
+            length = static_cast<size_t>(std::to_chars(text, text + NUMERIC_MAX_CHARS, result).ptr - text);
+            return NumericStatus::Ok;
+        });
+    }
+
+    /**
+     * @brief Adds delta to the number stored at key in long double precision, as INCRBYFLOAT does.
+     * @param result Receives the new value as stored: decimal without exponent, trailing zeros trimmed.
+     */
+    NumericStatus incrByFloat(std::string_view key, long double delta, std::string& result) {
+        return updateNumber(key, [&](const std::string_view* current, char* text, size_t& length) {
+            long double value = 0;
+            if (current && !parseLongDouble(*current, value)) return NumericStatus::NotNumber;
+            value += delta;
+            if (std::isnan(value) || std::isinf(value)) return NumericStatus::Overflow;
+
+            // 17 significant digits hide binary noise (10.5 + 0.1 is 10.6); values %Lg would
+            // print with an exponent are written in full instead.
+            const long double magnitude = std::fabs(value);
+            const bool full = magnitude != 0 && (magnitude < 1e-4L || magnitude >= 1e17L);
+            const int written = std::snprintf(text, NUMERIC_MAX_CHARS, full ? "%.17Lf" : "%.17Lg", value);
+            if (written <= 0 || written >= NUMERIC_MAX_CHARS) return NumericStatus::Overflow;
+            length = static_cast<size_t>(written);
+            if (std::memchr(text, '.', length)) {
+                while (text[length - 1] == '0') --length;
+                if (text[length - 1] == '.') --length;
+            }
+            if (length == 2 && text[0] == '-' && text[1] == '0') {
+                text[0] = '0';
+                length = 1;
+            }
+            result.assign(text, length);
+            return NumericStatus::Ok;
+        });
     }
 
     /**
      * @brief Retrieves a value by key.
      * @param key The key to look up.
-     * @return The value if found, otherwise std::nullopt.
+     * @return The value if found and not expired, otherwise std::nullopt.
      */
-    std::optional<std::string> get(const std::string& key) {
-        std::shared_lock lock(mutex);
-        auto it = data.find(key);
-        if (it != data.end()) {
-            return it->second;
+    std::optional<std::string> get(std::string_view key) {
+        std::optional<std::string> value;
+        read(key, [&](const Record& record) { value.emplace(valueOf(record)); });
+        return value;
+    }
+
+    /**
+     * @brief Looks a key up and lets visit serialize its value in place, without a copy.
+     *
+     * visit(const Record&) runs under the shard's shared lock; to use the
+     * value after it returns, take RecordArena::pin() of a pinnable record.
+     * @return False if the key is missing or expired; visit is not called.
+     */
+    template <typename Visitor>
+    bool read(std::string_view key, Visitor&& visit) {
+        const size_t index = shardOf(key);
+        Shard& shard = shards[index];
+        {
+            std::shared_lock lock(shard);
+            auto it = shard.data().find(key);
+            if (it == shard.data().end()) return false;
+            if (!expired(**it)) {
+                touch(**it);
+                visit(static_cast<const Record&>(**it));
+                return true;
+            }
         }
-        return std::nullopt;
+
+        std::unique_lock lock(shard);
+        findLive(index, shard, key);
+        return false;
+    }
+
+    /**
+     * @brief read() that also tells visit which shard the key is in and that shard's shardVersion().
+     *
+     * visit(const Record&, size_t shard, uint64_t version) runs under the
+     * shared lock, so no write can land between the version and the value.
+     */
+    template <typename Visitor>
+    bool readVersioned(std::string_view key, Visitor&& visit) {
+        const size_t index = shardOf(key);
+        const Shard& shard = shards[index];
+        return read(key, [&](const Record& record) {
+            visit(record, index, shard.seq.load(std::memory_order_relaxed));
+        });
+    }
+
+    /**
+     * @brief Looks a key up without locking, for threads registered with Qsbr.
+     *
+     * stage(std::string_view value) -> bool copies the value to wherever the
+     * caller wants it and may run on bytes a writer is rewriting, possibly
+     * more than once: only a Hit says the last staged copy is consistent.
+     * It returns false to decline a value, e.g. one it would rather pin.
+     * A compressed value is staged once, already validated and decompressed.
+     * @return Hit or Miss when the shard was not written meanwhile; Fallback if
+     *         the thread is not a reader, writers kept interfering, the key
+     *         has expired or stage declined. Callers then use read().
+     */
+    template <typename Stage>
+    ReadStatus readOptimistic(std::string_view key, Stage&& stage) {
+        if (!Qsbr::registered()) return ReadStatus::Fallback;
+
+        Shard& shard = shardFor(key);
+        for (int attempt = 0; attempt < OPTIMISTIC_READ_ATTEMPTS; ++attempt) {
+            const uint64_t start = shard.seq.load(std::memory_order_acquire);
+            if (start & 1) continue;
+
+            const Map& table = *shard.table.load(std::memory_order_acquire);
+            const size_t size = table.size();
+            auto it = table.find(key);
+            // Compare to the size read first: a racing erase can move end() under find.
+            if (static_cast<size_t>(it - table.begin()) >= size) {
+                if (shard.validate(start)) return ReadStatus::Miss;
+                continue;
+            }
+
+            Record* record = *it;
+            const uint32_t key_size = __atomic_load_n(&record->key_size, __ATOMIC_RELAXED);
+            const uint32_t value_word = __atomic_load_n(&record->value_size, __ATOMIC_RELAXED);
+            const uint32_t value_size = Record::storedSize(value_word);
+            const uint32_t capacity = __atomic_load_n(&record->capacity, __ATOMIC_RELAXED);
+            if (Record::sizeFor(key_size, value_size) > capacity) continue;
+            const int64_t expire_at = __atomic_load_n(&record->expire_at, __ATOMIC_RELAXED);
+            if (expire_at != 0 && expire_at <= nowMs()) return ReadStatus::Fallback;
+
+            const std::string_view stored(record->bytes() + key_size, value_size);
+            if (Record::encodingOf(value_word) != ValueEncoding::Raw) {
+                // Decompressing bytes a writer may be changing is wasted work: copy, validate, then decode.
+                static thread_local std::string copy;
+                copy.assign(stored.data(), stored.size());
+                if (!shard.validate(start)) continue;
+                static thread_local std::string decoded;
+                if (!decompress(copy, decoded) || !stage(std::string_view(decoded))) return ReadStatus::Fallback;
+                touch(*record);
+                return ReadStatus::Hit;
+            }
+            if (!stage(stored)) return ReadStatus::Fallback;
+            if (shard.validate(start)) {
+                touch(*record);
+                return ReadStatus::Hit;
+            }
+        }
+        return ReadStatus::Fallback;
     }
 
     /**
      * @brief Deletes a key from the store.
      * @param key The key to delete.
-     * @return True if the key was deleted, false otherwise.
+     * @return True if a live key was deleted, false otherwise.
      */
-    bool del(const std::string& key) {
-        std::unique_lock lock(mutex);
-        return data.erase(key) > 0;
+    bool del(std::string_view key) {
+        const size_t index = shardOf(key);
+        Shard& shard = shards[index];
+        std::unique_lock lock(shard);
+        auto it = shard.data().find(key);
+        if (it == shard.data().end()) return false;
+
+        const bool live = !expired(**it);
+        shard.erase(it);
+        if (log) log->logDel(index, key);
+        return live;
+    }
+
+    /**
+     * @brief Sets or replaces a key's expiry.
+     * @param key Key to update.
+     * @param expire_at Absolute expiry in Unix milliseconds; a time in the past deletes the key.
+     * @return False if the key does not exist.
+     */
+    bool expireAt(std::string_view key, int64_t expire_at) {
+        const size_t index = shardOf(key);
+        Shard& shard = shards[index];
+        std::unique_lock lock(shard);
+        auto it = findLive(index, shard, key);
+        if (it == shard.data().end()) return false;
+
+        if (expire_at <= nowMs()) {
+            shard.erase(it);
+            if (log) log->logDel(index, key);
+        } else {
+            shard.setExpiry(**it, expire_at);
+            if (log) log->logExpire(index, key, expire_at);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Removes a key's expiry.
+     * @return True if the key exists and had an expiry.
+     */
+    bool persist(std::string_view key) {
+        const size_t index = shardOf(key);
+        Shard& shard = shards[index];
+        std::unique_lock lock(shard);
+        auto it = findLive(index, shard, key);
+        if (it == shard.data().end() || (*it)->expire_at == 0) return false;
+
+        shard.setExpiry(**it, 0);
+        if (log) log->logExpire(index, key, 0);
+        return true;
+    }
+
+    /**
+     * @brief Returns the time a key has left to live.
+     * @return Milliseconds remaining, -1 if the key never expires, -2 if it does not exist.
+     */
+    int64_t ttlMs(std::string_view key) {
+        Shard& shard = shardFor(key);
+        std::shared_lock lock(shard);
+        auto it = shard.data().find(key);
+        if (it == shard.data().end()) return -2;
+        if ((*it)->expire_at == 0) return -1;
+
+        const int64_t remaining = (*it)->expire_at - nowMs();
+        return remaining > 0 ? remaining : -2;
+    }
+
+    /**
+     * @brief Reclaims expired keys from a subset of shards; call periodically.
+     *
+     * Shards without keys that carry an expiry are skipped without locking.
+     * Each remaining shard is sampled in rounds of 20 entries, walking its
+     * dense entry array from a per-shard cursor; another round follows only
+     * while at least a quarter of the previous one had expired, and never
+     * beyond max_samples. Lock hold time per shard is therefore bounded and
+     * successive calls cover the whole shard without ever scanning it at once.
+     * @param first First shard to visit.
+     * @param stride Visit shards first, first + stride, ...
+     * @param max_samples Upper bound on entries examined per shard per call.
+     * @return Number of keys removed.
+     */
+    size_t expireCycle(size_t first, size_t stride, size_t max_samples = 400) {
+        constexpr size_t kRound = 20;
+        size_t removed = 0;
+        const int64_t now = nowMs();
+
+        for (size_t index = first; index < shard_count; index += stride) {
+            Shard& shard = shards[index];
+            if (shard.volatile_count.load(std::memory_order_relaxed) == 0) continue;
+
+            std::unique_lock lock(shard);
+            for (size_t sampled = 0; sampled < max_samples;) {
+                size_t expired_in_round = 0;
+                for (size_t n = 0; n < kRound && !shard.data().empty(); ++n, ++sampled) {
+                    // Walking down means the back-swap of an erase only moves an entry already seen.
+                    if (shard.sweep_cursor == 0 || shard.sweep_cursor > shard.data().size()) {
+                        shard.sweep_cursor = shard.data().size();
+                    }
+                    const size_t pos = --shard.sweep_cursor;
+                    auto it = shard.data().begin() + static_cast<std::ptrdiff_t>(pos);
+                    if (!expired(**it, now)) continue;
+
+                    if (log) log->logDel(index, (*it)->key());
+                    shard.erase(it);
+                    ++expired_in_round;
+                }
+                removed += expired_in_round;
+                expired_keys.fetch_add(expired_in_round, std::memory_order_relaxed);
+                if (expired_in_round * 4 < kRound || shard.volatile_count.load(std::memory_order_relaxed) == 0) break;
+            }
+        }
+        return removed;
+    }
+
+    /**
+     * @brief Looks up several keys, locking each involved shard once.
+     *
+     * The lookups see one consistent state: no concurrent multiSet() or
+     * multiDel() is observed half-applied.
+     * @param keys Array of count keys.
+     * @param visit Called as visit(i, value) for every key, value a
+     *        const std::string_view* that is nullptr if the key is missing or
+     *        expired. Runs with the shard locks held, grouped by shard rather
+     *        than in key order; the viewed bytes are only valid during the call.
+     */
+    template <typename Visitor>
+    void multiGet(const std::string_view* keys, size_t count, Visitor&& visit) {
+        const int64_t now = nowMs();
+        forEachKeyLocked<false>(keys, count, 1, [&](size_t, Shard& shard, size_t i) {
+            auto it = shard.data().find(keys[i]);
+            if (it == shard.data().end() || expired(**it, now)) {
+                visit(i, static_cast<const std::string_view*>(nullptr));
+                return;
+            }
+            touch(**it);
+            const std::string_view value = valueOf(**it);
+            visit(i, &value);
+        });
+    }
+
+    /**
+     * @brief Stores several key-value pairs atomically, locking each involved shard once.
+     * @param pairs Array of 2 * count views: key, value, key, value, ...
+     * @param count Number of pairs. For repeated keys the last value wins.
+     * @return False, with nothing written, if a shard is full under NoEviction.
+     */
+    bool multiSet(const std::string_view* pairs, size_t count) {
+        // Compress ahead of locking; values that stay raw are not copied.
+        static thread_local std::vector<std::string> compressed;
+        static thread_local std::vector<ValueEncoding> encodings;
+        compressed.resize(std::max(compressed.size(), count));
+        encodings.assign(count, ValueEncoding::Raw);
+        if (compression_threshold != 0) {
+            for (size_t i = 0; i < count; ++i) {
+                const std::string_view stored = encodeValue(pairs[2 * i + 1], encodings[i]);
+                if (encodings[i] != ValueEncoding::Raw) compressed[i].assign(stored.data(), stored.size());
+            }
+        }
+
+        return forEachKeyLocked<true>(pairs, count, 2, [&](size_t index, Shard& shard, size_t i) {
+            const std::string_view key = pairs[2 * i];
+            const std::string_view stored =
+                encodings[i] == ValueEncoding::Raw ? pairs[2 * i + 1] : std::string_view(compressed[i]);
+            shard.upsert(key, stored, 0, encodings[i]).access = freshAccess();
+            if (log) log->logSet(index, key, stored, encodings[i]);
+        }, [&](size_t index, Shard& shard) { return makeRoom(index, shard); });
+    }
+
+    /**
+     * @brief Deletes several keys atomically, locking each involved shard once.
+     * @param keys Array of count keys.
+     * @return Number of keys that existed and were deleted.
+     */
+    size_t multiDel(const std::string_view* keys, size_t count) {
+        size_t deleted = 0;
+        const int64_t now = nowMs();
+        forEachKeyLocked<true>(keys, count, 1, [&](size_t index, Shard& shard, size_t i) {
+            auto it = shard.data().find(keys[i]);
+            if (it == shard.data().end()) return;
+            if (!expired(**it, now)) ++deleted;
+            shard.erase(it);
+            if (log) log->logDel(index, keys[i]);
+        });
+        return deleted;
+    }
+
+    /**
+     * @brief Visits a bounded slice of the keyspace, resuming where the previous call stopped.
+     *
+     * Each shard's value vector is walked from the back, SCAN_LOCK_BATCH
+     * entries per shared-lock hold. An erase back-swaps the last entry into
+     * the gap, and the last entry is always one the walk has passed already,
+     * so a key present for the whole iteration is visited at least once; it
+     * may be visited twice. Keys added meanwhile may or may not be seen. New
+     * table generations copy entries in order, so positions carry over.
+     * @param cursor 0 to start; otherwise a value returned by the previous call.
+     *        Encodes the shard in its top bits and the entries of that shard
+     *        still to walk in the low SCAN_POSITION_BITS.
+     * @param count Entries to examine, at least 1; expired ones count but are not visited.
+     * @param visit Called as visit(std::string_view key) for live keys, with the shard's shared lock held.
+     * @return The cursor to continue from; 0 once every shard has been walked.
+     */
+    template <typename Visitor>
+    uint64_t scan(uint64_t cursor, size_t count, Visitor&& visit) {
+        constexpr uint64_t kPositionMask = (uint64_t{1} << SCAN_POSITION_BITS) - 1;
+        size_t index = static_cast<size_t>(cursor >> SCAN_POSITION_BITS);
+        uint64_t remaining = cursor & kPositionMask;
+        bool started = remaining != 0;
+        const int64_t now = nowMs();
+
+        for (size_t examined = 0; index < shard_count && examined < count;) {
+            Shard& shard = shards[index];
+            {
+                std::shared_lock lock(shard);
+                const auto& values = shard.data().values();
+                // Past the end the shard shrank; every entry left to walk is still below size().
+                if (!started || remaining > values.size()) remaining = values.size();
+                started = true;
+                const size_t batch = static_cast<size_t>(
+                    std::min<uint64_t>({remaining, count - examined, SCAN_LOCK_BATCH}));
+                for (size_t n = 0; n < batch; ++n) {
+                    const Record* record = values[static_cast<size_t>(--remaining)];
+                    if (!expired(*record, now)) visit(record->key());
+                }
+                examined += batch;
+            }
+            if (remaining == 0) {
+                ++index;
+                started = false;
+            }
+        }
+        if (index >= shard_count) return 0;
+        return (static_cast<uint64_t>(index) << SCAN_POSITION_BITS) | remaining;
+    }
+
+    /**
+     * @brief Appends the live keys of one shard that satisfy match(std::string_view) to out.
+     *
+     * Holds the shard's shared lock for one pass over its entries.
+     */
+    template <typename Predicate>
+    void collectKeys(size_t index, Predicate&& match, std::vector<std::string>& out) {
+        Shard& shard = shards[index];
+        const int64_t now = nowMs();
+        std::shared_lock lock(shard);
+        for (const Record* record : shard.data()) {
+            if (!expired(*record, now) && match(record->key())) out.emplace_back(record->key());
+        }
+    }
+
+    /**
+     * @brief Hands keys of one shard to send and deletes them once it succeeds, all under the shard's lock.
+     *
+     * send(const std::vector<const Record*>&) -> bool receives the keys that
+     * are live, and no other thread can change them until it returns, so a
+     * key is either still here or already in whatever send put it into.
+     * Deletions are logged as usual.
+     * @param index Shard every key belongs to.
+     * @return Number of keys deleted; 0 if send failed.
+     */
+    template <typename Send>
+    size_t moveKeys(size_t index, const std::string* keys, size_t count, Send&& send) {
+        static thread_local std::vector<const Record*> records;
+        Shard& shard = shards[index];
+        const int64_t now = nowMs();
+        std::unique_lock lock(shard);
+        records.clear();
+        for (size_t i = 0; i < count; ++i) {
+            auto it = shard.data().find(keys[i]);
+            if (it != shard.data().end() && !expired(**it, now)) records.push_back(*it);
+        }
+        if (records.empty() || !send(records)) return 0;
+
+        for (const Record* record : records) {
+            const std::string key(record->key());
+            shard.erase(shard.data().find(key));
+            if (log) log->logDel(index, key);
+        }
+        return records.size();
     }
 
     /**
      * @brief Saves the current key-value store to disk.
+     *
+     * Shards are written one at a time, so writers only wait while their own
+     * shard is being serialized. The file is replaced atomically.
      * @throws std::runtime_error if file operations fail.
      */
     void persistToDisk() {
-        std::ofstream outFile(filename, std::ios::binary | std::ios::trunc);
-        if (!outFile) {
-            throw std::runtime_error("Failed to open file for writing");
+        std::lock_guard guard(snapshot_mutex);
+        SnapshotScope scope(snapshot_counters);
+        if (!writeSnapshotFile(filename, true)) {
+            throw std::runtime_error("Failed to write snapshot");
+        }
+        scope.succeeded();
+    }
+
+    /**
+     * @brief Writes a snapshot into an already open file, e.g. a memfd handed to a restarted server.
+     *
+     * Locks shards one at a time like persistToDisk(); loadSnapshot() reads
+     * the result back through /proc/self/fd.
+     * @throws std::runtime_error if writing fails.
+     */
+    void persistTo(int fd) {
+        std::lock_guard guard(snapshot_mutex);
+        SnapshotScope scope(snapshot_counters);
+        if (!writeSnapshot(fd, true)) {
+            throw std::runtime_error("Failed to write snapshot");
+        }
+        scope.succeeded();
+    }
+
+    /**
+     * @brief Saves a point-in-time snapshot from a forked child, like Redis BGSAVE.
+     *
+     * All shards are read-locked only for the duration of fork(), so the
+     * child sees a consistent copy-on-write image with no mutation in flight.
+     * Writers then run at full speed while the child serializes; the caller
+     * blocks until the child exits, so run this off the request path.
+     * @throws std::system_error if fork() fails.
+     * @throws std::runtime_error if the child fails to write the snapshot.
+     */
+    void backgroundPersist() {
+        backgroundPersistTo(filename, nullptr);
+    }
+
+    /**
+     * @brief Forks a snapshot to an arbitrary file, running a hook at the cut point.
+     *
+     * at_cut runs after every shard is read-locked and before fork(): no
+     * mutation is in flight, so whatever it records (a log position, say)
+     * lines up exactly with the state the child serializes.
+     * @param path Destination file; written via a temporary and renamed.
+     * @param at_cut Optional hook run at the cut point.
+     * @throws std::system_error if fork() fails.
+     * @throws std::runtime_error if the child fails to write the snapshot.
+     */
+    void backgroundPersistTo(const std::string& path, const std::function<void()>& at_cut) {
+        forkSnapshot([&] { return writeSnapshotFile(path, false); }, at_cut);
+    }
+
+    /**
+     * @brief Forks a snapshot that is written straight to a socket instead of a file.
+     *
+     * The stream is a series of RESP bulk strings: the snapshot from the
+     * first byte after its header on, an empty bulk string, and then the
+     * 64-byte header, which is only known at the end. Placing that header
+     * in front of the rest gives the file loadSnapshotImage() takes.
+     * @param fd Blocking socket; the child writes to it while the caller waits.
+     * @param at_cut As for backgroundPersistTo().
+     * @throws std::system_error if fork() fails.
+     * @throws std::runtime_error if the child fails to send the snapshot.
+     */
+    void backgroundStreamTo(int fd, const std::function<void()>& at_cut) {
+        forkSnapshot([this, fd] { return streamSnapshot(fd); }, at_cut);
+    }
+
+private:
+    bool setStored(std::string_view key, std::string_view stored, ValueEncoding encoding, int64_t expire_at) {
+        const size_t index = shardOf(key);
+        Shard& shard = shards[index];
+        std::unique_lock lock(shard);
+        if (!makeRoom(index, shard)) return false;
+
+        shard.upsert(key, stored, expire_at, encoding).access = freshAccess();
+        if (log) {
+            log->logSet(index, key, stored, encoding);
+            if (expire_at) log->logExpire(index, key, expire_at);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Replaces a key's value with compute()'s text under the exclusive shard lock, keeping its expiry.
+     *
+     * compute(const std::string_view* current, char* text, size_t& length)
+     * gets the live value or nullptr and writes up to NUMERIC_MAX_CHARS
+     * bytes; the store is only changed if it returns Ok.
+     */
+    template <typename Compute>
+    NumericStatus updateNumber(std::string_view key, Compute&& compute) {
+        const size_t index = shardOf(key);
+        Shard& shard = shards[index];
+        std::unique_lock lock(shard);
+        auto it = findLive(index, shard, key);
+        const bool exists = it != shard.data().end();
+        const std::string_view current = exists ? valueOf(**it) : std::string_view();
+
+        char text[NUMERIC_MAX_CHARS];
+        size_t length = 0;
+        const NumericStatus status = compute(exists ? &current : nullptr, text, length);
+        if (status != NumericStatus::Ok) return status;
+        if (!exists && !makeRoom(index, shard)) return NumericStatus::OutOfMemory;
+
+        const int64_t expire_at = exists ? (*it)->expire_at : 0;
+        const std::string_view value(text, length);
+        shard.upsert(key, value, expire_at).access = freshAccess();
+        if (log) {
+            log->logSet(index, key, value, ValueEncoding::Raw);
+            if (expire_at) log->logExpire(index, key, expire_at);
+        }
+        return NumericStatus::Ok;
+    }
+
+    static bool writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written == -1) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Reads the unversioned format: size_t-prefixed key and value, back to back.
+     *
+     * Reading stops at the first truncated record.
+     */
+    bool loadLegacySnapshot(const std::string& path) {
+        std::ifstream inFile(path, std::ios::binary);
+        if (!inFile) return false;
+
+        clear();
+
+        size_t size;
+        std::string key, value;
+        while (inFile.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+            key.resize(size);
+            if (!inFile.read(&key[0], size)) break;
+
+            if (!inFile.read(reinterpret_cast<char*>(&size), sizeof(size))) break;
+            value.resize(size);
+            if (!inFile.read(&value[0], size)) break;
+
+            Shard& shard = shardFor(key);
+            std::unique_lock lock(shard);
+            shard.upsert(key, value, 0);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Validates a mapped snapshot and loads its blocks on a pool of threads.
+     * @return False if the header, index or any block is inconsistent.
+     */
+    bool loadMapped(const char* base, size_t file_size, const SnapshotHeader& header) {
+        if (header.version < 1 || header.version > SNAPSHOT_VERSION || header.block_count == 0) return false;
+        const size_t index_size = size_t{header.block_count} * sizeof(SnapshotBlockIndex);
+        if (header.index_offset < sizeof(SnapshotHeader) || header.index_offset > file_size ||
+            file_size - header.index_offset < index_size) {
+            return false;
+        }
+
+        std::vector<SnapshotBlockIndex> index(header.block_count);
+        std::memcpy(index.data(), base + header.index_offset, index_size);
+        SnapshotChecksum checksum;
+        checksum.update(reinterpret_cast<const char*>(index.data()), index_size);
+        if (checksum.finish() != header.index_checksum) return false;
+
+        for (const SnapshotBlockIndex& block : index) {
+            if (block.offset < sizeof(SnapshotHeader) || block.offset > header.index_offset ||
+                header.index_offset - block.offset < block.length) {
+                return false;
+            }
+        }
+
+        clear();
+        const bool direct = header.block_count == shard_count;
+        if (!direct) {
+            // Records are routed, so only the total is known; spread it evenly.
+            const size_t per_shard = header.key_count / shard_count + header.key_count / shard_count / 8;
+            for (size_t i = 0; i < shard_count; ++i) {
+                std::unique_lock lock(shards[i]);
+                shards[i].reserve(per_shard);
+            }
         }
 
-        std::shared_lock lock(mutex);
-        for (const auto& [key, value] : data) {
-            size_t size = key.size();
-            outFile.write(reinterpret_cast<const char*>(&size), sizeof(size));
-            outFile.write(key.data(), size);
-            
-            size = value.size();
-            outFile.write(reinterpret_cast<const char*>(&size), sizeof(size));
-            outFile.write(value.data(), size);
+        const size_t threads = std::min<size_t>(header.block_count,
+                                                std::max(1u, std::thread::hardware_concurrency()));
+        const int64_t now = nowMs();
+        std::atomic<size_t> next_block{0};
+        std::atomic<bool> failed{false};
+        auto loader = [&] {
+            size_t i;
+            while (!failed.load(std::memory_order_relaxed) &&
+                   (i = next_block.fetch_add(1, std::memory_order_relaxed)) < index.size()) {
+                try {
+                    if (!loadBlock(base, index[i], header.version, now, direct ? &shards[i] : nullptr)) {
+                        failed = true;
+                    }
+                } catch (const std::exception&) {
+                    failed = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (size_t t = 1; t < threads; ++t) pool.emplace_back(loader);
+        loader();
+        for (auto& thread : pool) thread.join();
+        return !failed;
+    }
+
+    /**
+     * @brief Verifies one block's checksum and inserts its live records.
+     * @param version Snapshot version; version 1 records carry no expiry, and only version 3 compressed values.
+     * @param now Records that expired before this time are skipped.
+     * @param target Shard that owns every key of the block, or nullptr to route each record.
+     */
+    bool loadBlock(const char* base, const SnapshotBlockIndex& block, uint32_t version, int64_t now,
+                   Shard* target) {
+        const char* pos = base + block.offset;
+        const char* const end = pos + block.length;
+        const size_t record_header = version >= 2 ? sizeof(SnapshotRecordHeader) : 2 * sizeof(uint32_t);
+
+        SnapshotChecksum checksum;
+        checksum.update(pos, block.length);
+        if (checksum.finish() != block.checksum) return false;
+
+        std::unique_lock<Shard> target_lock;
+        if (target) {
+            target_lock = std::unique_lock(*target);
+            target->reserve(block.key_count);
+        }
+
+        uint64_t keys = 0;
+        while (pos < end) {
+            SnapshotRecordHeader record{};
+            if (static_cast<size_t>(end - pos) < record_header) return false;
+            std::memcpy(&record, pos, record_header);
+            pos += record_header;
+            const ValueEncoding encoding =
+                version >= 3 && (record.value_size & SNAPSHOT_VALUE_LZ4) ? ValueEncoding::Lz4 : ValueEncoding::Raw;
+            const size_t value_size = version >= 3 ? record.value_size & ~SNAPSHOT_VALUE_LZ4 : record.value_size;
+            if (static_cast<size_t>(end - pos) < size_t{record.key_size} + value_size) return false;
+
+            const std::string_view key(pos, record.key_size);
+            const std::string_view value(pos + record.key_size, value_size);
+            pos += size_t{record.key_size} + value_size;
+            ++keys;
+            if (record.expire_at != 0 && record.expire_at <= now) continue;
+
+            Shard& shard = target ? *target : shardFor(key);
+            std::unique_lock<Shard> lock;
+            if (!target) lock = std::unique_lock(shard);
+            // Compressed values stay compressed, whatever this store's threshold.
+            shard.upsert(key, value, record.expire_at, encoding).access = freshAccess();
+        }
+        return keys == block.key_count;
+    }
+
+    static void appendRecord(std::string& buffer, const Record& record) {
+        SnapshotRecordHeader header;
+        header.key_size = record.key_size;
+        static_assert(Record::kLz4Flag == SNAPSHOT_VALUE_LZ4, "records and snapshots share the LZ4 flag");
+        header.value_size = record.value_size;
+        header.expire_at = record.expire_at;
+        buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        // Key and value are contiguous in the record, exactly as the snapshot stores them.
+        buffer.append(record.bytes(), size_t{record.key_size} + record.value().size());
+    }
+
+    /**
+     * @brief Serializes every shard as snapshot blocks and the block index (see snapshot_format.h).
+     *
+     * Bytes go to write(const char*, size_t) -> bool in about 1 MiB pieces,
+     * and offsets assume they land after a SnapshotHeader, which is filled
+     * in here but left to the caller to place. Uses no locks beyond the
+     * optional shard locks and reports write failures by returning false,
+     * but allocates its buffer and can throw std::bad_alloc; forkSnapshot()
+     * turns that into a failed child.
+     * @param lock_shards Read-lock each shard while it is serialized.
+     */
+    template <typename Write>
+    bool serializeSnapshot(bool lock_shards, SnapshotHeader& header, Write&& write) {
+        constexpr size_t kFlushThreshold = 1 << 20;
+        std::string buffer;
+        buffer.reserve(kFlushThreshold * 2);
+
+        header = SnapshotHeader{};
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.block_count = static_cast<uint32_t>(shard_count);
+
+        std::vector<SnapshotBlockIndex> index(shard_count);
+        SnapshotChecksum checksum;
+        uint64_t offset = sizeof(header);
+        auto flush = [&] {
+            checksum.update(buffer.data(), buffer.size());
+            offset += buffer.size();
+            const bool written = write(buffer.data(), buffer.size());
+            buffer.clear();
+            return written;
+        };
+
+        bool ok = true;
+        for (size_t i = 0; i < shard_count && ok; ++i) {
+            std::shared_lock lock(shards[i].mutex, std::defer_lock);
+            if (lock_shards) lock.lock();
+
+            SnapshotBlockIndex& block = index[i];
+            block.offset = offset;
+            block.key_count = shards[i].data().size();
+            for (const Record* record : shards[i].data()) {
+                appendRecord(buffer, *record);
+                ok = buffer.size() < kFlushThreshold || flush();
+                if (!ok) break;
+            }
+            ok = ok && flush();
+            block.length = offset - block.offset;
+            block.checksum = checksum.finish();
+            header.key_count += block.key_count;
+        }
+        if (!ok) return false;
+
+        const size_t index_size = index.size() * sizeof(SnapshotBlockIndex);
+        header.index_offset = offset;
+        checksum.update(reinterpret_cast<const char*>(index.data()), index_size);
+        header.index_checksum = checksum.finish();
+        return write(reinterpret_cast<const char*>(index.data()), index_size);
+    }
+
+    /**
+     * @brief Writes a complete snapshot to fd from offset 0; the header goes in last, once it is known.
+     */
+    bool writeSnapshot(int fd, bool lock_shards) {
+        SnapshotHeader header;
+        return lseek(fd, sizeof(header), SEEK_SET) != -1 &&
+               serializeSnapshot(lock_shards, header, [fd](const char* data, size_t size) {
+                   return writeAll(fd, data, size);
+               }) &&
+               pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    }
+
+    /**
+     * @brief Serializes all shards to path via a temporary file and rename.
+     *
+     * Writes one block per shard, then the block index, then the header at
+     * offset 0. Uses raw write(), not stdio, so it can run in a forked
+     * child; it can still throw std::bad_alloc (see forkSnapshot()).
+     * @param path Destination file.
+     * @param lock_shards Read-lock each shard while it is serialized.
+     */
+    bool writeSnapshotFile(const std::string& path, bool lock_shards) {
+        const std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) return false;
+
+        bool ok = writeSnapshot(fd, lock_shards) && fsync(fd) == 0;
+        ok = (::close(fd) == 0) && ok;
+        ok = ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+        if (!ok) ::unlink(tmp.c_str());
+        return ok;
+    }
+
+    /**
+     * @brief Sends a snapshot over a socket as RESP bulk strings; see backgroundStreamTo().
+     */
+    bool streamSnapshot(int fd) {
+        auto sendAll = [fd](const char* data, size_t size) {
+            while (size > 0) {
+                const ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+                if (sent == -1) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                data += sent;
+                size -= static_cast<size_t>(sent);
+            }
+            return true;
+        };
+        auto chunk = [&](const char* data, size_t size) {
+            char head[32];
+            const int length = std::snprintf(head, sizeof(head), "$%zu\r\n", size);
+            return sendAll(head, static_cast<size_t>(length)) && sendAll(data, size) && sendAll("\r\n", 2);
+        };
+
+        SnapshotHeader header;
+        return serializeSnapshot(false, header, [&](const char* data, size_t size) {
+                   return size == 0 || chunk(data, size);
+               }) &&
+               chunk("", 0) && chunk(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    /**
+     * @brief Forks, runs write_in_child in the child and waits for it; shared by the background snapshots.
+     *
+     * All shards are read-locked only for the duration of fork(); at_cut
+     * runs at that point, after the locks and before the fork. An exception
+     * thrown by write_in_child, such as std::bad_alloc, exits the child
+     * with a failure status, reported here like any other failure.
+     * @throws std::system_error if fork() fails.
+     * @throws std::runtime_error if the child fails.
+     */
+    template <typename ChildWrite>
+    void forkSnapshot(ChildWrite&& write_in_child, const std::function<void()>& at_cut) {
+        std::lock_guard guard(snapshot_mutex);
+        SnapshotScope scope(snapshot_counters);
+
+        pid_t pid;
+        {
+            std::vector<std::shared_lock<Shard>> locks;
+            locks.reserve(shard_count);
+            for (size_t i = 0; i < shard_count; ++i) {
+                locks.emplace_back(shards[i]);
+            }
+
+            if (at_cut) at_cut();
+            const auto fork_start = std::chrono::steady_clock::now();
+            pid = fork();
+            if (pid == 0) {
+                // Child: the only thread left; nothing mutates the image, so no locks.
+                // An exception must not reach std::terminate here; it fails the child.
+                bool ok = false;
+                try {
+                    ok = write_in_child();
+                } catch (...) {
+                }
+                _exit(ok ? 0 : 1);
+            }
+            snapshot_counters.last_fork_ns.store(
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - fork_start).count()),
+                std::memory_order_relaxed);
+        }
+
+        if (pid == -1) {
+            throw std::system_error(errno, std::system_category(), "fork");
+        }
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) == -1) {
+            if (errno != EINTR) throw std::system_error(errno, std::system_category(), "waitpid");
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            throw std::runtime_error("Background snapshot failed");
         }
+        scope.succeeded();
     }
 };
 
-#endif // KV_STORE_H
\ No newline at end of file
+#endif // KV_STORE_H
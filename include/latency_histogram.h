@@ -0,0 +1,120 @@
+/**
+ * @file latency_histogram.h
+ * @brief Fixed-precision latency histogram in the style of HdrHistogram.
+ */
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#define HISTOGRAM_SUB_BUCKET_BITS 8
+
+/**
+ * @class LatencyHistogram
+ * @brief Records values with 0.4% relative precision in constant time and memory.
+ *
+ * Values are bucketed log-linearly: values below 2^8 are exact, and each
+ * further power of two is split into 256 equal sub-buckets, so every value
+ * maps to a bucket whose width is at most 1/256 of the value. Recording
+ * is a count-leading-zeros and an increment; percentiles walk the 14 K
+ * buckets. Histograms merge by adding counts, so each thread can record
+ * into its own and the totals are combined once at the end.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBits = HISTOGRAM_SUB_BUCKET_BITS;
+    static constexpr uint64_t kSubCount = uint64_t{1} << kSubBits;
+    static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSubCount;
+
+    LatencyHistogram() : counts_(kBuckets, 0) {}
+
+    void record(uint64_t value, uint64_t count = 1) noexcept {
+        counts_[indexOf(value)] += count;
+        total_ += count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram& other) noexcept {
+        for (size_t i = 0; i < kBuckets; ++i) counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset() noexcept {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_ = 0;
+        min_ = UINT64_MAX;
+        max_ = 0;
+    }
+
+    uint64_t count() const noexcept { return total_; }
+    uint64_t min() const noexcept { return total_ ? min_ : 0; }
+    uint64_t max() const noexcept { return max_; }
+
+    /**
+     * @brief Value at or below which the given fraction of recorded values fall.
+     * @param percentile 0 to 100, e.g. 99.9.
+     * @return The highest value equivalent to that bucket, capped at max(); 0 if empty.
+     */
+    uint64_t percentile(double percentile) const noexcept {
+        if (total_ == 0) return 0;
+        const double clamped = std::clamp(percentile, 0.0, 100.0);
+        uint64_t rank = static_cast<uint64_t>(clamped / 100.0 * static_cast<double>(total_) + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, total_);
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(highestIn(i), max_);
+        }
+        return max_;
+    }
+
+    double mean() const noexcept {
+        if (total_ == 0) return 0;
+        double sum = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            if (counts_[i] == 0) continue;
+            const double midpoint = (static_cast<double>(lowestIn(i)) + static_cast<double>(highestIn(i))) / 2;
+            sum += static_cast<double>(counts_[i]) * midpoint;
+        }
+        return sum / static_cast<double>(total_);
+    }
+
+    /**
+     * @brief Bucket a value is counted in.
+     *
+     * Group 0 holds [0, 256) exactly; group g >= 1 splits [2^(g+7), 2^(g+8)) into 256 buckets.
+     */
+    static constexpr size_t indexOf(uint64_t value) noexcept {
+        if (value < kSubCount) return static_cast<size_t>(value);
+        const unsigned top = 63 - static_cast<unsigned>(__builtin_clzll(value));
+        const unsigned group = top - kSubBits + 1;
+        const uint64_t sub = (value >> (top - kSubBits)) - kSubCount;
+        return static_cast<size_t>(group * kSubCount + sub);
+    }
+
+    static constexpr uint64_t lowestIn(size_t index) noexcept {
+        const size_t group = index / kSubCount;
+        if (group == 0) return index;
+        return (kSubCount + index % kSubCount) << (group - 1);
+    }
+
+    static constexpr uint64_t highestIn(size_t index) noexcept {
+        const size_t group = index / kSubCount;
+        if (group == 0) return index;
+        return lowestIn(index) + ((uint64_t{1} << (group - 1)) - 1);
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+#endif // LATENCY_HISTOGRAM_H
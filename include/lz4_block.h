@@ -0,0 +1,166 @@
+/**
+ * @file lz4_block.h
+ * @brief Self-contained LZ4 block format compressor and decompressor.
+ */
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_LAST_LITERALS 5  ///< A block always ends in at least this many literals.
+#define LZ4_MATCH_LIMIT 12   ///< The last match starts at least this far from the end.
+
+/**
+ * @class Lz4
+ * @brief Single-pass LZ4 over one buffer, output readable by the reference liblz4 (LZ4_decompress_safe).
+ *
+ * The compressor is the greedy fast mode: a 4096-entry table of the last
+ * position each 4-byte sequence hashed to, with matches extended both
+ * ways and the search stepping faster through incompressible stretches.
+ * The decompressor validates every length and offset against both
+ * buffers, so corrupt input fails instead of reading or writing out of
+ * bounds.
+ */
+class Lz4 {
+public:
+    /**
+     * @brief Worst-case compressed size of size bytes.
+     */
+    static size_t compressBound(size_t size) noexcept { return size + size / 255 + 16; }
+
+    /**
+     * @return Bytes written to dst, or 0 if they would not fit in capacity.
+     */
+    static size_t compress(const char* src, size_t size, char* dst, size_t capacity) noexcept {
+        const auto* in = reinterpret_cast<const uint8_t*>(src);
+        auto* out = reinterpret_cast<uint8_t*>(dst);
+        uint8_t* const out_end = out + capacity;
+        size_t anchor = 0;
+
+        if (size > LZ4_MATCH_LIMIT) {
+            uint32_t table[1 << LZ4_HASH_BITS] = {};
+            const size_t match_limit = size - LZ4_MATCH_LIMIT;
+            size_t pos = 0;
+            while (pos < match_limit) {
+                const uint32_t sequence = load32(in + pos);
+                const uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+                const size_t candidate = table[hash];
+                table[hash] = static_cast<uint32_t>(pos);
+                if (candidate >= pos || pos - candidate > LZ4_MAX_OFFSET || load32(in + candidate) != sequence) {
+                    pos += 1 + ((pos - anchor) >> 6);
+                    continue;
+                }
+
+                size_t start = pos, ref = candidate;
+                while (start > anchor && ref > 0 && in[start - 1] == in[ref - 1]) {
+                    --start;
+                    --ref;
+                }
+                size_t end = pos + LZ4_MIN_MATCH;
+                while (end < size - LZ4_LAST_LITERALS && in[end] == in[candidate + (end - pos)]) ++end;
+
+                if (!emit(out, out_end, in + anchor, start - anchor, pos - candidate, end - start)) return 0;
+                anchor = pos = end;
+            }
+        }
+        if (!emit(out, out_end, in + anchor, size - anchor, 0, 0)) return 0;
+        return static_cast<size_t>(out - reinterpret_cast<uint8_t*>(dst));
+    }
+
+    /**
+     * @param size Compressed bytes at src.
+     * @param out_size Exact decompressed size; dst must hold that many bytes.
+     * @return False if src is not a valid block that decompresses to exactly out_size bytes.
+     */
+    static bool decompress(const char* src, size_t size, char* dst, size_t out_size) noexcept {
+        const auto* in = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* const in_end = in + size;
+        auto* out = reinterpret_cast<uint8_t*>(dst);
+        uint8_t* const out_begin = out;
+        uint8_t* const out_end = out + out_size;
+
+        while (in < in_end) {
+            const uint8_t token = *in++;
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(in, in_end, literals)) return false;
+            if (literals > static_cast<size_t>(in_end - in) || literals > static_cast<size_t>(out_end - out)) {
+                return false;
+            }
+            std::memcpy(out, in, literals);
+            in += literals;
+            out += literals;
+            if (in == in_end) break;
+
+            if (in_end - in < 2) return false;
+            const size_t offset = in[0] | (size_t{in[1]} << 8);
+            in += 2;
+            if (offset == 0 || offset > static_cast<size_t>(out - out_begin)) return false;
+            size_t length = token & 15;
+            if (length == 15 && !readLength(in, in_end, length)) return false;
+            length += LZ4_MIN_MATCH;
+            if (length > static_cast<size_t>(out_end - out)) return false;
+
+            const uint8_t* match = out - offset;
+            if (offset >= length) {
+                std::memcpy(out, match, length);
+                out += length;
+            } else {
+                // Overlapping copy repeats the last offset bytes, e.g. a run of one byte.
+                for (size_t i = 0; i < length; ++i) *out++ = *match++;
+            }
+        }
+        return out == out_end;
+    }
+
+private:
+    static uint32_t load32(const uint8_t* p) noexcept {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static bool readLength(const uint8_t*& in, const uint8_t* in_end, size_t& length) noexcept {
+        uint8_t byte;
+        do {
+            if (in == in_end) return false;
+            byte = *in++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    static void writeLength(uint8_t*& out, size_t length) noexcept {
+        for (; length >= 255; length -= 255) *out++ = 255;
+        *out++ = static_cast<uint8_t>(length);
+    }
+
+    /**
+     * @brief Writes one sequence: literals, then a match unless length is 0 (the final sequence).
+     */
+    static bool emit(uint8_t*& out, uint8_t* out_end, const uint8_t* literals, size_t literal_count, size_t offset,
+                     size_t length) noexcept {
+        const size_t needed = 1 + literal_count / 255 + 1 + literal_count + 2 + length / 255 + 1;
+        if (needed > static_cast<size_t>(out_end - out)) return false;
+
+        uint8_t& token = *out++;
+        token = static_cast<uint8_t>((literal_count < 15 ? literal_count : 15) << 4);
+        if (literal_count >= 15) writeLength(out, literal_count - 15);
+        std::memcpy(out, literals, literal_count);
+        out += literal_count;
+        if (length == 0) return true;
+
+        *out++ = static_cast<uint8_t>(offset);
+        *out++ = static_cast<uint8_t>(offset >> 8);
+        const size_t extra = length - LZ4_MIN_MATCH;
+        token |= static_cast<uint8_t>(extra < 15 ? extra : 15);
+        if (extra >= 15) writeLength(out, extra - 15);
+        return true;
+    }
+};
+
+#endif // LZ4_BLOCK_H
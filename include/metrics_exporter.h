@@ -0,0 +1,195 @@
+/**
+ * @file metrics_exporter.h
+ * @brief Serves the INFO report in the Prometheus text format over HTTP.
+ */
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include "server_stats.h"
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define METRICS_PREFIX "blinkdb_"
+#define METRICS_MAX_REQUEST 8192
+
+/**
+ * @class MetricsExporter
+ * @brief Answers GET /metrics on its own port and thread, away from the Workers.
+ *
+ * Every scrape renders INFO all and converts it line by line, the way
+ * redis_exporter does: numeric "field:value" becomes blinkdb_field, and
+ * "name_id:key=value,..." becomes blinkdb_name_key{id="id"} for each pair,
+ * so cmdstat_get:calls=5 is exported as blinkdb_cmdstat_calls{id="get"} 5.
+ * Non-numeric values are left out. Requests are served one at a time.
+ */
+class MetricsExporter {
+public:
+    /**
+     * @throws std::system_error if the port cannot be bound.
+     */
+    MetricsExporter(uint16_t port, const ServerInfo& info) : info_(info) {
+        fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ == -1) throw std::system_error(errno, std::system_category(), "socket");
+
+        int opt = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+        if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 || listen(fd_, 16) == -1) {
+            const int err = errno;
+            close(fd_);
+            throw std::system_error(err, std::system_category(), "metrics bind");
+        }
+    }
+
+    ~MetricsExporter() {
+        stop();
+        close(fd_);
+    }
+
+    void start() {
+        if (running_) return;
+        running_ = true;
+        thread_ = std::thread(&MetricsExporter::serve, this);
+    }
+
+    void stop() {
+        if (!running_) return;
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+    }
+
+    /**
+     * @brief Converts an INFO report to Prometheus text exposition lines.
+     */
+    static std::string toPrometheus(std::string_view info) {
+        std::string out;
+        size_t pos = 0;
+        while (pos < info.size()) {
+            size_t end = info.find('\n', pos);
+            if (end == std::string_view::npos) end = info.size();
+            std::string_view line = info.substr(pos, end - pos);
+            pos = end + 1;
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (line.empty() || line[0] == '#') continue;
+
+            const size_t colon = line.find(':');
+            if (colon == std::string_view::npos) continue;
+            const std::string_view name = line.substr(0, colon);
+            const std::string_view value = line.substr(colon + 1);
+
+            if (value.find('=') == std::string_view::npos) {
+                if (numeric(value)) appendSample(out, name, {}, value);
+                continue;
+            }
+
+            const size_t split = name.rfind('_');
+            const std::string_view prefix = split == std::string_view::npos ? name : name.substr(0, split);
+            const std::string_view id = split == std::string_view::npos ? std::string_view() : name.substr(split + 1);
+            size_t field = 0;
+            while (field < value.size()) {
+                size_t next = value.find(',', field);
+                if (next == std::string_view::npos) next = value.size();
+                const std::string_view pair = value.substr(field, next - field);
+                field = next + 1;
+
+                const size_t eq = pair.find('=');
+                if (eq == std::string_view::npos || !numeric(pair.substr(eq + 1))) continue;
+                appendSample(out, std::string(prefix) + "_" + std::string(pair.substr(0, eq)), id, pair.substr(eq + 1));
+            }
+        }
+        return out;
+    }
+
+private:
+    const ServerInfo& info_;
+    int fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    static bool numeric(std::string_view text) {
+        if (text.empty()) return false;
+        const std::string copy(text);
+        char* end = nullptr;
+        std::strtod(copy.c_str(), &end);
+        return end == copy.c_str() + copy.size();
+    }
+
+    static void appendSample(std::string& out, std::string_view name, std::string_view id, std::string_view value) {
+        out += METRICS_PREFIX;
+        for (const char c : name) out += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+        if (!id.empty()) {
+            out += "{id=\"";
+            out.append(id);
+            out += "\"}";
+        }
+        out += ' ';
+        out.append(value);
+        out += '\n';
+    }
+
+    void serve() {
+        while (running_) {
+            pollfd pfd{fd_, POLLIN, 0};
+            // Wake up periodically so stop() does not wait for a scrape.
+            if (poll(&pfd, 1, 200) <= 0) continue;
+            const int client = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client == -1) continue;
+            respond(client);
+            close(client);
+        }
+    }
+
+    void respond(int client) {
+        timeval timeout{1, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < METRICS_MAX_REQUEST) {
+            const ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+            if (n <= 0) return;
+            request.append(buffer, static_cast<size_t>(n));
+        }
+
+        std::string body;
+        std::string status = "200 OK";
+        if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET /metrics?", 0) == 0) {
+            try {
+                body = toPrometheus(info_.render({"all"}));
+            } catch (const std::exception& e) {
+                status = "500 Internal Server Error";
+                body = std::string(e.what()) + "\n";
+            }
+        } else {
+            status = "404 Not Found";
+            body = "Not found; metrics are at /metrics\n";
+        }
+
+        const std::string response = "HTTP/1.1 " + status +
+                                     "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                     std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            const ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return;
+            sent += static_cast<size_t>(n);
+        }
+    }
+};
+
+#endif // METRICS_EXPORTER_H
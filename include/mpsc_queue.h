@@ -0,0 +1,86 @@
+/**
+ * @file mpsc_queue.h
+ * @brief Lock-free multi-producer single-consumer queue.
+ */
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include "free_list.h"
+#include <atomic>
+#include <utility>
+
+#define MPSC_NODE_CACHE 1024
+
+/**
+ * @class MpscQueue
+ * @brief Unbounded lock-free queue with many producers and one consumer.
+ *
+ * Dmitry Vyukov's node-based design: push() is a single atomic exchange
+ * plus a release store, pop() touches only consumer-owned state. Items
+ * are delivered in the order their pushes linearized. Nodes a consumer
+ * retires are cached for pushes from its own thread (see FreeList), so
+ * threads that post to each other stop allocating once warmed up.
+ * @tparam T Default-constructible, movable item type.
+ */
+template <typename T>
+class MpscQueue {
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value;
+    };
+
+    using NodePool = FreeList<Node, MPSC_NODE_CACHE>;
+
+    alignas(64) std::atomic<Node*> head_;  ///< Last pushed node; producers swap it.
+    alignas(64) Node* tail_;               ///< Stub whose successor is the next item.
+
+public:
+    MpscQueue() {
+        Node* stub = new Node();
+        head_.store(stub, std::memory_order_relaxed);
+        tail_ = stub;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    ~MpscQueue() {
+        T discarded;
+        while (pop(discarded)) {}
+        delete tail_;
+    }
+
+    /**
+     * @brief Appends an item. Safe to call from any thread.
+     */
+    void push(T value) {
+        Node* node = NodePool::take();
+        if (node == nullptr) {
+            node = new Node();
+        } else {
+            node->next.store(nullptr, std::memory_order_relaxed);
+        }
+        node->value = std::move(value);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief Removes the oldest item. Must only be called by the consumer thread.
+     * @return False if the queue is empty (or a push is still linking its node).
+     */
+    bool pop(T& out) {
+        Node* next = tail_->next.load(std::memory_order_acquire);
+        if (next == nullptr) return false;
+
+        out = std::move(next->value);
+        // Clearing lets whatever the moved-from value still holds go now, not on reuse.
+        next->value = T();
+        NodePool::give(tail_);
+        tail_ = next;
+        return true;
+    }
+};
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,91 @@
+/**
+ * @file mutation_codec.h
+ * @brief RESP encoding of KVStore mutations, shared by the AOF and replication.
+ */
+#ifndef MUTATION_CODEC_H
+#define MUTATION_CODEC_H
+
+#include "kv_store.h"
+#include "resp_parser.h"
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/**
+ * @class MutationCodec
+ * @brief Writes MutationLog callbacks as commands and applies them back to a store.
+ *
+ * A mutation is one of SET key value, SETLZ4 key compressed, DEL key,
+ * PEXPIREAT key ms or PERSIST key, so the encoded stream is ordinary RESP
+ * that any client parser reads. SETLZ4 carries a value exactly as the
+ * store keeps it compressed (ValueEncoding::Lz4) and is only understood
+ * by apply().
+ */
+class MutationCodec {
+public:
+    static void appendSet(std::string& out, std::string_view key, std::string_view value, ValueEncoding encoding) {
+        out += encoding == ValueEncoding::Lz4 ? "*3\r\n$6\r\nSETLZ4\r\n" : "*3\r\n$3\r\nSET\r\n";
+        appendBulk(out, key);
+        appendBulk(out, value);
+    }
+
+    static void appendDel(std::string& out, std::string_view key) {
+        out += "*2\r\n$3\r\nDEL\r\n";
+        appendBulk(out, key);
+    }
+
+    /**
+     * @param expire_at Unix time in milliseconds, or 0 to remove the expiry (PERSIST).
+     */
+    static void appendExpire(std::string& out, std::string_view key, int64_t expire_at) {
+        if (expire_at == 0) {
+            out += "*2\r\n$7\r\nPERSIST\r\n";
+            appendBulk(out, key);
+            return;
+        }
+        out += "*3\r\n$9\r\nPEXPIREAT\r\n";
+        appendBulk(out, key);
+        appendBulk(out, std::to_string(expire_at));
+    }
+
+    /**
+     * @brief Applies one encoded mutation to store.
+     * @return False if command is not a mutation this codec writes, or carries a corrupt value.
+     */
+    static bool apply(KVStore& store, const RESPCommand& command) {
+        if (command.name() == "SET" && command.size() == 3) {
+            store.set(command[1], command[2]);
+        } else if (command.name() == "SETLZ4" && command.size() == 3) {
+            try {
+                store.setEncoded(command[1], command[2], ValueEncoding::Lz4);
+            } catch (const std::invalid_argument&) {
+                return false;
+            }
+        } else if (command.name() == "DEL" && command.size() == 2) {
+            store.del(command[1]);
+        } else if (command.name() == "PEXPIREAT" && command.size() == 3) {
+            int64_t expire_at = 0;
+            const std::string_view when = command[2];
+            if (std::from_chars(when.data(), when.data() + when.size(), expire_at).ec != std::errc()) return false;
+            store.expireAt(command[1], expire_at);
+        } else if (command.name() == "PERSIST" && command.size() == 2) {
+            store.persist(command[1]);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static void appendBulk(std::string& out, std::string_view bytes) {
+        out += '$';
+        out += std::to_string(bytes.size());
+        out += "\r\n";
+        out.append(bytes.data(), bytes.size());
+        out += "\r\n";
+    }
+};
+
+#endif // MUTATION_CODEC_H
@@ -3,8 +3,30 @@
 
 #include "kv_store.h"
 #include "resp_parser.h"
+#include "byte_buffer.h"
+#include "command_table.h"
+#include "server_stats.h"
+#include "cluster.h"
+#include "glob_pattern.h"
+#include "hot_keys.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <memory>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <limits>
+#include <cmath>
 
+#define OOM_ERROR "OOM command not allowed when used memory > 'maxmemory'"
+#define ZERO_COPY_MIN_VALUE (16 * 1024)
+#define LATENCY_SAMPLE_INTERVAL 16
+#define SCAN_DEFAULT_COUNT 10
+#define READONLY_ERROR "READONLY You can't write against a read only replica."
+#define AOF_WRITE_ERROR "MISCONF Errors writing to the AOF file"
 
 /**
  * @class RedisProtocolHandler
@@ -18,6 +40,29 @@ public:
      */
     explicit RedisProtocolHandler(KVStore& store) : store_(store) {}
 
+    /**
+     * @brief Sets the report INFO replies with; without one INFO is an error.
+     * @param info Must outlive the handler; its sections are rendered on the worker running INFO.
+     */
+    void set_info(const ServerInfo* info) noexcept { info_ = info; }
+
+    /**
+     * @brief Refuses commands that mutate the store, as a replica must.
+     */
+    void set_read_only(bool read_only) noexcept { read_only_ = read_only; }
+
+    /**
+     * @brief Enables cluster mode: keyed commands for slots served elsewhere are redirected.
+     * @param cluster Must outlive the handler; nullptr serves every key.
+     */
+    void set_cluster(Cluster* cluster) noexcept { cluster_ = cluster; }
+
+    /**
+     * @brief Gives every thread a HotKeyCache of this many entries for the keys its GETs find hot.
+     * @param entries Per thread, rounded up to a power of two; 0 disables caching. Call before serving.
+     */
+    void set_hot_key_cache(size_t entries) noexcept { hot_cache_entries_ = entries; }
+
     /**
      * @brief Processes a raw RESP request string and generates a response.
      * @param request The RESP-encoded command string.
@@ -25,49 +70,805 @@ public:
      */
     std::string handle_request(const std::string& request) {
         size_t pos = 0;
-        try {
-            auto resp_value = RESPParser::parse(request, pos);
-            return process_command(resp_value);
-        } catch (const std::exception& e) {
-            return RESPParser::createErrorResponse("ERR " + std::string(e.what()));
+        RESPCommand command;
+        switch (RESPParser::parseCommand(request, pos, command)) {
+            case RESPParser::ParseStatus::Complete: {
+                ByteBuffer output;
+                process_command(command, output);
+                return std::string(output.view());
+            }
+            case RESPParser::ParseStatus::Incomplete:
+                return RESPParser::createErrorResponse("ERR incomplete request");
+            default:
+                return RESPParser::createErrorResponse("ERR " + std::string(command.error()));
         }
     }
 
-private:
-    std::string process_command(const std::shared_ptr<RESPValue>& command) {
-        if (command->type != RESPValue::Type::Array || command->arrayValue.empty()) {
-            return RESPParser::createErrorResponse("ERR invalid command");
+    /**
+     * @brief Processes every complete RESP request in a pipelined buffer.
+     *
+     * The replies are sent only after store_.syncLog() returns. Under the
+     * always fsync policy a log write or fsync that fails ends the process,
+     * as in Redis, so no client is ever told a write succeeded that the log
+     * lost. Under the other policies replies never waited for the disk;
+     * while the log is failing, write commands are refused with
+     * log_write_error() and reads are served as usual.
+     * @param input Buffered bytes received from a client.
+     * @param output Buffer the responses are appended to, in request order.
+     * @return Number of input bytes consumed; a trailing partial request is left in place.
+     */
+    size_t handle_requests(std::string_view input, ByteBuffer& output) {
+        // One handler serves every worker thread; each keeps its own scratch command.
+        static thread_local RESPCommand command;
+        size_t pos = 0;
+        bool complete = true;
+        while (complete && pos < input.size()) {
+            switch (RESPParser::parseCommand(input, pos, command)) {
+                case RESPParser::ParseStatus::Complete:
+                    process_command(command, output);
+                    break;
+                case RESPParser::ParseStatus::Incomplete:
+                    complete = false;
+                    break;
+                case RESPParser::ParseStatus::Invalid:
+                    // A malformed frame leaves no reliable boundary to resume from.
+                    output.append(RESPParser::createErrorResponse("ERR " + std::string(command.error())));
+                    pos = input.size();
+                    break;
+            }
+        }
+        store_.syncLog();
+        return pos;
+    }
+
+    /**
+     * @brief RESP error for a write refused because the log is failing to persist writes.
+     */
+    std::string log_write_error() const {
+        const int error = store_.logWriteError();
+        return RESPParser::createErrorResponse(
+            error == 0 ? std::string(AOF_WRITE_ERROR) : std::string(AOF_WRITE_ERROR ": ") + std::strerror(error));
+    }
+
+    /**
+     * @brief Request handler entry point for AsyncServer (see RequestHandler).
+     * @param conn Worker connection; requests are read from conn.input, replies go to conn.output.
+     * @return Number of input bytes consumed.
+     */
+    template <typename Connection>
+    size_t handle(Connection& conn) {
+        return handle_requests(conn.input.view(), conn.output);
+    }
+
+    /**
+     * @brief Finds the key that decides which partition a command touches.
+     * @param command Parsed command.
+     * @param key Receives the routing key.
+     * @return False for commands that touch no key, or more than one.
+     */
+    static bool routing_key(const RESPCommand& command, std::string_view& key) {
+        if (command.empty()) return false;
+        const CommandSpec* spec = commands_.find(command.name());
+        if (spec == nullptr || spec->first_key == 0 || command.size() <= static_cast<size_t>(spec->first_key)) {
+            return false;
         }
+        // Multi-key commands lock their shards directly and run wherever they arrive.
+        const size_t last = spec->last_key < 0 ? command.size() - 1 : static_cast<size_t>(spec->last_key);
+        if ((last - spec->first_key) / spec->key_step != 0) return false;
+        key = command[spec->first_key];
+        return true;
+    }
+
+    /**
+     * @brief True if the command names keys, whether one or several.
+     */
+    static bool has_keys(const RESPCommand& command) {
+        if (command.empty()) return false;
+        const CommandSpec* spec = commands_.find(command.name());
+        return spec != nullptr && spec->first_key != 0 && command.size() > static_cast<size_t>(spec->first_key);
+    }
 
-        const auto& cmd = command->arrayValue[0];
-        if (cmd->type != RESPValue::Type::BulkString && cmd->type != RESPValue::Type::SimpleString) {
-            return RESPParser::createErrorResponse("ERR invalid command");
+    /**
+     * @brief Executes one parsed command and appends its response.
+     *
+     * The name, in any letter case, is looked up in a perfect-hash table
+     * (see CommandTable), so dispatch costs the same for every command.
+     * Every call is counted in the calling thread's CommandStats; the first
+     * and then one in LATENCY_SAMPLE_INTERVAL calls of each command are
+     * also timed, which keeps clock reads off most commands while the
+     * percentiles stay representative.
+     * @param command Parsed command.
+     * @param output Buffer the RESP response is appended to.
+     */
+    void process_command(const RESPCommand& command, ByteBuffer& output) {
+        if (command.empty()) {
+            output.append(RESPParser::createErrorResponse("ERR invalid command"));
+            return;
         }
 
-        const std::string& command_str = cmd->strValue;
+        CommandStats& stats = stats_.local();
+        const CommandSpec* spec = commands_.find(command.name());
+        if (spec == nullptr) {
+            stats.unknown.add();
+            output.append(RESPParser::createErrorResponse("ERR unknown command"));
+            return;
+        }
 
-        if (command_str == "GET" && command->arrayValue.size() == 2) {
-            auto key = command->arrayValue[1]->strValue;
-            auto value = store_.get(key);
-            return value ? RESPParser::createRESPResponse(*value) 
-                        : RESPParser::createMissingResponse();
+        CommandCounters& counters = stats.commands[static_cast<size_t>(spec - commands_.entries().data())];
+        if (spec->arity > 0 ? command.size() != static_cast<size_t>(spec->arity)
+                            : command.size() < static_cast<size_t>(-spec->arity)) {
+            counters.rejected.add();
+            wrong_arity(*spec, output);
+            return;
         }
-        else if (command_str == "SET" && command->arrayValue.size() == 3) {
-            auto key = command->arrayValue[1]->strValue;
-            auto value = command->arrayValue[2]->strValue;
-            store_.set(key, value);
-            return RESPParser::createOKResponse();
+        if (spec->write && read_only_) {
+            counters.rejected.add();
+            output.append(RESPParser::createErrorResponse(READONLY_ERROR));
+            return;
+        }
+        if (spec->write && store_.logWriteError() != 0) {
+            counters.rejected.add();
+            output.append(log_write_error());
+            return;
+        }
+        if (cluster_ && spec->first_key != 0 && redirect(*spec, command, output)) return;
+
+        counters.calls.add();
+        if (++counters.since_sample < LATENCY_SAMPLE_INTERVAL) {
+            (this->*spec->run)(command, output);
+            return;
+        }
+        counters.since_sample = 0;
+        const auto start = std::chrono::steady_clock::now();
+        (this->*spec->run)(command, output);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        const uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        counters.sampled.add();
+        counters.sampled_ns.add(ns);
+        counters.latency.record(ns);
+    }
+
+    /**
+     * @brief Commands executed so far by every thread, excluding rejected ones.
+     */
+    uint64_t total_commands() const {
+        uint64_t total = 0;
+        stats_.forEach([&](const CommandStats& stats) {
+            for (const CommandCounters& counters : stats.commands) total += counters.calls.load();
+        });
+        return total;
+    }
+
+    /**
+     * @brief Calls of unknown commands plus calls rejected for their argument count or on a replica.
+     */
+    uint64_t rejected_commands() const {
+        uint64_t total = 0;
+        stats_.forEach([&](const CommandStats& stats) {
+            total += stats.unknown.load();
+            for (const CommandCounters& counters : stats.commands) total += counters.rejected.load();
+        });
+        return total;
+    }
+
+    /**
+     * @brief Appends one cmdstat_<name> line per command that was called, as in Redis.
+     *
+     * usec is estimated as calls times the mean of the sampled calls.
+     */
+    void write_command_stats(std::string& out) const {
+        for (size_t i = 0; i < kCommandCount; ++i) {
+            uint64_t calls = 0, rejected = 0, sampled = 0, sampled_ns = 0;
+            stats_.forEach([&](const CommandStats& stats) {
+                calls += stats.commands[i].calls.load();
+                rejected += stats.commands[i].rejected.load();
+                sampled += stats.commands[i].sampled.load();
+                sampled_ns += stats.commands[i].sampled_ns.load();
+            });
+            if (calls == 0 && rejected == 0) continue;
+
+            const double usec_per_call = sampled ? static_cast<double>(sampled_ns) / static_cast<double>(sampled) / 1e3 : 0;
+            char line[160];
+            std::snprintf(line, sizeof(line), "calls=%llu,usec=%llu,usec_per_call=%.2f,rejected_calls=%llu",
+                          static_cast<unsigned long long>(calls),
+                          static_cast<unsigned long long>(usec_per_call * static_cast<double>(calls)), usec_per_call,
+                          static_cast<unsigned long long>(rejected));
+            ServerInfo::field(out, "cmdstat_" + lower_name(commands_.entries()[i]), line);
         }
-        else if (command_str == "DEL" && command->arrayValue.size() == 2) {
-            auto key = command->arrayValue[1]->strValue;
-            bool deleted = store_.del(key);
-            return RESPParser::createDELResponse(deleted);
+    }
+
+    /**
+     * @brief Appends one latency_percentiles_usec_<name> line per sampled command, as in Redis.
+     */
+    void write_latency_stats(std::string& out) const {
+        LatencyHistogram histogram;
+        for (size_t i = 0; i < kCommandCount; ++i) {
+            histogram.reset();
+            stats_.forEach([&](const CommandStats& stats) { stats.commands[i].latency.addTo(histogram); });
+            if (histogram.count() == 0) continue;
+
+            char line[160];
+            std::snprintf(line, sizeof(line), "p50=%.3f,p99=%.3f,p99.9=%.3f",
+                          static_cast<double>(histogram.percentile(50)) / 1e3,
+                          static_cast<double>(histogram.percentile(99)) / 1e3,
+                          static_cast<double>(histogram.percentile(99.9)) / 1e3);
+            ServerInfo::field(out, "latency_percentiles_usec_" + lower_name(commands_.entries()[i]), line);
         }
+    }
+
+    /**
+     * @brief Appends the hot-key cache counters and the hottest keys across threads, hottest first.
+     *
+     * A key tracked by several threads is listed once with their estimates
+     * summed; reads scales the sampled estimate back to all reads.
+     */
+    void write_hot_key_stats(std::string& out) const {
+        uint64_t hits = 0, fills = 0, stale = 0;
+        std::vector<HotKeyTracker::Top> top;
+        hot_keys_.forEach([&](const HotKeys& hot) {
+            hits += hot.cache.hits.load();
+            fills += hot.cache.fills.load();
+            stale += hot.cache.stale.load();
+            hot.tracker.topKeys(top);
+        });
+        ServerInfo::field(out, "hotkey_cache_entries", uint64_t{hot_cache_entries_});
+        ServerInfo::field(out, "hotkey_cache_hits", hits);
+        ServerInfo::field(out, "hotkey_cache_fills", fills);
+        ServerInfo::field(out, "hotkey_cache_stale", stale);
 
-        return RESPParser::createErrorResponse("ERR unknown command");
+        std::sort(top.begin(), top.end(), [](const HotKeyTracker::Top& a, const HotKeyTracker::Top& b) {
+            return a.hash != b.hash ? a.hash < b.hash : a.key < b.key;
+        });
+        std::vector<HotKeyTracker::Top> merged;
+        for (HotKeyTracker::Top& entry : top) {
+            if (!merged.empty() && merged.back().hash == entry.hash && merged.back().key == entry.key) {
+                merged.back().estimate += entry.estimate;
+            } else {
+                merged.push_back(std::move(entry));
+            }
+        }
+        std::sort(merged.begin(), merged.end(), [](const HotKeyTracker::Top& a, const HotKeyTracker::Top& b) {
+            return a.estimate > b.estimate;
+        });
+        for (size_t i = 0; i < merged.size() && i < HOTKEY_TOP; ++i) {
+            std::string key = merged[i].key;
+            // Keep the line parseable as field:name=value,name=value.
+            for (char& c : key) {
+                if (c == ',' || c == '=' || !std::isprint(static_cast<unsigned char>(c))) c = '?';
+            }
+            ServerInfo::field(out, "hotkey_" + std::to_string(i),
+                              "key=" + key + ",reads=" +
+                              std::to_string(uint64_t{merged[i].estimate} * HOTKEY_SAMPLE_INTERVAL));
+        }
     }
 
+private:
+    /**
+     * @brief One command: arity and key positions as in Redis' COMMAND metadata, plus its handler.
+     */
+    struct CommandSpec {
+        std::string_view name;  ///< Upper case.
+        int arity;              ///< Argument count including the name; -n means at least n.
+        int first_key;          ///< Position of the first key; 0 if the command takes none.
+        int last_key;           ///< Position of the last key; -1 means the last argument.
+        int key_step;           ///< Distance between consecutive keys.
+        bool write;             ///< Mutates the store; refused by set_read_only().
+        void (RedisProtocolHandler::*run)(const RESPCommand& command, ByteBuffer& output);
+    };
+
+    static constexpr size_t kCommandCount = 18;
+    static const CommandTable<CommandSpec, kCommandCount> commands_;
+
+    struct CommandCounters {
+        StatCounter calls;
+        StatCounter rejected;    ///< Wrong number of arguments, or a write on a read-only replica.
+        StatCounter sampled;     ///< Calls that were timed.
+        StatCounter sampled_ns;  ///< Total time of the timed calls.
+        LatencyRecorder latency;
+        uint32_t since_sample = LATENCY_SAMPLE_INTERVAL - 1;  ///< Owner only: calls since the last timed one.
+    };
+
+    /**
+     * @brief One thread's view of which keys its GETs keep hitting, and its copies of their values.
+     */
+    struct HotKeys {
+        HotKeyTracker tracker;
+        HotKeyCache cache;
+    };
+
+    /**
+     * @brief One thread's counters, indexed like commands_.entries().
+     */
+    struct CommandStats {
+        CommandCounters commands[kCommandCount];
+        StatCounter unknown;
+    };
+
     KVStore& store_;
+    const ServerInfo* info_ = nullptr;
+    bool read_only_ = false;
+    Cluster* cluster_ = nullptr;
+    PerThread<CommandStats> stats_;
+    size_t hot_cache_entries_ = 0;
+    PerThread<HotKeys> hot_keys_;
+
+    static std::string lower_name(const CommandSpec& spec) {
+        std::string name;
+        for (const char c : spec.name) name += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return name;
+    }
+
+    static void wrong_arity(const CommandSpec& spec, ByteBuffer& output) {
+        output.append(RESPParser::createErrorResponse("ERR wrong number of arguments for '" + lower_name(spec) +
+                                                      "' command"));
+    }
+
+    /**
+     * @brief INFO [section ...]: the report from set_info() as a bulk string.
+     */
+    void info_command(const RESPCommand& command, ByteBuffer& output) {
+        if (info_ == nullptr) {
+            output.append(RESPParser::createErrorResponse("ERR INFO is not available"));
+            return;
+        }
+        std::vector<std::string_view> sections(command.argv() + 1, command.argv() + command.size());
+        RESPParser::appendBulkString(output, info_->render(sections));
+    }
+
+    /**
+     * @brief Replies with a redirect unless this node serves the command's keys, as Redis Cluster does.
+     *
+     * All keys must share a slot (CROSSSLOT otherwise). For a slot that is
+     * migrating away, the command runs here if all its keys are still here,
+     * is sent to the target with ASK if none are, and gets TRYAGAIN if only
+     * some are.
+     * @return True if a redirect or error was appended instead of running the command.
+     */
+    bool redirect(const CommandSpec& spec, const RESPCommand& command, ByteBuffer& output) {
+        const size_t last = spec.last_key < 0 ? command.size() - 1 : static_cast<size_t>(spec.last_key);
+        const uint16_t slot = Cluster::keySlot(command[spec.first_key]);
+        for (size_t i = spec.first_key + spec.key_step; i <= last; i += spec.key_step) {
+            if (Cluster::keySlot(command[i]) != slot) {
+                output.append(RESPParser::createErrorResponse("CROSSSLOT Keys in request don't hash to the same slot"));
+                return true;
+            }
+        }
+
+        std::string address;
+        switch (cluster_->route(slot, address)) {
+            case Cluster::Route::Serve:
+                return false;
+            case Cluster::Route::Moved:
+                output.append(RESPParser::createErrorResponse("MOVED " + std::to_string(slot) + " " + address));
+                return true;
+            case Cluster::Route::Down:
+                output.append(RESPParser::createErrorResponse("CLUSTERDOWN Hash slot not served"));
+                return true;
+            case Cluster::Route::Ask:
+                break;
+        }
+
+        size_t present = 0, keys = 0;
+        for (size_t i = spec.first_key; i <= last; i += spec.key_step, ++keys) {
+            present += store_.ttlMs(command[i]) != -2;
+        }
+        if (present == keys) return false;
+        output.append(RESPParser::createErrorResponse(
+            present == 0 ? "ASK " + std::to_string(slot) + " " + address
+                         : std::string("TRYAGAIN Multiple keys request during rehashing of slot")));
+        return true;
+    }
+
+    /**
+     * @brief CLUSTER KEYSLOT | COUNTKEYSINSLOT | SLOTS | NODES | INFO | MYID | SETSLOT | MIGRATE.
+     *
+     * MIGRATE slot host:port is specific to blinkdb: it starts Cluster::migrate().
+     */
+    void cluster_command(const RESPCommand& command, ByteBuffer& output) {
+        const std::string_view sub = command[1];
+        if (equals_ignore_case(sub, "KEYSLOT") && command.size() == 3) {
+            output.append(RESPParser::createIntegerResponse(Cluster::keySlot(command[2])));
+            return;
+        }
+        if (cluster_ == nullptr) {
+            output.append(RESPParser::createErrorResponse("ERR This instance has cluster support disabled"));
+            return;
+        }
+
+        long long slot = -1;
+        const bool has_slot = command.size() >= 3 && parse_integer(command[2], slot) && slot >= 0 && slot < CLUSTER_SLOTS;
+        try {
+            if (equals_ignore_case(sub, "SLOTS") && command.size() == 2) {
+                const std::vector<Cluster::SlotRange> ranges = cluster_->slotRanges();
+                RESPParser::appendArrayHeader(output, ranges.size());
+                for (const Cluster::SlotRange& range : ranges) {
+                    RESPParser::appendArrayHeader(output, 3);
+                    output.append(RESPParser::createIntegerResponse(range.first));
+                    output.append(RESPParser::createIntegerResponse(range.last));
+                    RESPParser::appendArrayHeader(output, 2);
+                    RESPParser::appendBulkString(output, range.host);
+                    output.append(RESPParser::createIntegerResponse(range.port));
+                }
+            } else if (equals_ignore_case(sub, "NODES") && command.size() == 2) {
+                RESPParser::appendBulkString(output, cluster_->nodesText());
+            } else if (equals_ignore_case(sub, "INFO") && command.size() == 2) {
+                RESPParser::appendBulkString(output, cluster_->infoText());
+            } else if (equals_ignore_case(sub, "MYID") && command.size() == 2) {
+                RESPParser::appendBulkString(output, cluster_->myId());
+            } else if (equals_ignore_case(sub, "COUNTKEYSINSLOT") && command.size() == 3 && has_slot) {
+                output.append(RESPParser::createIntegerResponse(
+                    static_cast<long long>(cluster_->countKeysInSlot(static_cast<uint16_t>(slot)))));
+            } else if (equals_ignore_case(sub, "SETSLOT") && has_slot && (command.size() == 4 || command.size() == 5)) {
+                cluster_->setSlot(static_cast<uint16_t>(slot), command[3], command.size() == 5 ? command[4] : "");
+                output.append(RESPParser::createOKResponse());
+            } else if (equals_ignore_case(sub, "MIGRATE") && has_slot && command.size() == 4) {
+                cluster_->migrate(static_cast<uint16_t>(slot), command[3]);
+                output.append(RESPParser::createOKResponse());
+            } else {
+                output.append(RESPParser::createErrorResponse("ERR unknown subcommand or wrong number of arguments for 'cluster' command"));
+            }
+        } catch (const std::invalid_argument& e) {
+            output.append(RESPParser::createErrorResponse(std::string("ERR ") + e.what()));
+        }
+    }
+
+    /**
+     * @brief GET, sampling the key for hot-key detection and serving hot keys from the thread's cache.
+     *
+     * A sampled read of a key the tracker rates hot that is not cached is
+     * done under the shard lock instead of optimistically, so its copy can
+     * be tagged with the shard version it was read at. Filling only on
+     * sampled reads keeps hot values too large to cache mostly lock-free.
+     */
+    void get_command(const RESPCommand& command, ByteBuffer& output) {
+        const std::string_view key = command[1];
+        HotKeys& hot = hot_keys_.local();
+        const bool sampled = hot.tracker.sampleDue();
+        const bool caching = hot_cache_entries_ != 0;
+        const uint64_t hash = sampled || caching ? StringHash{}(key) : 0;
+        if (sampled) hot.tracker.record(key, hash);
+        if (caching) {
+            if (hot.cache.configured() != hot_cache_entries_) hot.cache.resize(hot_cache_entries_);
+            if (const std::string* value = hot.cache.find(key, hash, store_)) {
+                RESPParser::appendBulkString(output, *value);
+                return;
+            }
+        }
+        const bool fill = caching && sampled && hot.tracker.hot(hash);
+
+        // Most GETs never lock; values worth pinning take the locked path below.
+        size_t staged = 0;
+        const ReadStatus status = fill ? ReadStatus::Fallback : store_.readOptimistic(key, [&](std::string_view value) {
+            if (output.splicing() && value.size() >= ZERO_COPY_MIN_VALUE) return false;
+            staged = RESPParser::prepareBulkString(output, value);
+            return true;
+        });
+        if (status == ReadStatus::Hit) {
+            output.commit(staged);
+            return;
+        }
+        if (status == ReadStatus::Miss) {
+            output.append(RESPParser::createMissingResponse());
+            return;
+        }
+
+        const bool found = store_.readVersioned(key, [&](const Record& record, size_t shard, uint64_t version) {
+            // Large values are sent straight from the store; copying beats pinning below that.
+            if (output.splicing() && record.value().size() >= ZERO_COPY_MIN_VALUE && RecordArena::pinnable(record) &&
+                record.encoding() == ValueEncoding::Raw) {
+                RESPParser::appendBulkString(output, RecordArena::pin(record));
+                return;
+            }
+            const std::string_view value = KVStore::valueOf(record);
+            RESPParser::appendBulkString(output, value);
+            if (fill && value.size() <= HOTKEY_CACHE_MAX_VALUE) {
+                hot.cache.fill(key, hash, value, shard, version, record.expire_at);
+            }
+        });
+        if (!found) output.append(RESPParser::createMissingResponse());
+    }
+
+    /**
+     * @brief SET key value [EX seconds | PX milliseconds].
+     */
+    void set_command(const RESPCommand& command, ByteBuffer& output) {
+        if (command.size() == 5) {
+            set_with_expiry(command, output);
+        } else if (command.size() == 3) {
+            output.append(store_.set(command[1], command[2]) ? RESPParser::createOKResponse()
+                                                             : RESPParser::createErrorResponse(OOM_ERROR));
+        } else {
+            output.append(RESPParser::createErrorResponse("ERR syntax error"));
+        }
+    }
+
+    void expire_command(const RESPCommand& command, ByteBuffer& output) { expire(command, 1000, output); }
+    void pexpire_command(const RESPCommand& command, ByteBuffer& output) { expire(command, 1, output); }
+
+    void expire(const RESPCommand& command, long long unit_ms, ByteBuffer& output) {
+        long long amount;
+        int64_t expire_at;
+        if (!parse_integer(command[2], amount)) {
+            output.append(RESPParser::createErrorResponse("ERR value is not an integer or out of range"));
+        } else if (!expiry_from_now(amount, unit_ms, expire_at)) {
+            output.append(RESPParser::createErrorResponse("ERR invalid expire time in '" +
+                                                          std::string(command.name()) + "' command"));
+        } else {
+            output.append(RESPParser::createDELResponse(store_.expireAt(command[1], expire_at)));
+        }
+    }
+
+    void ttl_command(const RESPCommand& command, ByteBuffer& output) {
+        int64_t ttl = store_.ttlMs(command[1]);
+        if (ttl > 0) ttl = (ttl + 500) / 1000;
+        output.append(RESPParser::createIntegerResponse(ttl));
+    }
+
+    void pttl_command(const RESPCommand& command, ByteBuffer& output) {
+        output.append(RESPParser::createIntegerResponse(store_.ttlMs(command[1])));
+    }
+
+    void persist_command(const RESPCommand& command, ByteBuffer& output) {
+        output.append(RESPParser::createDELResponse(store_.persist(command[1])));
+    }
+
+    void incr_command(const RESPCommand& command, ByteBuffer& output) { incr_by(command[1], 1, output); }
+    void decr_command(const RESPCommand& command, ByteBuffer& output) { incr_by(command[1], -1, output); }
+
+    void incrby_command(const RESPCommand& command, ByteBuffer& output) {
+        long long delta;
+        if (!parse_integer(command[2], delta)) {
+            output.append(RESPParser::createErrorResponse("ERR value is not an integer or out of range"));
+            return;
+        }
+        incr_by(command[1], delta, output);
+    }
+
+    void decrby_command(const RESPCommand& command, ByteBuffer& output) {
+        long long delta;
+        if (!parse_integer(command[2], delta)) {
+            output.append(RESPParser::createErrorResponse("ERR value is not an integer or out of range"));
+        } else if (delta == std::numeric_limits<long long>::min()) {
+            output.append(RESPParser::createErrorResponse("ERR decrement would overflow"));
+        } else {
+            incr_by(command[1], -delta, output);
+        }
+    }
+
+    void incr_by(std::string_view key, int64_t delta, ByteBuffer& output) {
+        int64_t result = 0;
+        switch (store_.incrBy(key, delta, result)) {
+            case NumericStatus::Ok:
+                output.append(RESPParser::createIntegerResponse(result));
+                break;
+            case NumericStatus::NotNumber:
+                output.append(RESPParser::createErrorResponse("ERR value is not an integer or out of range"));
+                break;
+            case NumericStatus::Overflow:
+                output.append(RESPParser::createErrorResponse("ERR increment or decrement would overflow"));
+                break;
+            case NumericStatus::OutOfMemory:
+                output.append(RESPParser::createErrorResponse(OOM_ERROR));
+                break;
+        }
+    }
+
+    void incrbyfloat_command(const RESPCommand& command, ByteBuffer& output) {
+        long double delta;
+        if (!KVStore::parseLongDouble(command[2], delta) || std::isinf(delta)) {
+            output.append(RESPParser::createErrorResponse("ERR value is not a valid float"));
+            return;
+        }
+        std::string result;
+        switch (store_.incrByFloat(command[1], delta, result)) {
+            case NumericStatus::Ok:
+                RESPParser::appendBulkString(output, result);
+                break;
+            case NumericStatus::NotNumber:
+                output.append(RESPParser::createErrorResponse("ERR value is not a valid float"));
+                break;
+            case NumericStatus::Overflow:
+                output.append(RESPParser::createErrorResponse("ERR increment would produce NaN or Infinity"));
+                break;
+            case NumericStatus::OutOfMemory:
+                output.append(RESPParser::createErrorResponse(OOM_ERROR));
+                break;
+        }
+    }
+
+    void del_command(const RESPCommand& command, ByteBuffer& output) {
+        if (command.size() == 2) {
+            output.append(RESPParser::createDELResponse(store_.del(command[1])));
+            return;
+        }
+        const size_t deleted = store_.multiDel(command.argv() + 1, command.size() - 1);
+        output.append(RESPParser::createIntegerResponse(static_cast<long long>(deleted)));
+    }
+
+    void mset_command(const RESPCommand& command, ByteBuffer& output) {
+        if (command.size() % 2 == 0) {
+            wrong_arity(*commands_.find(command.name()), output);
+            return;
+        }
+        const bool stored = store_.multiSet(command.argv() + 1, (command.size() - 1) / 2);
+        output.append(stored ? RESPParser::createOKResponse() : RESPParser::createErrorResponse(OOM_ERROR));
+    }
+
+    /**
+     * @brief SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]; see KVStore::scan().
+     *
+     * COUNT bounds the entries examined, so a call costs the same however
+     * selective MATCH is and may return no keys with a non-zero cursor.
+     * Every value is a string, so TYPE either keeps every key or none.
+     */
+    void scan_command(const RESPCommand& command, ByteBuffer& output) {
+        static thread_local ByteBuffer scratch;
+
+        uint64_t cursor = 0;
+        const std::string_view cursor_text = command[1];
+        const auto [end, ec] = std::from_chars(cursor_text.data(), cursor_text.data() + cursor_text.size(), cursor);
+        if (cursor_text.empty() || ec != std::errc() || end != cursor_text.data() + cursor_text.size()) {
+            output.append(RESPParser::createErrorResponse("ERR invalid cursor"));
+            return;
+        }
+
+        std::string_view pattern = "*";
+        long long count = SCAN_DEFAULT_COUNT;
+        bool strings = true;
+        for (size_t i = 2; i < command.size(); i += 2) {
+            if (i + 1 == command.size()) {
+                output.append(RESPParser::createErrorResponse("ERR syntax error"));
+                return;
+            }
+            if (equals_ignore_case(command[i], "MATCH")) {
+                pattern = command[i + 1];
+            } else if (equals_ignore_case(command[i], "COUNT")) {
+                if (!parse_integer(command[i + 1], count)) {
+                    output.append(RESPParser::createErrorResponse("ERR value is not an integer or out of range"));
+                    return;
+                }
+                if (count < 1) {
+                    output.append(RESPParser::createErrorResponse("ERR syntax error"));
+                    return;
+                }
+            } else if (equals_ignore_case(command[i], "TYPE")) {
+                strings = equals_ignore_case(command[i + 1], "STRING");
+            } else {
+                output.append(RESPParser::createErrorResponse("ERR syntax error"));
+                return;
+            }
+        }
+
+        const bool match_all = pattern == "*";
+        size_t found = 0;
+        scratch.clear();
+        const uint64_t next = store_.scan(cursor, static_cast<size_t>(count), [&](std::string_view key) {
+            if (!strings || (!match_all && !GlobPattern::matches(pattern, key))) return;
+            RESPParser::appendBulkString(scratch, key);
+            ++found;
+        });
+
+        RESPParser::appendArrayHeader(output, 2);
+        char digits[24];
+        const auto digits_end = std::to_chars(digits, digits + sizeof(digits), next).ptr;
+        RESPParser::appendBulkString(output, std::string_view(digits, static_cast<size_t>(digits_end - digits)));
+        RESPParser::appendArrayHeader(output, found);
+        output.append(scratch.view());
+        scratch.clear();
+        scratch.releaseIfLarger(1 << 20);
+    }
+
+    static bool parse_integer(std::string_view text, long long& value) {
+        const char* end = text.data() + text.size();
+        auto [ptr, ec] = std::from_chars(text.data(), end, value);
+        return ec == std::errc() && ptr == end && !text.empty();
+    }
+
+    static bool equals_ignore_case(std::string_view text, std::string_view upper) {
+        if (text.size() != upper.size()) return false;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (std::toupper(static_cast<unsigned char>(text[i])) != upper[i]) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Converts a relative expiry to absolute Unix milliseconds.
+     * @param amount Relative time; may be negative, which yields a time in the past.
+     * @param unit_ms Milliseconds per unit of amount.
+     * @return False if the result does not fit.
+     */
+    static bool expiry_from_now(long long amount, long long unit_ms, int64_t& expire_at) {
+        const int64_t now = KVStore::nowMs();
+        constexpr int64_t kMax = std::numeric_limits<int64_t>::max();
+        if (amount > (kMax - now) / unit_ms || amount < -now / unit_ms) return false;
+        expire_at = now + amount * unit_ms;
+        // 0 means "no expiry" to the store; anything in the past deletes.
+        if (expire_at <= 0) expire_at = 1;
+        return true;
+    }
+
+    /**
+     * @brief SET key value EX seconds | PX milliseconds.
+     */
+    void set_with_expiry(const RESPCommand& command, ByteBuffer& output) {
+        const bool seconds = equals_ignore_case(command[3], "EX");
+        if (!seconds && !equals_ignore_case(command[3], "PX")) {
+            output.append(RESPParser::createErrorResponse("ERR syntax error"));
+            return;
+        }
+
+        long long amount;
+        int64_t expire_at;
+        if (!parse_integer(command[4], amount)) {
+            output.append(RESPParser::createErrorResponse("ERR value is not an integer or out of range"));
+        } else if (amount <= 0 || !expiry_from_now(amount, seconds ? 1000 : 1, expire_at)) {
+            output.append(RESPParser::createErrorResponse("ERR invalid expire time in 'set' command"));
+        } else {
+            output.append(store_.set(command[1], command[2], expire_at)
+                              ? RESPParser::createOKResponse()
+                              : RESPParser::createErrorResponse(OOM_ERROR));
+        }
+    }
+
+    /**
+     * @brief MGET: looks keys up grouped by shard, then replies in key order.
+     *
+     * Replies are encoded into a scratch buffer while the shard locks are
+     * held and copied out in request order afterwards, so no value is
+     * copied into a std::string.
+     */
+    void mget_command(const RESPCommand& command, ByteBuffer& output) {
+        struct Span {
+            size_t offset;
+            size_t length;
+        };
+        static thread_local ByteBuffer scratch;
+        static thread_local std::vector<Span> spans;
+
+        const size_t count = command.size() - 1;
+        scratch.clear();
+        spans.resize(count);
+        store_.multiGet(command.argv() + 1, count, [&](size_t i, const std::string_view* value) {
+            const size_t offset = scratch.size();
+            if (value) {
+                RESPParser::appendBulkString(scratch, *value);
+            } else {
+                scratch.append(RESPParser::createMissingResponse());
+            }
+            spans[i] = {offset, scratch.size() - offset};
+        });
+
+        RESPParser::appendArrayHeader(output, count);
+        const std::string_view replies = scratch.view();
+        for (const Span& span : spans) {
+            output.append(replies.substr(span.offset, span.length));
+        }
+        scratch.clear();
+        scratch.releaseIfLarger(1 << 20);
+    }
 };
 
+inline constexpr CommandTable<RedisProtocolHandler::CommandSpec, RedisProtocolHandler::kCommandCount>
+    RedisProtocolHandler::commands_{{{
+        {"GET", 2, 1, 1, 1, false, &RedisProtocolHandler::get_command},
+        {"SET", -3, 1, 1, 1, true, &RedisProtocolHandler::set_command},
+        {"DEL", -2, 1, -1, 1, true, &RedisProtocolHandler::del_command},
+        {"MGET", -2, 1, -1, 1, false, &RedisProtocolHandler::mget_command},
+        {"MSET", -3, 1, -1, 2, true, &RedisProtocolHandler::mset_command},
+        {"EXPIRE", 3, 1, 1, 1, true, &RedisProtocolHandler::expire_command},
+        {"PEXPIRE", 3, 1, 1, 1, true, &RedisProtocolHandler::pexpire_command},
+        {"TTL", 2, 1, 1, 1, false, &RedisProtocolHandler::ttl_command},
+        {"PTTL", 2, 1, 1, 1, false, &RedisProtocolHandler::pttl_command},
+        {"PERSIST", 2, 1, 1, 1, true, &RedisProtocolHandler::persist_command},
+        {"INCR", 2, 1, 1, 1, true, &RedisProtocolHandler::incr_command},
+        {"DECR", 2, 1, 1, 1, true, &RedisProtocolHandler::decr_command},
+        {"INCRBY", 3, 1, 1, 1, true, &RedisProtocolHandler::incrby_command},
+        {"DECRBY", 3, 1, 1, 1, true, &RedisProtocolHandler::decrby_command},
+        {"INCRBYFLOAT", 3, 1, 1, 1, true, &RedisProtocolHandler::incrbyfloat_command},
+        {"SCAN", -2, 0, 0, 1, false, &RedisProtocolHandler::scan_command},
+        {"INFO", -1, 0, 0, 1, false, &RedisProtocolHandler::info_command},
+        {"CLUSTER", -2, 0, 0, 1, false, &RedisProtocolHandler::cluster_command},
+    }}};
+
 #endif // REDIS_PROTOCOL_HANDLER_H
\ No newline at end of file
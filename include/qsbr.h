@@ -0,0 +1,183 @@
+/**
+ * @file qsbr.h
+ * @brief Quiescent-state-based reclamation for memory that threads read without locks.
+ */
+#ifndef QSBR_H
+#define QSBR_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#define QSBR_MAX_THREADS 256
+#define QSBR_BATCH_SIZE 64
+
+/**
+ * @class Qsbr
+ * @brief Defers frees until every lock-free reader has passed a quiescent state.
+ *
+ * Reader threads register once and then announce a quiescent state at a
+ * point where they hold no pointer into shared structures (the top of
+ * each event loop iteration), and go offline while blocked so an idle
+ * thread never holds up reclamation. That costs a few stores to a
+ * thread-private cache line and one fence per iteration, and nothing per read.
+ *
+ * A writer that unlinks memory a reader might still be traversing hands
+ * it to retire() instead of freeing it. Retired objects are batched per
+ * thread; a sealed batch is tagged with the global epoch it advanced and
+ * freed once every online reader has announced a later one. Any thread
+ * may retire; only registered threads may read without locks.
+ */
+class Qsbr {
+public:
+    using Deleter = void (*)(void* object);
+
+    /**
+     * @brief Makes the calling thread a lock-free reader, initially online.
+     * @return False if every slot is taken; the thread must then keep using locks.
+     */
+    static bool registerThread() {
+        ThreadState& state = local();
+        if (state.slot) return true;
+        for (size_t i = 0; i < QSBR_MAX_THREADS; ++i) {
+            bool expected = false;
+            if (!slots_[i].used.compare_exchange_strong(expected, true)) continue;
+
+            size_t limit = slot_limit_.load();
+            while (limit < i + 1 && !slot_limit_.compare_exchange_weak(limit, i + 1)) {}
+            state.slot = &slots_[i];
+            online();
+            return true;
+        }
+        return false;
+    }
+
+    static void unregisterThread() noexcept { local().unregisterThread(); }
+
+    static bool registered() noexcept { return local().slot != nullptr; }
+
+    /**
+     * @brief Declares that the calling reader holds no shared pointers, and frees what it can.
+     */
+    static void quiescent() {
+        ThreadState& state = local();
+        if (!state.slot) return;
+        if (!state.pending.empty()) seal(state);
+        state.slot->epoch.store(global_epoch_.load(std::memory_order_acquire), std::memory_order_release);
+        if (!state.sealed.empty()) reclaim(state);
+    }
+
+    /**
+     * @brief Stops the calling reader from holding up reclamation, e.g. while it blocks.
+     */
+    static void offline() noexcept {
+        ThreadState& state = local();
+        if (state.slot) state.slot->epoch.store(0, std::memory_order_release);
+    }
+
+    /**
+     * @brief Resumes lock-free reading after offline().
+     */
+    static void online() noexcept {
+        ThreadState& state = local();
+        if (!state.slot) return;
+        state.slot->epoch.store(global_epoch_.load(std::memory_order_acquire), std::memory_order_relaxed);
+        // The announcement must be visible before this thread loads any shared pointer.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief Frees object with deleter once no reader can still reach it.
+     */
+    static void retire(void* object, Deleter deleter) {
+        ThreadState& state = local();
+        state.pending.push_back({object, deleter});
+        // Readers seal on their next quiescent state; other threads have none, so seal now.
+        if (!state.slot || state.pending.size() >= QSBR_BATCH_SIZE) {
+            seal(state);
+            reclaim(state);
+        }
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};  ///< Last announced epoch; 0 while offline.
+        std::atomic<bool> used{false};
+    };
+
+    struct Retired {
+        void* object;
+        Deleter deleter;
+    };
+
+    struct Batch {
+        uint64_t epoch;
+        std::vector<Retired> objects;
+    };
+
+    struct ThreadState {
+        Slot* slot = nullptr;
+        std::vector<Retired> pending;
+        std::deque<Batch> sealed;
+
+        /**
+         * @brief Waits out the grace period of whatever the exiting thread retired.
+         */
+        ~ThreadState() {
+            unregisterThread();
+            if (!pending.empty()) seal(*this);
+            while (!sealed.empty()) {
+                reclaim(*this);
+                if (!sealed.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        void unregisterThread() noexcept {
+            if (!slot) return;
+            slot->epoch.store(0, std::memory_order_release);
+            slot->used.store(false, std::memory_order_release);
+            slot = nullptr;
+        }
+    };
+
+    static Slot slots_[QSBR_MAX_THREADS];
+    static inline std::atomic<size_t> slot_limit_{0};     ///< Slots [0, limit) have ever been used.
+    static inline std::atomic<uint64_t> global_epoch_{1};
+
+    static ThreadState& local() {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    static void seal(ThreadState& state) {
+        const uint64_t epoch = global_epoch_.fetch_add(1, std::memory_order_seq_cst);
+        state.sealed.push_back({epoch, std::move(state.pending)});
+        state.pending.clear();
+    }
+
+    /**
+     * @brief Frees every sealed batch all online readers have moved past.
+     */
+    static void reclaim(ThreadState& state) {
+        // Pairs with the fence in online(): either that reader is seen, or it sees the unlink.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t oldest = UINT64_MAX;
+        const size_t limit = slot_limit_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < limit; ++i) {
+            const uint64_t epoch = slots_[i].epoch.load(std::memory_order_acquire);
+            if (epoch != 0) oldest = std::min(oldest, epoch);
+        }
+        while (!state.sealed.empty() && state.sealed.front().epoch < oldest) {
+            for (const Retired& retired : state.sealed.front().objects) retired.deleter(retired.object);
+            state.sealed.pop_front();
+        }
+    }
+};
+
+inline Qsbr::Slot Qsbr::slots_[QSBR_MAX_THREADS];
+
+#endif // QSBR_H
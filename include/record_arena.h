@@ -0,0 +1,323 @@
+/**
+ * @file record_arena.h
+ * @brief Packed key/value records and the per-shard arena that allocates them.
+ */
+#ifndef RECORD_ARENA_H
+#define RECORD_ARENA_H
+
+#include "byte_buffer.h"
+#include "qsbr.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#define ARENA_SLAB_SIZE (256 * 1024)
+#define ARENA_SIZE_CLASS_STEP 8
+#define ARENA_MAX_SMALL_RECORD 1024
+
+/**
+ * @brief How a Record's value bytes are stored.
+ */
+enum class ValueEncoding : uint8_t {
+    Raw = 0,  ///< The value itself.
+    Lz4 = 1   ///< The value's size as a uint32_t, then the value as one LZ4 block (see lz4_block.h).
+};
+
+/**
+ * @struct Record
+ * @brief One key and its value in a single allocation: this header, the key bytes, the value bytes.
+ *
+ * The table stores only a pointer per key, so a small pair costs one
+ * 24-byte header plus its bytes rounded to the arena's 8-byte size
+ * classes, instead of two std::string objects and up to two heap blocks.
+ * Values stay under 2 GiB, so the top bit of value_size is free to mark an
+ * LZ4-encoded value, as in snapshots. It is kept out of the access word on
+ * purpose: lock-free readers update access, while value_size only changes
+ * under the shard's exclusive lock.
+ */
+struct Record {
+    static constexpr uint32_t kLz4Flag = 0x80000000u;
+
+    uint32_t key_size;
+    uint32_t value_size;  ///< Stored bytes, plus kLz4Flag for an Lz4 value; use value() and encoding().
+    int64_t expire_at;  ///< Unix time in milliseconds; 0 means the key never expires.
+    uint32_t access;    ///< LRU clock or LFU stamp+counter; accessed with __atomic builtins.
+    uint32_t capacity;  ///< Bytes allocated, header included.
+
+    char* bytes() noexcept { return reinterpret_cast<char*>(this + 1); }
+    const char* bytes() const noexcept { return reinterpret_cast<const char*>(this + 1); }
+
+    std::string_view key() const noexcept { return {bytes(), key_size}; }
+
+    /**
+     * @brief The stored value bytes; KVStore::valueOf() decodes them whatever the encoding.
+     */
+    std::string_view value() const noexcept { return {bytes() + key_size, storedSize(value_size)}; }
+
+    ValueEncoding encoding() const noexcept { return encodingOf(value_size); }
+
+    /**
+     * @brief Sets the number of stored bytes, keeping the encoding; writers only.
+     */
+    void setValueSize(size_t size) noexcept {
+        value_size = static_cast<uint32_t>(size) | (value_size & kLz4Flag);
+    }
+
+    /**
+     * @brief Changes the encoding, keeping the size; writers only.
+     */
+    void setEncoding(ValueEncoding value_encoding) noexcept {
+        value_size = storedSize(value_size) | (value_encoding == ValueEncoding::Lz4 ? kLz4Flag : 0);
+    }
+
+    /**
+     * @brief Size part of a value_size word, e.g. one a lock-free reader loaded atomically.
+     */
+    static uint32_t storedSize(uint32_t value_size) noexcept { return value_size & ~kLz4Flag; }
+
+    static ValueEncoding encodingOf(uint32_t value_size) noexcept {
+        return value_size & kLz4Flag ? ValueEncoding::Lz4 : ValueEncoding::Raw;
+    }
+
+    static size_t sizeFor(size_t key_size, size_t value_size) noexcept {
+        return sizeof(Record) + key_size + value_size;
+    }
+};
+static_assert(sizeof(Record) == 24, "record header must stay 24 bytes");
+
+/**
+ * @class RecordArena
+ * @brief Size-class allocator for Records, owned by one shard and used under its lock.
+ *
+ * Records up to ARENA_MAX_SMALL_RECORD bytes are carved from 256 KiB slabs
+ * in 8-byte classes and recycled through one free list per class, so
+ * steady-state churn neither calls malloc nor fragments its heap. Larger
+ * records, whose bytes dwarf any allocator overhead, come from operator
+ * new and are linked into a list so reset() can still free everything.
+ * Slabs are only returned to the system by reset() or destruction.
+ *
+ * Large records are also reference counted so pin() can hand their value
+ * to a response that outlives the shard lock. destroy() and reset() then
+ * only unlink a pinned record; the last PinnedBytes frees it.
+ *
+ * KVStore readers may also be reading a record without the lock, so memory
+ * only goes back to the system through Qsbr::retire(): reset() retires its
+ * slabs and a destroyed large record drops the arena's reference once
+ * readers are done. A small record's slot is reused immediately, but a slot
+ * never changes size class, so its capacity field stays valid and a stale
+ * reader can bound what it reads by it and stay inside the slab.
+ */
+class RecordArena {
+private:
+    static constexpr size_t kClasses = ARENA_MAX_SMALL_RECORD / ARENA_SIZE_CLASS_STEP;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct LargeBlock {
+        LargeBlock* prev;
+        LargeBlock* next;
+        std::atomic<uint32_t> refs;  ///< The arena's reference plus one per PinnedBytes.
+    };
+    static_assert(sizeof(LargeBlock) % alignof(Record) == 0, "records follow the block header");
+
+    std::vector<char*> slabs_;
+    char* cursor_ = nullptr;
+    char* limit_ = nullptr;
+    FreeNode* free_[kClasses] = {};
+    LargeBlock* large_ = nullptr;
+    size_t used_bytes_ = 0;
+    size_t large_bytes_ = 0;
+
+    void* allocateSmall(size_t capacity) {
+        FreeNode*& head = free_[capacity / ARENA_SIZE_CLASS_STEP - 1];
+        if (head) {
+            FreeNode* node = head;
+            head = node->next;
+            return node;
+        }
+        if (static_cast<size_t>(limit_ - cursor_) < capacity) {
+            // The tail of the old slab, under one record, is abandoned.
+            slabs_.push_back(static_cast<char*>(::operator new(ARENA_SLAB_SIZE)));
+            cursor_ = slabs_.back();
+            limit_ = cursor_ + ARENA_SLAB_SIZE;
+        }
+        void* memory = cursor_;
+        cursor_ += capacity;
+        return memory;
+    }
+
+    void* allocateLarge(size_t capacity) {
+        auto* block = new (::operator new(sizeof(LargeBlock) + capacity)) LargeBlock;
+        block->refs.store(1, std::memory_order_relaxed);
+        block->prev = nullptr;
+        block->next = large_;
+        if (large_) large_->prev = block;
+        large_ = block;
+        large_bytes_ += sizeof(LargeBlock) + capacity;
+        return block + 1;
+    }
+
+    void freeLarge(LargeBlock* block, bool deferred) {
+        if (block->prev) block->prev->next = block->next;
+        else large_ = block->next;
+        if (block->next) block->next->prev = block->prev;
+        if (deferred) Qsbr::retire(block, &RecordArena::unref);
+        else unref(block);
+    }
+
+    /**
+     * @brief Frees all memory; deferred leaves slabs and large records to readers still using them.
+     */
+    void release(bool deferred) {
+        while (large_) freeLarge(large_, deferred);
+        for (char* slab : slabs_) {
+            if (deferred) Qsbr::retire(slab, [](void* memory) { ::operator delete(memory); });
+            else ::operator delete(slab);
+        }
+        slabs_.clear();
+        cursor_ = limit_ = nullptr;
+        std::memset(free_, 0, sizeof(free_));
+        used_bytes_ = 0;
+        large_bytes_ = 0;
+    }
+
+    static void unref(void* owner) {
+        auto* block = static_cast<LargeBlock*>(owner);
+        if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            block->~LargeBlock();
+            ::operator delete(block);
+        }
+    }
+
+    static LargeBlock* blockOf(const Record& record) noexcept {
+        return const_cast<LargeBlock*>(reinterpret_cast<const LargeBlock*>(&record)) - 1;
+    }
+
+public:
+    RecordArena() = default;
+    RecordArena(const RecordArena&) = delete;
+    RecordArena& operator=(const RecordArena&) = delete;
+
+    RecordArena(RecordArena&& other) { *this = std::move(other); }
+
+    RecordArena& operator=(RecordArena&& other) {
+        if (this == &other) return *this;
+        reset();
+        slabs_ = std::move(other.slabs_);
+        other.slabs_.clear();
+        cursor_ = std::exchange(other.cursor_, nullptr);
+        limit_ = std::exchange(other.limit_, nullptr);
+        std::memcpy(free_, other.free_, sizeof(free_));
+        std::memset(other.free_, 0, sizeof(other.free_));
+        large_ = std::exchange(other.large_, nullptr);
+        used_bytes_ = std::exchange(other.used_bytes_, 0);
+        large_bytes_ = std::exchange(other.large_bytes_, 0);
+        return *this;
+    }
+
+    /**
+     * @brief Frees everything at once: an arena is only destroyed once readers are gone.
+     */
+    ~RecordArena() { release(false); }
+
+    /**
+     * @brief Bytes an allocation of size bytes actually occupies.
+     */
+    static size_t capacityFor(size_t size) noexcept {
+        if (size > ARENA_MAX_SMALL_RECORD) return size;
+        return (size + ARENA_SIZE_CLASS_STEP - 1) / ARENA_SIZE_CLASS_STEP * ARENA_SIZE_CLASS_STEP;
+    }
+
+    /**
+     * @brief Allocates a record and fills in its key and value; expiry and access start at 0.
+     */
+    Record* create(std::string_view key, std::string_view value) {
+        const size_t capacity = capacityFor(Record::sizeFor(key.size(), value.size()));
+        void* memory = capacity > ARENA_MAX_SMALL_RECORD ? allocateLarge(capacity) : allocateSmall(capacity);
+        used_bytes_ += capacity;
+
+        Record* record = static_cast<Record*>(memory);
+        record->key_size = static_cast<uint32_t>(key.size());
+        record->value_size = static_cast<uint32_t>(value.size());
+        record->expire_at = 0;
+        record->access = 0;
+        record->capacity = static_cast<uint32_t>(capacity);
+        std::memcpy(record->bytes(), key.data(), key.size());
+        std::memcpy(record->bytes() + key.size(), value.data(), value.size());
+        return record;
+    }
+
+    /**
+     * @brief Copies a record, possibly from another arena, keeping its encoding, expiry and access metadata.
+     */
+    Record* copy(const Record& source) {
+        Record* record = create(source.key(), source.value());
+        record->value_size = source.value_size;
+        record->expire_at = source.expire_at;
+        record->access = source.access;
+        return record;
+    }
+
+    void destroy(Record* record) {
+        const size_t capacity = record->capacity;
+        used_bytes_ -= capacity;
+        if (capacity > ARENA_MAX_SMALL_RECORD) {
+            large_bytes_ -= sizeof(LargeBlock) + capacity;
+            freeLarge(blockOf(*record), true);
+            return;
+        }
+        FreeNode*& head = free_[capacity / ARENA_SIZE_CLASS_STEP - 1];
+        FreeNode* node = reinterpret_cast<FreeNode*>(record);
+        node->next = head;
+        head = node;
+    }
+
+    /**
+     * @brief True if pin() can reference this record's value rather than copy it.
+     */
+    static bool pinnable(const Record& record) noexcept { return record.capacity > ARENA_MAX_SMALL_RECORD; }
+
+    /**
+     * @brief True while some PinnedBytes still references the record, which must then not change.
+     */
+    static bool pinned(const Record& record) noexcept {
+        return pinnable(record) && blockOf(record)->refs.load(std::memory_order_acquire) > 1;
+    }
+
+    /**
+     * @brief Keeps a large record's value readable after the caller drops the shard lock.
+     *
+     * Safe under a shared lock: the record cannot be destroyed meanwhile,
+     * and concurrent pins only touch the atomic count.
+     * @pre pinnable(record)
+     */
+    static PinnedBytes pin(const Record& record) noexcept {
+        LargeBlock* block = blockOf(record);
+        block->refs.fetch_add(1, std::memory_order_relaxed);
+        return PinnedBytes(record.value(), &RecordArena::unref, block);
+    }
+
+    /**
+     * @brief Frees every record this arena ever handed out, except ones still pinned or read.
+     */
+    void reset() { release(true); }
+
+    /**
+     * @brief Bytes held by live records, slack of their size class included.
+     */
+    size_t usedBytes() const noexcept { return used_bytes_; }
+
+    /**
+     * @brief Bytes reserved from the system: slabs plus large records.
+     */
+    size_t reservedBytes() const noexcept { return slabs_.size() * ARENA_SLAB_SIZE + large_bytes_; }
+};
+
+#endif // RECORD_ARENA_H
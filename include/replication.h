@@ -0,0 +1,649 @@
+/**
+ * @file replication.h
+ * @brief Asynchronous primary-to-replica replication: a mutation backlog on the primary, a tailing client on the replica.
+ */
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "blocking_socket.h"
+#include "kv_store.h"
+#include "mutation_codec.h"
+#include "resp_parser.h"
+#include "server_stats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define REPL_BACKLOG_SIZE (16 * 1024 * 1024)
+#define REPL_PING_INTERVAL_MS 1000
+#define REPL_TIMEOUT_MS 60000
+#define REPL_SEND_CHUNK (256 * 1024)
+#define REPL_RETRY_MS 1000
+#define REPL_MAX_HANDSHAKE 256
+
+/**
+ * @class ReplicationPrimary
+ * @brief Streams every mutation of the store to replicas that connect on a dedicated port.
+ *
+ * Installed as the store's MutationLog, it forwards each callback to the
+ * next log (the AOF, if any) and, once a replica has connected, also
+ * encodes it into a per-shard buffer like the AOF does, so the write path
+ * contends only within its shard. A feeder thread drains those buffers
+ * into the backlog, a ring of the most recent stream bytes addressed by
+ * absolute offset, and every replica has a sender thread that tails the
+ * ring from its own offset. Writers wake the feeder only when its buffers
+ * go from empty to non-empty, so under load one wake-up covers a batch.
+ *
+ * A replica opens with an inline "PSYNC <replid> <offset>" naming the
+ * stream it last applied. If the ring still holds that offset it gets
+ * "+CONTINUE" and the stream resumes; otherwise "+FULLRESYNC <replid>
+ * <offset>" followed by a forked snapshot (KVStore::backgroundStreamTo())
+ * cut at exactly that offset, then the stream. A replica that falls a
+ * whole ring behind is disconnected and resynchronizes in full. Replicas
+ * send no acknowledgements; the primary never waits for them.
+ */
+class ReplicationPrimary : public MutationLog {
+public:
+    /**
+     * @param store Store whose log this becomes; install it with KVStore::setMutationLog().
+     * @param next Log every mutation is also forwarded to, e.g. the AOF; may be nullptr.
+     * @param port Port replicas connect to.
+     * @param backlog_size Bytes of stream kept for replicas to resume from, and to lag by.
+     * @param slots Number of write buffers; use the store's shard count.
+     * @throws std::system_error if the port cannot be bound.
+     */
+    ReplicationPrimary(KVStore& store, MutationLog* next, uint16_t port, size_t backlog_size, size_t slots)
+        : store_(store), next_(next), capacity_(std::max<size_t>(backlog_size, REPL_SEND_CHUNK)),
+          slots_(std::make_unique<Slot[]>(std::max<size_t>(slots, 1))), slot_count_(std::max<size_t>(slots, 1)),
+          replid_(randomId()) {
+        fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ == -1) throw std::system_error(errno, std::system_category(), "socket");
+
+        int opt = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+        if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 || listen(fd_, 16) == -1) {
+            const int err = errno;
+            close(fd_);
+            throw std::system_error(err, std::system_category(), "replication bind");
+        }
+    }
+
+    ~ReplicationPrimary() override {
+        stop();
+        close(fd_);
+    }
+
+    void start() {
+        if (running_) return;
+        running_ = true;
+        feeder_ = std::thread(&ReplicationPrimary::feedLoop, this);
+        listener_ = std::thread(&ReplicationPrimary::listenLoop, this);
+    }
+
+    /**
+     * @brief Disconnects every replica and stops the threads.
+     */
+    void stop() {
+        if (!running_) return;
+        running_ = false;
+        {
+            std::lock_guard guard(wake_mutex_);
+        }
+        wake_cv_.notify_one();
+        {
+            std::lock_guard guard(backlog_mutex_);
+            stopping_ = true;
+        }
+        backlog_cv_.notify_all();
+        if (listener_.joinable()) listener_.join();
+        if (feeder_.joinable()) feeder_.join();
+
+        std::lock_guard guard(sessions_mutex_);
+        for (auto& session : sessions_) ::shutdown(session->fd, SHUT_RDWR);
+        for (auto& session : sessions_) finish(*session);
+        sessions_.clear();
+    }
+
+    void logSet(size_t shard, std::string_view key, std::string_view value, ValueEncoding encoding) override {
+        if (next_) next_->logSet(shard, key, value, encoding);
+        append(shard, [&](std::string& out) { MutationCodec::appendSet(out, key, value, encoding); });
+    }
+
+    void logDel(size_t shard, std::string_view key) override {
+        if (next_) next_->logDel(shard, key);
+        append(shard, [&](std::string& out) { MutationCodec::appendDel(out, key); });
+    }
+
+    void logExpire(size_t shard, std::string_view key, int64_t expire_at) override {
+        if (next_) next_->logExpire(shard, key, expire_at);
+        append(shard, [&](std::string& out) { MutationCodec::appendExpire(out, key, expire_at); });
+    }
+
+    void sync() override {
+        if (next_) next_->sync();
+    }
+
+    int writeError() const override { return next_ ? next_->writeError() : 0; }
+
+    /**
+     * @brief Appends the Replication section of INFO in the Redis layout.
+     */
+    void writeInfo(std::string& out) {
+        std::lock_guard sessions_guard(sessions_mutex_);
+        std::lock_guard guard(backlog_mutex_);
+        size_t online = 0;
+        for (const auto& session : sessions_) online += session->online.load();
+
+        ServerInfo::field(out, "role", "master");
+        ServerInfo::field(out, "connected_slaves", static_cast<uint64_t>(online));
+        size_t index = 0;
+        for (const auto& session : sessions_) {
+            if (!session->online.load()) continue;
+            const uint64_t offset = session->offset.load();
+            ServerInfo::field(out, "slave" + std::to_string(index++),
+                              "ip=" + session->address + ",state=online,offset=" + std::to_string(offset) +
+                              ",lag_bytes=" + std::to_string(end_ - std::min(end_, offset)));
+        }
+        ServerInfo::field(out, "master_replid", replid_);
+        ServerInfo::field(out, "master_repl_offset", end_);
+        ServerInfo::field(out, "sync_full", full_syncs_);
+        ServerInfo::field(out, "sync_partial_ok", partial_syncs_);
+        ServerInfo::field(out, "repl_backlog_active", uint64_t{active_.load()});
+        ServerInfo::field(out, "repl_backlog_size", static_cast<uint64_t>(capacity_));
+        ServerInfo::field(out, "repl_backlog_first_byte_offset", firstOffsetLocked());
+        ServerInfo::field(out, "repl_backlog_histlen", end_ - firstOffsetLocked());
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::mutex mutex;
+        std::string pending;
+    };
+
+    /**
+     * @brief One connected replica and the thread serving it.
+     */
+    struct Session {
+        int fd = -1;
+        std::string address;
+        std::atomic<uint64_t> offset{0};  ///< Stream sent so far.
+        std::atomic<bool> online{false};  ///< Past the handshake and any full resync.
+        std::atomic<bool> done{false};
+        std::thread thread;
+    };
+
+    KVStore& store_;
+    MutationLog* next_;
+    const size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    size_t slot_count_;
+    const std::string replid_;
+    int fd_ = -1;
+
+    std::atomic<bool> active_{false};  ///< Mutations are encoded once the first replica has connected.
+    std::atomic<bool> dirty_{false};   ///< Some slot has data the feeder has not collected.
+    std::atomic<bool> running_{false};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::thread feeder_;
+    std::thread listener_;
+
+    std::mutex backlog_mutex_;  ///< Guards the ring, offsets and counters below.
+    std::condition_variable backlog_cv_;
+    std::vector<char> ring_;
+    uint64_t start_ = 0;  ///< Offset at which the ring was activated.
+    uint64_t end_ = 0;    ///< Offset one past the newest byte.
+    uint64_t full_syncs_ = 0;
+    uint64_t partial_syncs_ = 0;
+    bool stopping_ = false;
+    std::string batch_;
+
+    std::mutex sessions_mutex_;
+    std::vector<std::unique_ptr<Session>> sessions_;
+
+    static std::string randomId() {
+        static constexpr char kHex[] = "0123456789abcdef";
+        std::random_device device;
+        std::string id(40, '0');
+        for (char& c : id) c = kHex[device() % 16];
+        return id;
+    }
+
+    template <typename Encode>
+    void append(size_t shard, Encode&& encode) {
+        // Turned on under every shard lock (see fullResync()), so this is stable while ours is held.
+        if (!active_.load(std::memory_order_relaxed)) return;
+        {
+            Slot& slot = slots_[shard % slot_count_];
+            std::lock_guard guard(slot.mutex);
+            encode(slot.pending);
+        }
+        if (!dirty_.load(std::memory_order_relaxed) && !dirty_.exchange(true)) {
+            {
+                std::lock_guard guard(wake_mutex_);
+            }
+            wake_cv_.notify_one();
+        }
+    }
+
+    uint64_t firstOffsetLocked() const {
+        return std::max(start_, end_ - std::min<uint64_t>(end_, capacity_));
+    }
+
+    void writeRingLocked(std::string_view data) {
+        if (data.size() > capacity_) {
+            end_ += data.size() - capacity_;
+            data.remove_prefix(data.size() - capacity_);
+        }
+        const size_t at = static_cast<size_t>(end_ % capacity_);
+        const size_t first = std::min(data.size(), capacity_ - at);
+        std::memcpy(ring_.data() + at, data.data(), first);
+        std::memcpy(ring_.data(), data.data() + first, data.size() - first);
+        end_ += data.size();
+    }
+
+    /**
+     * @brief Moves every slot's data into the ring. Needs backlog_mutex_.
+     * @return False if there was nothing to move.
+     */
+    bool collectLocked() {
+        for (size_t i = 0; i < slot_count_; ++i) {
+            std::lock_guard guard(slots_[i].mutex);
+            if (slots_[i].pending.empty()) continue;
+            if (batch_.empty()) {
+                batch_.swap(slots_[i].pending);
+            } else {
+                batch_ += slots_[i].pending;
+                slots_[i].pending.clear();
+            }
+        }
+        if (batch_.empty()) return false;
+        writeRingLocked(batch_);
+        batch_.clear();
+        return true;
+    }
+
+    void feedLoop() {
+        std::unique_lock lock(wake_mutex_);
+        while (running_) {
+            const bool woken = wake_cv_.wait_for(lock, std::chrono::milliseconds(REPL_PING_INTERVAL_MS),
+                                                 [this] { return !running_ || dirty_.load(); });
+            dirty_.store(false);
+            lock.unlock();
+            {
+                std::lock_guard guard(backlog_mutex_);
+                bool fed = collectLocked();
+                // An idle stream carries a PING so replicas can tell a quiet primary from a dead one.
+                if (!fed && !woken && active_.load()) {
+                    writeRingLocked("*1\r\n$4\r\nPING\r\n");
+                    fed = true;
+                }
+                if (fed) backlog_cv_.notify_all();
+            }
+            lock.lock();
+        }
+    }
+
+    void listenLoop() {
+        while (running_) {
+            pollfd pfd{fd_, POLLIN, 0};
+            // Wake up periodically so stop() does not wait for a replica.
+            if (poll(&pfd, 1, 200) > 0) {
+                sockaddr_in addr{};
+                socklen_t length = sizeof(addr);
+                const int client = accept4(fd_, reinterpret_cast<sockaddr*>(&addr), &length, SOCK_CLOEXEC);
+                if (client != -1) {
+                    char text[INET_ADDRSTRLEN] = "?";
+                    inet_ntop(AF_INET, &addr.sin_addr, text, sizeof(text));
+                    auto session = std::make_unique<Session>();
+                    session->fd = client;
+                    session->address = text;
+                    Session* raw = session.get();
+                    std::lock_guard guard(sessions_mutex_);
+                    sessions_.push_back(std::move(session));
+                    raw->thread = std::thread(&ReplicationPrimary::serve, this, raw);
+                }
+            }
+
+            std::lock_guard guard(sessions_mutex_);
+            for (auto it = sessions_.begin(); it != sessions_.end();) {
+                if (!(*it)->done.load()) {
+                    ++it;
+                    continue;
+                }
+                finish(**it);
+                it = sessions_.erase(it);
+            }
+        }
+    }
+
+    static void finish(Session& session) {
+        if (session.thread.joinable()) session.thread.join();
+        ::close(session.fd);
+    }
+
+    static bool readHandshake(int fd, std::string& line) {
+        char buffer[REPL_MAX_HANDSHAKE];
+        while (line.find("\r\n") == std::string::npos) {
+            if (line.size() >= REPL_MAX_HANDSHAKE) return false;
+            const ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) return false;
+            line.append(buffer, static_cast<size_t>(n));
+        }
+        line.resize(line.find("\r\n"));
+        return true;
+    }
+
+    void serve(Session* session) {
+        try {
+            BlockingSocket::setTimeouts(session->fd, REPL_TIMEOUT_MS);
+            std::string line;
+            uint64_t offset = 0;
+            if (readHandshake(session->fd, line) && handshake(*session, line, offset)) {
+                session->offset = offset;
+                session->online = true;
+                stream(*session, offset);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Replication: replica " << session->address << ": " << e.what() << std::endl;
+        }
+        session->online = false;
+        session->done = true;
+    }
+
+    /**
+     * @brief Answers PSYNC with +CONTINUE or a full resync.
+     * @param offset Receives the stream offset to send the replica from.
+     * @return False if the replica is to be dropped.
+     */
+    bool handshake(Session& session, std::string_view line, uint64_t& offset) {
+        const size_t first = line.find(' ');
+        const size_t second = first == std::string_view::npos ? first : line.find(' ', first + 1);
+        if (line.substr(0, first) != "PSYNC" || second == std::string_view::npos) {
+            BlockingSocket::sendAll(session.fd, "-ERR expected PSYNC <replid> <offset>\r\n");
+            return false;
+        }
+        const std::string_view id = line.substr(first + 1, second - first - 1);
+        const bool known = BlockingSocket::parseUnsigned(line.substr(second + 1), offset);
+        {
+            std::lock_guard guard(backlog_mutex_);
+            if (known && active_.load() && id == replid_ && offset >= firstOffsetLocked() && offset <= end_) {
+                ++partial_syncs_;
+                return BlockingSocket::sendAll(session.fd, "+CONTINUE\r\n");
+            }
+        }
+        return fullResync(session, offset);
+    }
+
+    bool fullResync(Session& session, uint64_t& offset) {
+        bool sent = false;
+        // Runs with every shard locked: no mutation is half logged, so the
+        // snapshot holds exactly the stream before this offset.
+        auto cut = [&] {
+            std::lock_guard guard(backlog_mutex_);
+            if (!active_.load()) {
+                ring_.resize(capacity_);
+                start_ = end_;
+                active_ = true;
+            }
+            collectLocked();
+            offset = end_;
+            ++full_syncs_;
+            sent = BlockingSocket::sendAll(session.fd, "+FULLRESYNC " + replid_ + " " + std::to_string(offset) + "\r\n");
+        };
+        store_.backgroundStreamTo(session.fd, cut);
+        return sent;
+    }
+
+    void stream(Session& session, uint64_t offset) {
+        std::string chunk;
+        while (true) {
+            {
+                std::unique_lock lock(backlog_mutex_);
+                backlog_cv_.wait(lock, [&] { return stopping_ || end_ > offset; });
+                if (stopping_) return;
+                if (offset < firstOffsetLocked()) {
+                    std::cerr << "Replication: replica " << session.address
+                              << " fell behind the backlog; disconnecting" << std::endl;
+                    return;
+                }
+                const size_t size = static_cast<size_t>(std::min<uint64_t>(end_ - offset, REPL_SEND_CHUNK));
+                const size_t at = static_cast<size_t>(offset % capacity_);
+                const size_t first = std::min(size, capacity_ - at);
+                chunk.assign(ring_.data() + at, first);
+                chunk.append(ring_.data(), size - first);
+            }
+            if (!BlockingSocket::sendAll(session.fd, chunk)) return;
+            offset += chunk.size();
+            session.offset = offset;
+        }
+    }
+};
+
+/**
+ * @class ReplicaClient
+ * @brief Keeps a store in sync with a ReplicationPrimary, reconnecting whenever the link drops.
+ *
+ * Runs on its own thread: it sends PSYNC with the stream it has applied
+ * so far, loads the snapshot of a full resync into the store and then
+ * applies the mutation stream as it arrives. While the snapshot loads,
+ * clients see a partially filled store. The RedisProtocolHandler serving
+ * clients should be set_read_only() so only the stream changes the store.
+ */
+class ReplicaClient {
+public:
+    ReplicaClient(KVStore& store, std::string host, uint16_t port)
+        : store_(store), host_(std::move(host)), port_(port) {}
+
+    ~ReplicaClient() { stop(); }
+
+    void start() {
+        if (running_) return;
+        running_ = true;
+        thread_ = std::thread(&ReplicaClient::run, this);
+    }
+
+    void stop() {
+        if (!running_) return;
+        running_ = false;
+        {
+            std::lock_guard guard(fd_mutex_);
+            if (fd_ != -1) ::shutdown(fd_, SHUT_RDWR);
+        }
+        if (thread_.joinable()) thread_.join();
+    }
+
+    /**
+     * @brief Appends the Replication section of INFO in the Redis layout.
+     */
+    void writeInfo(std::string& out) const {
+        const auto now = std::chrono::steady_clock::now().time_since_epoch();
+        const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+        const int64_t last_io_ms = last_io_ms_.load();
+        ServerInfo::field(out, "role", "slave");
+        ServerInfo::field(out, "master_host", host_);
+        ServerInfo::field(out, "master_port", uint64_t{port_});
+        ServerInfo::field(out, "master_link_status", link_up_.load() ? "up" : "down");
+        ServerInfo::field(out, "master_last_io_seconds_ago",
+                          last_io_ms ? static_cast<uint64_t>((now_ms - last_io_ms) / 1000) : uint64_t{0});
+        ServerInfo::field(out, "master_sync_in_progress", uint64_t{syncing_.load()});
+        ServerInfo::field(out, "slave_repl_offset", offset_.load());
+        ServerInfo::field(out, "slave_read_only", uint64_t{1});
+        std::lock_guard guard(replid_mutex_);
+        ServerInfo::field(out, "master_replid", replid_.empty() ? "?" : replid_);
+    }
+
+private:
+    KVStore& store_;
+    const std::string host_;
+    const uint16_t port_;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    std::mutex fd_mutex_;  ///< Lets stop() interrupt a blocking receive.
+    int fd_ = -1;
+    std::string input_;
+    size_t pos_ = 0;
+
+    mutable std::mutex replid_mutex_;
+    std::string replid_;             ///< Stream being applied; empty before the first sync.
+    std::atomic<uint64_t> offset_{0};  ///< Stream applied so far.
+    std::atomic<bool> link_up_{false};
+    std::atomic<bool> syncing_{false};
+    std::atomic<int64_t> last_io_ms_{0};
+
+    void run() {
+        while (running_) {
+            try {
+                connectToPrimary();
+                synchronize();
+            } catch (const std::exception& e) {
+                if (running_) std::cerr << "Replication: " << e.what() << std::endl;
+            }
+            link_up_ = false;
+            syncing_ = false;
+            {
+                std::lock_guard guard(fd_mutex_);
+                if (fd_ != -1) ::close(fd_);
+                fd_ = -1;
+            }
+            for (int waited = 0; running_ && waited < REPL_RETRY_MS; waited += 100) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+    }
+
+    void connectToPrimary() {
+        const int fd = BlockingSocket::connectTo(host_, port_, REPL_TIMEOUT_MS);
+        std::lock_guard guard(fd_mutex_);
+        fd_ = fd;
+        input_.clear();
+        pos_ = 0;
+    }
+
+    /**
+     * @brief Receives more input; throws when the link is closed, broken or silent for REPL_TIMEOUT_MS.
+     */
+    void fill() {
+        if (pos_ > 0) {
+            input_.erase(0, pos_);
+            pos_ = 0;
+        }
+        BlockingSocket::receiveInto(fd_, input_, 64 * 1024, "primary");
+        last_io_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::string readLine() {
+        size_t end;
+        while ((end = input_.find("\r\n", pos_)) == std::string::npos) fill();
+        std::string line = input_.substr(pos_, end - pos_);
+        pos_ = end + 2;
+        return line;
+    }
+
+    /**
+     * @brief Reads one "$n" bulk string and appends its payload to out.
+     * @return The payload size.
+     */
+    size_t readBulk(std::string& out) {
+        const std::string head = readLine();
+        uint64_t size = 0;
+        if (head.empty() || head[0] != '$' || !BlockingSocket::parseUnsigned(std::string_view(head).substr(1), size)) {
+            throw std::runtime_error("malformed snapshot stream");
+        }
+        while (input_.size() - pos_ < size + 2) fill();
+        out.append(input_, pos_, size);
+        pos_ += size + 2;
+        return size;
+    }
+
+    /**
+     * @brief Handshakes, loads a full resync if the primary sends one, and applies the stream until the link fails.
+     */
+    void synchronize() {
+        uint64_t offset;
+        std::string replid;
+        {
+            std::lock_guard guard(replid_mutex_);
+            replid = replid_.empty() ? "?" : replid_;
+            offset = offset_.load();
+        }
+        if (!BlockingSocket::sendAll(fd_, "PSYNC " + replid + " " + std::to_string(offset) + "\r\n")) {
+            throw std::system_error(errno, std::system_category(), "replication send");
+        }
+
+        const std::string reply = readLine();
+        if (reply.rfind("+FULLRESYNC ", 0) == 0) {
+            const size_t space = reply.find(' ', 12);
+            if (space == std::string::npos ||
+                !BlockingSocket::parseUnsigned(std::string_view(reply).substr(space + 1), offset)) {
+                throw std::runtime_error("malformed FULLRESYNC from primary");
+            }
+            syncing_ = true;
+            loadSnapshot();
+            syncing_ = false;
+            std::lock_guard guard(replid_mutex_);
+            replid_ = reply.substr(12, space - 12);
+            offset_ = offset;
+        } else if (reply != "+CONTINUE") {
+            throw std::runtime_error("primary refused PSYNC: " + reply);
+        }
+        link_up_ = true;
+        std::cerr << "Replication: in sync with " << host_ << ":" << port_ << " at offset " << offset_.load()
+                  << std::endl;
+
+        RESPCommand command;
+        while (running_) {
+            while (pos_ < input_.size()) {
+                size_t next = pos_;
+                const auto status = RESPParser::parseCommand(input_, next, command);
+                if (status == RESPParser::ParseStatus::Incomplete) break;
+                if (status == RESPParser::ParseStatus::Invalid ||
+                    (command.name() != "PING" && !MutationCodec::apply(store_, command))) {
+                    throw std::runtime_error("unexpected data in replication stream");
+                }
+                offset_ += next - pos_;
+                pos_ = next;
+            }
+            fill();
+        }
+    }
+
+    /**
+     * @brief Assembles the streamed snapshot in memory, header last (see KVStore::backgroundStreamTo()), and loads it.
+     */
+    void loadSnapshot() {
+        std::string image(sizeof(SnapshotHeader), '\0');
+        while (readBulk(image) > 0) {
+        }
+        std::string header;
+        if (readBulk(header) != sizeof(SnapshotHeader)) throw std::runtime_error("malformed snapshot stream");
+        std::memcpy(image.data(), header.data(), sizeof(SnapshotHeader));
+        store_.loadSnapshotImage(image.data(), image.size());
+    }
+};
+
+#endif // REPLICATION_H
@@ -3,12 +3,16 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <stdexcept>
 #include <cctype>
 #include <charconv>
 #include <system_error>
+#include <cstring>
+#include <limits>
+#include "byte_buffer.h"
 
 class RESPValue {
 public:
@@ -36,22 +40,165 @@ public:
           arrayValue(std::move(other.arrayValue)) {}
 };
 
+/**
+ * @class RESPCommand
+ * @brief A command parsed in place: the name and arguments are views into the input.
+ *
+ * Up to kInlineArgs views are stored inline; longer commands spill into a
+ * vector that keeps its capacity, so a command object reused across
+ * requests stops allocating after warm-up. Views are only valid while
+ * the buffer they were parsed from is neither modified nor consumed.
+ */
+class RESPCommand {
+public:
+    static constexpr size_t kInlineArgs = 8;
+
+    /**
+     * @brief Number of elements, including the command name.
+     */
+    size_t size() const noexcept { return argc_; }
+    bool empty() const noexcept { return argc_ == 0; }
+
+    std::string_view name() const noexcept { return argv()[0]; }
+    std::string_view operator[](size_t i) const noexcept { return argv()[i]; }
+
+    /**
+     * @brief Contiguous array of size() views.
+     */
+    const std::string_view* argv() const noexcept {
+        return argc_ <= kInlineArgs ? inline_ : overflow_.data();
+    }
+
+    /**
+     * @brief Static description of the last parse failure.
+     */
+    const char* error() const noexcept { return error_; }
+
+private:
+    friend class RESPParser;
+
+    std::string_view inline_[kInlineArgs];
+    std::vector<std::string_view> overflow_;
+    size_t argc_ = 0;
+    const char* error_ = "";
+
+    void clear() noexcept {
+        argc_ = 0;
+        overflow_.clear();
+    }
+
+    void push(std::string_view arg) {
+        if (argc_ < kInlineArgs) {
+            inline_[argc_++] = arg;
+            return;
+        }
+        if (argc_ == kInlineArgs) {
+            overflow_.assign(inline_, inline_ + kInlineArgs);
+        }
+        overflow_.push_back(arg);
+        ++argc_;
+    }
+};
+
+/**
+ * @class RESPIncomplete
+ * @brief Thrown when the input ends before a complete RESP value.
+ *
+ * Distinguishes a frame that is merely truncated (more bytes may complete it)
+ * from one that is malformed.
+ */
+class RESPIncomplete : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
 /**
  * @class RESPParser
  * @brief Parses RESP messages and generates RESP responses.
  */
 class RESPParser {
 public:
+    /**
+     * @brief Outcome of an incremental parse.
+     */
+    enum class ParseStatus {
+        Complete,    ///< A whole frame was parsed and pos advanced past it.
+        Incomplete,  ///< The frame is truncated; pos is unchanged.
+        Invalid      ///< The frame is malformed; see RESPCommand::error().
+    };
+
+    static constexpr int64_t kMaxArgs = 1024 * 1024;
+    static constexpr int64_t kMaxBulkLength = 512LL * 1024 * 1024;
+
+    /**
+     * @brief Parses one command frame without copying or allocating.
+     *
+     * Accepts an array of bulk (or simple) strings, the form every Redis
+     * client sends. On success the command holds views into input.
+     * @param input Buffered bytes, possibly ending in a partial frame.
+     * @param pos Offset of the frame; advanced past it only on Complete.
+     * @param command Reusable command object that receives the arguments.
+     * @return Whether the frame was complete, truncated or malformed.
+     */
+    static ParseStatus parseCommand(std::string_view input, size_t& pos, RESPCommand& command) {
+        command.clear();
+        size_t p = pos;
+        if (p >= input.size()) return ParseStatus::Incomplete;
+        if (input[p++] != '*') {
+            return fail(command, "Protocol error: expected '*'");
+        }
+
+        int64_t count;
+        ParseStatus status = parseLength(input, p, count, command);
+        if (status != ParseStatus::Complete) return status;
+        if (count > kMaxArgs) {
+            return fail(command, "Protocol error: invalid multibulk length");
+        }
+
+        for (int64_t i = 0; i < count; ++i) {
+            if (p >= input.size()) return ParseStatus::Incomplete;
+
+            const char prefix = input[p++];
+            if (prefix == '$') {
+                int64_t length;
+                status = parseLength(input, p, length, command);
+                if (status != ParseStatus::Complete) return status;
+                if (length < 0 || length > kMaxBulkLength) {
+                    return fail(command, "Protocol error: invalid bulk length");
+                }
+
+                const size_t len = static_cast<size_t>(length);
+                if (input.size() - p < len + 2) return ParseStatus::Incomplete;
+                if (input[p + len] != '\r' || input[p + len + 1] != '\n') {
+                    return fail(command, "Protocol error: invalid bulk string terminator");
+                }
+                command.push(input.substr(p, len));
+                p += len + 2;
+            } else if (prefix == '+') {
+                const size_t end = input.find("\r\n", p);
+                if (end == std::string_view::npos) return ParseStatus::Incomplete;
+                command.push(input.substr(p, end - p));
+                p = end + 2;
+            } else {
+                return fail(command, "Protocol error: expected '$'");
+            }
+        }
+
+        pos = p;
+        return ParseStatus::Complete;
+    }
+
     /**
      * @brief Parses a RESP message from input.
      * @param input The RESP input string.
      * @param pos Current position in the input string.
      * @return Parsed RESP value.
+     * @throws RESPIncomplete if the input ends inside the value.
      * @throws std::runtime_error on invalid RESP format.
      */
-    static std::shared_ptr<RESPValue> parse(const std::string& input, size_t& pos) {
+    static std::shared_ptr<RESPValue> parse(std::string_view input, size_t& pos) {
         if (pos >= input.length()) {
-            throw std::runtime_error("Unexpected end of input");
+            throw RESPIncomplete("Unexpected end of input");
         }
 
         const char prefix = input[pos++];
@@ -66,6 +213,20 @@ public:
         }
     }
 
+    /**
+     * @brief Re-encodes a parsed command as a RESP array of bulk strings.
+     * @param output Buffer the encoded command is appended to.
+     * @param command Command to encode.
+     */
+    static void appendCommand(ByteBuffer& output, const RESPCommand& command) {
+        appendHeader(output, '*', command.size());
+        for (size_t i = 0; i < command.size(); ++i) {
+            appendHeader(output, '$', command[i].size());
+            output.append(command[i]);
+            output.append("\r\n", 2);
+        }
+    }
+
    /**
      * @brief Creates a RESP bulk string response.
      * @param value The string to be formatted as a bulk string.
@@ -104,18 +265,124 @@ public:
     static std::string createDELResponse(bool deleted) noexcept {
         return deleted ? ":1\r\n" : ":0\r\n";
     }
+    /**
+     * @brief Creates a RESP integer response.
+     */
+    static std::string createIntegerResponse(long long value) {
+        return ":" + std::to_string(value) + "\r\n";
+    }
+
+    /**
+     * @brief Appends the header of a RESP array with count elements.
+     */
+    static void appendArrayHeader(ByteBuffer& output, size_t count) {
+        appendHeader(output, '*', count);
+    }
+
+    /**
+     * @brief Appends a RESP bulk string without building a temporary std::string.
+     */
+    static void appendBulkString(ByteBuffer& output, std::string_view value) {
+        appendHeader(output, '$', value.size());
+        output.append(value);
+        output.append("\r\n", 2);
+    }
+
+    /**
+     * @brief Appends a RESP bulk string whose body is queued by reference if the buffer splices.
+     */
+    static void appendBulkString(ByteBuffer& output, PinnedBytes value) {
+        appendHeader(output, '$', value.view().size());
+        output.appendPinned(std::move(value));
+        output.append("\r\n", 2);
+    }
+
+    /**
+     * @brief Writes a RESP bulk string into output's free space without committing it.
+     * @return Bytes written; output.commit() them to append the reply, or drop them by not doing so.
+     */
+    static size_t prepareBulkString(ByteBuffer& output, std::string_view value) {
+        char* const start = output.prepare(value.size() + 32);
+        *start = '$';
+        char* pos = std::to_chars(start + 1, start + 22, value.size()).ptr;
+        *pos++ = '\r';
+        *pos++ = '\n';
+        std::memcpy(pos, value.data(), value.size());
+        pos += value.size();
+        *pos++ = '\r';
+        *pos++ = '\n';
+        return static_cast<size_t>(pos - start);
+    }
 
 private:
-    static void checkCRLF(const std::string& input, size_t pos) {
+    static void appendHeader(ByteBuffer& output, char prefix, size_t length) {
+        char header[24];
+        header[0] = prefix;
+        char* end = std::to_chars(header + 1, header + sizeof(header) - 2, length).ptr;
+        *end++ = '\r';
+        *end++ = '\n';
+        output.append(header, static_cast<size_t>(end - header));
+    }
+
+    static ParseStatus fail(RESPCommand& command, const char* message) noexcept {
+        command.error_ = message;
+        return ParseStatus::Invalid;
+    }
+
+    /**
+     * @brief Parses a decimal length terminated by CRLF, advancing p past it.
+     *
+     * Digits are accumulated in the same pass that looks for the CR: a
+     * header length is one to three digits, where calling memchr() and then
+     * from_chars() over the same bytes costs more than the bytes themselves.
+     * Bulk bodies are skipped by their length, so no payload byte is scanned.
+     */
+    static ParseStatus parseLength(std::string_view input, size_t& p, int64_t& length, RESPCommand& command) {
+        // A length never needs more than 20 bytes, so don't wait longer for
+        // its CR. 19 significant digits fit in uint64_t; leading zeros don't
+        // count, as they did not for from_chars().
+        constexpr size_t kMaxHeader = 20;
+        constexpr size_t kMaxDigits = 19;
+        const char* const begin = input.data() + p;
+        const char* const end = input.data() + input.size();
+        const char* c = begin;
+        const bool negative = c != end && *c == '-';
+        if (negative) ++c;
+
+        const char* const digits = c;
+        while (c != end && *c == '0') ++c;
+        const char* const significant = c;
+        uint64_t value = 0;
+        while (c != end && static_cast<unsigned char>(*c - '0') <= 9) {
+            value = value * 10 + static_cast<unsigned char>(*c - '0');
+            ++c;
+        }
+        if (static_cast<size_t>(c - begin) > kMaxHeader || static_cast<size_t>(c - significant) > kMaxDigits ||
+            value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + negative) {
+            return fail(command, "Protocol error: invalid length");
+        }
+        if (c == end || c + 1 == end) {
+            return c == end || *c == '\r' ? ParseStatus::Incomplete : fail(command, "Protocol error: invalid length");
+        }
+        if (*c != '\r') return fail(command, "Protocol error: invalid length");
+        if (c[1] != '\n') return fail(command, "Protocol error: invalid CRLF terminator");
+        if (c == digits) return fail(command, "Protocol error: invalid length");
+
+        length = negative ? static_cast<int64_t>(0 - value) : static_cast<int64_t>(value);
+        p += static_cast<size_t>(c - begin) + 2;
+        return ParseStatus::Complete;
+    }
+
+    static void checkCRLF(std::string_view input, size_t pos) {
         if (pos + 1 >= input.size() || input[pos] != '\r' || input[pos + 1] != '\n') {
             throw std::runtime_error("Invalid CRLF terminator");
         }
     }
 
-    static std::shared_ptr<RESPValue> parseSimpleString(const std::string& input, size_t& pos) {
+    static std::shared_ptr<RESPValue> parseSimpleString(std::string_view input, size_t& pos) {
         const size_t end = input.find("\r\n", pos);
-        if (end == std::string::npos) {
-            throw std::runtime_error("Unterminated simple string");
+        if (end == std::string_view::npos) {
+            throw RESPIncomplete("Unterminated simple string");
         }
 
         auto value = std::make_shared<RESPValue>(RESPValue::Type::SimpleString);
@@ -124,10 +391,10 @@ private:
         return value;
     }
 
-    static std::shared_ptr<RESPValue> parseError(const std::string& input, size_t& pos) {
+    static std::shared_ptr<RESPValue> parseError(std::string_view input, size_t& pos) {
         const size_t end = input.find("\r\n", pos);
-        if (end == std::string::npos) {
-            throw std::runtime_error("Unterminated error");
+        if (end == std::string_view::npos) {
+            throw RESPIncomplete("Unterminated error");
         }
 
         auto value = std::make_shared<RESPValue>(RESPValue::Type::Error);
@@ -136,10 +403,10 @@ private:
         return value;
     }
 
-    static std::shared_ptr<RESPValue> parseInteger(const std::string& input, size_t& pos) {
+    static std::shared_ptr<RESPValue> parseInteger(std::string_view input, size_t& pos) {
         const size_t end = input.find("\r\n", pos);
-        if (end == std::string::npos) {
-            throw std::runtime_error("Unterminated integer");
+        if (end == std::string_view::npos) {
+            throw RESPIncomplete("Unterminated integer");
         }
 
         auto value = std::make_shared<RESPValue>(RESPValue::Type::Integer);
@@ -155,10 +422,10 @@ private:
         return value;
     }
 
-    static std::shared_ptr<RESPValue> parseBulkString(const std::string& input, size_t& pos) {
+    static std::shared_ptr<RESPValue> parseBulkString(std::string_view input, size_t& pos) {
         const size_t lenEnd = input.find("\r\n", pos);
-        if (lenEnd == std::string::npos) {
-            throw std::runtime_error("Unterminated bulk string length");
+        if (lenEnd == std::string_view::npos) {
+            throw RESPIncomplete("Unterminated bulk string length");
         }
 
         int64_t length;
@@ -174,7 +441,7 @@ private:
         }
 
         if (pos + static_cast<size_t>(length) + 2 > input.size()) {
-            throw std::runtime_error("Incomplete bulk string");
+            throw RESPIncomplete("Incomplete bulk string");
         }
 
         if (input[pos + length] != '\r' || input[pos + length + 1] != '\n') {
@@ -187,10 +454,10 @@ private:
         return value;
     }
 
-    static std::shared_ptr<RESPValue> parseArray(const std::string& input, size_t& pos) {
+    static std::shared_ptr<RESPValue> parseArray(std::string_view input, size_t& pos) {
         const size_t lenEnd = input.find("\r\n", pos);
-        if (lenEnd == std::string::npos) {
-            throw std::runtime_error("Unterminated array length");
+        if (lenEnd == std::string_view::npos) {
+            throw RESPIncomplete("Unterminated array length");
         }
 
         int64_t length;
@@ -0,0 +1,275 @@
+/**
+ * @file server_stats.h
+ * @brief Per-thread counters for the hot path and the INFO report built from them.
+ */
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include "latency_histogram.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define STATS_MAX_THREADS 256
+#define STATS_LATENCY_MAX_NS (uint64_t{1} << 30)
+#define STATS_RATE_SAMPLES 16
+
+/**
+ * @class StatCounter
+ * @brief A monotonic counter written by one thread and read by any.
+ *
+ * add() is a relaxed load and store rather than a read-modify-write, so it
+ * costs the same as bumping a plain integer; keep each counter on a cache
+ * line only its writer touches (see PerThread) and readers never slow it down.
+ */
+class StatCounter {
+public:
+    void add(uint64_t n = 1) noexcept {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t load() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+/**
+ * @brief Index of the calling thread among live threads, reused after a thread exits.
+ *
+ * A thread that takes over an index carries on with the counts its
+ * predecessor left, which is what cumulative statistics want. Past
+ * STATS_MAX_THREADS live threads the rest share the last index, where
+ * concurrent updates may be lost.
+ */
+inline size_t statsThreadIndex() {
+    static std::atomic<bool> used[STATS_MAX_THREADS];
+
+    struct Claim {
+        size_t index = STATS_MAX_THREADS - 1;
+        bool owned = false;
+
+        Claim() {
+            for (size_t i = 0; i + 1 < STATS_MAX_THREADS; ++i) {
+                bool expected = false;
+                if (used[i].compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                    index = i;
+                    owned = true;
+                    return;
+                }
+            }
+        }
+        ~Claim() {
+            if (owned) used[index].store(false, std::memory_order_release);
+        }
+    };
+    static thread_local Claim claim;
+    return claim.index;
+}
+
+/**
+ * @class PerThread
+ * @brief One T per thread, allocated on first use, with every copy visible to readers.
+ *
+ * Writers only touch their own T, which is cache-line aligned; readers
+ * aggregate with forEach(). T is made of StatCounter-like fields that are
+ * safe to read while their owner writes them.
+ */
+template <typename T>
+class PerThread {
+public:
+    PerThread() : slots_(new std::atomic<Slot*>[STATS_MAX_THREADS]()) {}
+    ~PerThread() {
+        for (size_t i = 0; i < STATS_MAX_THREADS; ++i) delete slots_[i].load(std::memory_order_relaxed);
+        delete[] slots_;
+    }
+    PerThread(const PerThread&) = delete;
+    PerThread& operator=(const PerThread&) = delete;
+
+    T& local() {
+        std::atomic<Slot*>& slot = slots_[statsThreadIndex()];
+        Slot* current = slot.load(std::memory_order_acquire);
+        if (current) return current->value;
+
+        Slot* created = new Slot();
+        if (!slot.compare_exchange_strong(current, created, std::memory_order_acq_rel)) {
+            delete created;
+            return current->value;
+        }
+        return created->value;
+    }
+
+    template <typename Visitor>
+    void forEach(Visitor&& visit) const {
+        for (size_t i = 0; i < STATS_MAX_THREADS; ++i) {
+            if (const Slot* slot = slots_[i].load(std::memory_order_acquire)) visit(slot->value);
+        }
+    }
+
+private:
+    struct alignas(64) Slot {
+        T value;
+    };
+    std::atomic<Slot*>* slots_;
+};
+
+/**
+ * @class LatencyRecorder
+ * @brief Single-writer latency histogram that other threads can fold into a LatencyHistogram.
+ *
+ * Buckets match LatencyHistogram's up to STATS_LATENCY_MAX_NS, where larger
+ * values are clamped, and are only allocated once something is recorded.
+ */
+class LatencyRecorder {
+public:
+    static constexpr size_t kBuckets = LatencyHistogram::indexOf(STATS_LATENCY_MAX_NS) + 1;
+
+    LatencyRecorder() = default;
+    ~LatencyRecorder() { delete[] buckets_.load(std::memory_order_relaxed); }
+    LatencyRecorder(const LatencyRecorder&) = delete;
+    LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+    void record(uint64_t ns) {
+        std::atomic<uint64_t>* buckets = buckets_.load(std::memory_order_relaxed);
+        if (!buckets) {
+            buckets = new std::atomic<uint64_t>[kBuckets]();
+            buckets_.store(buckets, std::memory_order_release);
+        }
+        auto& bucket = buckets[LatencyHistogram::indexOf(std::min(ns, STATS_LATENCY_MAX_NS))];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void addTo(LatencyHistogram& histogram) const {
+        const std::atomic<uint64_t>* buckets = buckets_.load(std::memory_order_acquire);
+        if (!buckets) return;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            const uint64_t count = buckets[i].load(std::memory_order_relaxed);
+            if (count) histogram.record(LatencyHistogram::lowestIn(i), count);
+        }
+    }
+
+private:
+    std::atomic<std::atomic<uint64_t>*> buckets_{nullptr};
+};
+
+/**
+ * @class RateMeter
+ * @brief Turns a cumulative total into a per-second rate over its last few samples.
+ *
+ * Like Redis' instantaneous_ops_per_sec: sample() is called periodically
+ * (every 100 ms here) and perSecond() averages over the window it keeps.
+ */
+class RateMeter {
+public:
+    void sample(uint64_t total) {
+        std::lock_guard guard(mutex_);
+        samples_[next_ % STATS_RATE_SAMPLES] = {total, std::chrono::steady_clock::now()};
+        ++next_;
+    }
+
+    double perSecond() const {
+        std::lock_guard guard(mutex_);
+        if (next_ < 2) return 0;
+        const Sample& newest = samples_[(next_ - 1) % STATS_RATE_SAMPLES];
+        const Sample& oldest = samples_[next_ > STATS_RATE_SAMPLES ? next_ % STATS_RATE_SAMPLES : 0];
+        const double seconds = std::chrono::duration<double>(newest.at - oldest.at).count();
+        return seconds > 0 ? static_cast<double>(newest.total - oldest.total) / seconds : 0;
+    }
+
+private:
+    struct Sample {
+        uint64_t total = 0;
+        std::chrono::steady_clock::time_point at{};
+    };
+    mutable std::mutex mutex_;
+    Sample samples_[STATS_RATE_SAMPLES];
+    size_t next_ = 0;
+};
+
+/**
+ * @class ServerInfo
+ * @brief The sections of the INFO report, each rendered on demand by the module that owns the data.
+ *
+ * Sections are registered before the server starts and rendered in
+ * registration order in the Redis layout: a "# Name" header followed by
+ * "field:value" lines. Fields with several values use
+ * "name:key=value,key=value", e.g. cmdstat_get:calls=10,usec=3.
+ */
+class ServerInfo {
+public:
+    using Render = std::function<void(std::string& out)>;
+
+    /**
+     * @param name Section title as shown in the header; INFO matches it in any case.
+     * @param render Appends the section's field lines.
+     * @param in_default False for sections only shown by INFO all or by name, such as commandstats.
+     */
+    void addSection(std::string name, Render render, bool in_default = true) {
+        sections_.push_back({std::move(name), std::move(render), in_default});
+    }
+
+    /**
+     * @brief Renders the requested sections; none, "default", "all" or "everything" select groups.
+     */
+    std::string render(const std::vector<std::string_view>& requested = {}) const {
+        std::string out;
+        for (const Section& section : sections_) {
+            if (!selected(section, requested)) continue;
+            if (!out.empty()) out += "\r\n";
+            out += "# " + section.name + "\r\n";
+            section.render(out);
+        }
+        return out;
+    }
+
+    static void field(std::string& out, std::string_view name, std::string_view value) {
+        out.append(name);
+        out += ':';
+        out.append(value);
+        out += "\r\n";
+    }
+
+    static void field(std::string& out, std::string_view name, uint64_t value) {
+        field(out, name, std::to_string(value));
+    }
+
+    static void field(std::string& out, std::string_view name, double value) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.2f", value);
+        field(out, name, text);
+    }
+
+private:
+    struct Section {
+        std::string name;
+        Render render;
+        bool in_default;
+    };
+    std::vector<Section> sections_;
+
+    static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+                   return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+               });
+    }
+
+    static bool selected(const Section& section, const std::vector<std::string_view>& requested) {
+        if (requested.empty()) return section.in_default;
+        for (std::string_view name : requested) {
+            if (equalsIgnoreCase(name, "all") || equalsIgnoreCase(name, "everything")) return true;
+            if (equalsIgnoreCase(name, "default") && section.in_default) return true;
+            if (equalsIgnoreCase(name, section.name)) return true;
+        }
+        return false;
+    }
+};
+
+#endif // SERVER_STATS_H
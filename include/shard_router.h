@@ -0,0 +1,191 @@
+/**
+ * @file shard_router.h
+ * @brief Shared-nothing request routing: each Worker owns a partition of the keyspace.
+ */
+#ifndef SHARD_ROUTER_H
+#define SHARD_ROUTER_H
+
+#include "async_server.h"
+#include "proto_handler.h"
+#include "kv_store.h"
+#include "resp_parser.h"
+#include "byte_buffer.h"
+#include "free_list.h"
+#include <vector>
+
+#define ROUTER_BATCH_CACHE 64
+
+/**
+ * @class ShardRouter
+ * @brief Runs every keyed command on the Worker that owns the key's shard.
+ *
+ * Worker w owns the KVStore shards s with s % workerCount() == w. Commands
+ * whose key is owned locally execute inline. The rest are re-encoded into a
+ * per-owner batch, handed to the owner through its lock-free task queue and
+ * answered the same way; the client connection reserves a reply slot for
+ * each so responses keep request order. One batch per owner is posted per
+ * read, so a deep pipeline costs one queue hop per remote core, not one per
+ * command. Batches return to the worker that filled them, which keeps them,
+ * buffers and all, for its next read; with the task captures small
+ * enough to live inside std::function, a forwarded command allocates
+ * nothing once the workers are warmed up.
+ *
+ * Multi-key commands run on the worker that received them, locking the
+ * shards they touch. One that arrives while earlier commands of the same
+ * connection are still out on other workers waits until their replies are
+ * in, so it never overtakes a write it follows.
+ *
+ * Shards keep their locks, so anything that bypasses the router (snapshots,
+ * future multi-key commands) stays correct. Under routing only the owner
+ * takes them, which keeps every shard lock on its owner's cache.
+ */
+class ShardRouter {
+private:
+    struct Ticket {
+        int fd;
+        uint64_t connection_id;
+        uint64_t seq;
+    };
+
+    /**
+     * @brief Commands forwarded from one worker to another, and their replies.
+     */
+    struct Batch {
+        Worker* origin = nullptr;
+        ByteBuffer requests;
+        std::vector<Ticket> tickets;
+        ByteBuffer replies;
+        std::vector<size_t> reply_ends;
+    };
+
+    using BatchPool = FreeList<Batch, ROUTER_BATCH_CACHE>;
+
+    static Batch* acquireBatch(Worker& origin) {
+        Batch* batch = BatchPool::take();
+        if (batch == nullptr) batch = new Batch();
+        batch->origin = &origin;
+        return batch;
+    }
+
+    /**
+     * @brief Empties a delivered batch and keeps it for the calling (origin) worker's next read.
+     */
+    static void releaseBatch(Batch* batch) {
+        batch->requests.clear();
+        batch->requests.releaseIfLarger(MAX_IDLE_BUFFER);
+        batch->replies.clear();
+        batch->replies.releaseIfLarger(MAX_IDLE_BUFFER);
+        batch->tickets.clear();
+        batch->reply_ends.clear();
+        BatchPool::give(batch);
+    }
+
+    KVStore& store_;
+    RedisProtocolHandler& handler_;
+    AsyncServer& server_;
+
+    size_t ownerOf(std::string_view key) const {
+        return store_.shardOf(key) % server_.workerCount();
+    }
+
+    /**
+     * @brief Executes a forwarded batch on its owning worker and sends back the replies.
+     */
+    void execute(Batch* batch) {
+        static thread_local RESPCommand command;
+        const std::string_view requests = batch->requests.view();
+        size_t pos = 0;
+
+        batch->reply_ends.reserve(batch->tickets.size());
+        while (RESPParser::parseCommand(requests, pos, command) == RESPParser::ParseStatus::Complete) {
+            handler_.process_command(command, batch->replies);
+            batch->reply_ends.push_back(batch->replies.size());
+        }
+        store_.syncLog();
+
+        batch->origin->post([batch] {
+            const std::string_view replies = batch->replies.view();
+            size_t begin = 0;
+            for (size_t i = 0; i < batch->tickets.size(); ++i) {
+                const Ticket& ticket = batch->tickets[i];
+                const size_t end = batch->reply_ends[i];
+                batch->origin->completeReply(ticket.fd, ticket.connection_id, ticket.seq,
+                                             replies.substr(begin, end - begin));
+                begin = end;
+            }
+            releaseBatch(batch);
+        });
+    }
+
+public:
+    /**
+     * @brief Constructs a router over a store partitioned across the server's workers.
+     * @param store Store whose shards are assigned to workers.
+     * @param handler Protocol handler that executes commands.
+     * @param server Server whose workers own the partitions.
+     */
+    ShardRouter(KVStore& store, RedisProtocolHandler& handler, AsyncServer& server)
+        : store_(store), handler_(handler), server_(server) {}
+
+    /**
+     * @brief Request handler entry point; must run on a Worker thread.
+     * @param conn Connection with buffered input.
+     * @return Number of input bytes consumed.
+     */
+    size_t handle(Connection& conn) {
+        static thread_local RESPCommand command;
+        static thread_local ByteBuffer scratch;
+        static thread_local std::vector<Batch*> outbox;
+
+        Worker& self = *Worker::current();
+        if (outbox.size() != server_.workerCount()) outbox.resize(server_.workerCount());
+
+        const std::string_view input = conn.input.view();
+        size_t pos = 0;
+        while (pos < input.size()) {
+            const size_t start = pos;
+            const RESPParser::ParseStatus status = RESPParser::parseCommand(input, pos, command);
+            if (status == RESPParser::ParseStatus::Incomplete) break;
+            if (status == RESPParser::ParseStatus::Invalid) {
+                // A malformed frame leaves no reliable boundary to resume from.
+                conn.reply(RESPParser::createErrorResponse("ERR " + std::string(command.error())));
+                pos = input.size();
+                break;
+            }
+
+            std::string_view key;
+            const bool routed = RedisProtocolHandler::routing_key(command, key);
+            if (!routed && conn.hasDeferred() && RedisProtocolHandler::has_keys(command)) {
+                // Worker hands the rest of the input back once the deferred replies are in.
+                pos = start;
+                break;
+            }
+            const size_t owner = routed ? ownerOf(key) : self.id();
+            if (owner == self.id()) {
+                if (!conn.hasDeferred()) {
+                    handler_.process_command(command, conn.output);
+                } else {
+                    scratch.clear();
+                    handler_.process_command(command, scratch);
+                    conn.reply(scratch.view());
+                }
+                continue;
+            }
+
+            Batch*& batch = outbox[owner];
+            if (batch == nullptr) batch = acquireBatch(self);
+            batch->tickets.push_back({conn.fd, conn.id, conn.deferReply()});
+            RESPParser::appendCommand(batch->requests, command);
+        }
+
+        for (size_t owner = 0; owner < outbox.size(); ++owner) {
+            if (outbox[owner] == nullptr) continue;
+            server_.worker(owner).post([this, batch = outbox[owner]] { execute(batch); });
+            outbox[owner] = nullptr;
+        }
+        store_.syncLog();
+        return pos;
+    }
+};
+
+#endif // SHARD_ROUTER_H
@@ -0,0 +1,115 @@
+/**
+ * @file snapshot_format.h
+ * @brief On-disk layout of versioned KVStore snapshots.
+ */
+#ifndef SNAPSHOT_FORMAT_H
+#define SNAPSHOT_FORMAT_H
+
+#include "ankerl/unordered_dense.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+/**
+ * Layout, all integers in host byte order:
+ *
+ *   SnapshotHeader                          64 bytes at offset 0
+ *   block 0 .. block N-1                    one per store shard
+ *   SnapshotBlockIndex[N]                   at header.index_offset
+ *
+ * A block is a run of records, each a SnapshotRecordHeader followed by
+ * the key bytes and the value bytes (version 1 records stop the header
+ * after value_size and never expire). Since version 3 a value_size with
+ * SNAPSHOT_VALUE_LZ4 set is a compressed value, stored exactly as the
+ * store keeps it (ValueEncoding::Lz4). Blocks are self-contained
+ * and carry their own key count and checksum, so a loader can map the
+ * file and hand each block to a different thread.
+ */
+#define SNAPSHOT_MAGIC "BLNKSNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_VALUE_LZ4 0x80000000u
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_count;     ///< Equals the writer's shard count.
+    uint64_t key_count;
+    uint64_t index_offset;
+    uint64_t index_checksum;  ///< SnapshotChecksum of the block index.
+    uint8_t reserved[24];
+};
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header must stay 64 bytes");
+
+struct SnapshotBlockIndex {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t key_count;
+    uint64_t checksum;
+};
+static_assert(sizeof(SnapshotBlockIndex) == 32, "snapshot index entry must stay 32 bytes");
+
+struct SnapshotRecordHeader {
+    uint32_t key_size;
+    uint32_t value_size;  ///< Stored bytes; the top bit is SNAPSHOT_VALUE_LZ4 since version 3.
+    int64_t expire_at;  ///< Unix milliseconds, 0 for keys that never expire. Since version 2.
+};
+static_assert(sizeof(SnapshotRecordHeader) == 16, "snapshot record header must stay 16 bytes");
+
+/**
+ * @class SnapshotChecksum
+ * @brief Streaming checksum: wyhash over fixed 64 KiB segments, chained.
+ *
+ * The result depends only on the bytes, not on how they were split across
+ * update() calls, so the writer can feed its flush buffer while the loader
+ * hashes a mapped block in one call. Whole segments of a contiguous input
+ * are hashed in place; only a partial segment is buffered.
+ */
+class SnapshotChecksum {
+private:
+    static constexpr size_t kSegment = 64 * 1024;
+
+    uint64_t state_ = 0;
+    std::unique_ptr<char[]> pending_;
+    size_t pending_size_ = 0;
+
+    void absorb(const char* data, size_t size) noexcept {
+        const uint64_t segment = ankerl::unordered_dense::detail::wyhash::hash(data, size);
+        state_ = ankerl::unordered_dense::detail::wyhash::mix(state_ ^ segment, UINT64_C(0x9E3779B97F4A7C15));
+    }
+
+public:
+    void update(const char* data, size_t size) {
+        if (pending_size_ > 0) {
+            const size_t take = std::min(size, kSegment - pending_size_);
+            std::memcpy(pending_.get() + pending_size_, data, take);
+            pending_size_ += take;
+            data += take;
+            size -= take;
+            if (pending_size_ < kSegment) return;
+            absorb(pending_.get(), kSegment);
+            pending_size_ = 0;
+        }
+        for (; size >= kSegment; data += kSegment, size -= kSegment) {
+            absorb(data, kSegment);
+        }
+        if (size > 0) {
+            if (!pending_) pending_.reset(new char[kSegment]);
+            std::memcpy(pending_.get(), data, size);
+            pending_size_ = size;
+        }
+    }
+
+    /**
+     * @brief Returns the checksum of everything passed to update() and resets.
+     */
+    uint64_t finish() noexcept {
+        if (pending_size_ > 0) absorb(pending_.get(), pending_size_);
+        const uint64_t result = state_;
+        state_ = 0;
+        pending_size_ = 0;
+        return result;
+    }
+};
+
+#endif // SNAPSHOT_FORMAT_H
@@ -2,33 +2,540 @@
 #include "async_server.h"
 #include "resp_parser.h"
 #include "proto_handler.h"
+#include "shard_router.h"
+#include "aof.h"
+#include "replication.h"
+#include "cluster.h"
+#include "server_stats.h"
+#include "metrics_exporter.h"
+#include "hot_restart.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <memory>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <cstring>
+#include <cctype>
+#include <csignal>
+#include <vector>
+
+/**
+ * @brief Parses a CPU list such as "0-3,8,10-11".
+ */
+static std::vector<size_t> parseCpuList(const std::string& list) {
+    std::vector<size_t> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+
+        const std::string item = list.substr(pos, end - pos);
+        const size_t dash = item.find('-');
+        const size_t first = std::stoul(item.substr(0, dash));
+        const size_t last = dash == std::string::npos ? first : std::stoul(item.substr(dash + 1));
+        for (size_t cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+/**
+ * @brief Parses a byte count with an optional kb, mb or gb suffix, e.g. "512mb".
+ */
+static size_t parseBytes(const std::string& text) {
+    size_t pos = 0;
+    const size_t value = std::stoull(text, &pos);
+    std::string unit = text.substr(pos);
+    for (char& c : unit) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (unit.empty() || unit == "b") return value;
+    if (unit == "kb" || unit == "k") return value << 10;
+    if (unit == "mb" || unit == "m") return value << 20;
+    if (unit == "gb" || unit == "g") return value << 30;
+    throw std::invalid_argument("unknown size unit in '" + text + "'");
+}
+
+/**
+ * @brief Reads a config file as command-line arguments: each "name value..." line becomes "--name value...".
+ *
+ * Blank lines and # comments are skipped. Switches such as aof take yes or
+ * no, so a file can spell out that they are off.
+ */
+static std::vector<std::string> readConfigFile(const std::string& path) {
+    static const char* const switches[] = {"shared-nothing", "numa", "io-uring", "aof"};
+    std::ifstream file(path);
+    if (!file) throw std::runtime_error("Cannot open config file " + path);
+
+    std::vector<std::string> args;
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string name, value;
+        if (!(words >> name)) continue;
+        std::vector<std::string> values;
+        while (words >> value) values.push_back(value);
+
+        const bool is_switch = std::find(std::begin(switches), std::end(switches), name) != std::end(switches);
+        if (is_switch) {
+            if (values.size() != 1 || (values[0] != "yes" && values[0] != "no")) {
+                throw std::invalid_argument(path + ": " + name + " must be yes or no");
+            }
+            if (values[0] == "yes") args.push_back("--" + name);
+            continue;
+        }
+        args.push_back("--" + name);
+        args.insert(args.end(), values.begin(), values.end());
+    }
+    return args;
+}
+
+/**
+ * @class PersistenceLoop
+ * @brief Saves periodic snapshots, or rewrites the AOF when it is due, on its own thread.
+ *
+ * Waits on a condition variable rather than sleeping, so stop() returns as
+ * soon as a save in progress finishes instead of an interval later.
+ */
+class PersistenceLoop {
+private:
+    KVStore& store_;
+    AppendOnlyLog* aof_;
+    std::chrono::seconds interval_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool running_ = false;
+    std::thread thread_;
+
+    void run() {
+        std::unique_lock lock(mutex_);
+        while (running_) {
+            lock.unlock();
+            try {
+                if (!aof_) {
+                    store_.backgroundPersist();
+                } else if (aof_->rewriteDue()) {
+                    aof_->rewrite(store_);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Snapshot error: " << e.what() << std::endl;
+            }
+            lock.lock();
+            wake_.wait_for(lock, interval_, [this] { return !running_; });
+        }
+    }
+
+public:
+    /**
+     * @param save_interval Time between snapshots without an AOF; the AOF is checked every second.
+     */
+    PersistenceLoop(KVStore& store, AppendOnlyLog* aof, std::chrono::seconds save_interval)
+        : store_(store), aof_(aof), interval_(aof ? std::chrono::seconds(1) : save_interval) {}
+
+    ~PersistenceLoop() { stop(); }
+
+    void start() {
+        std::lock_guard guard(mutex_);
+        if (running_) return;
+        running_ = true;
+        thread_ = std::thread(&PersistenceLoop::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard guard(mutex_);
+            if (!running_) return;
+            running_ = false;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+};
+
+/**
+ * @brief Rates INFO reports as instantaneous_*, sampled by worker 0's timer.
+ */
+struct InfoRates {
+    RateMeter ops;
+    RateMeter input;
+    RateMeter output;
+};
+
+static uint64_t sumWorkers(AsyncServer& server, StatCounter WorkerStats::*counter) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < server.workerCount(); ++i) total += (server.worker(i).stats().*counter).load();
+    return total;
+}
+
+/**
+ * @brief Registers the INFO sections, each reading its module's counters when rendered.
+ */
+static void addInfoSections(ServerInfo& info, KVStore& store, AsyncServer& server, RedisProtocolHandler& handler,
+                            const InfoRates& rates, IoBackend backend, bool shared_nothing, bool aof_enabled,
+                            uint16_t port, ServerInfo::Render replication, const Cluster* cluster) {
+    const auto started = std::chrono::steady_clock::now();
+
+    info.addSection("Server", [&server, started, backend, shared_nothing, port](std::string& out) {
+        const auto uptime = std::chrono::steady_clock::now() - started;
+        ServerInfo::field(out, "process_id", static_cast<uint64_t>(getpid()));
+        ServerInfo::field(out, "tcp_port", uint64_t{port});
+        ServerInfo::field(out, "uptime_in_seconds",
+                          static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(uptime).count()));
+        ServerInfo::field(out, "io_backend", backend == IoBackend::IoUring ? "io_uring" : "epoll");
+        ServerInfo::field(out, "workers", static_cast<uint64_t>(server.workerCount()));
+        ServerInfo::field(out, "routing", shared_nothing ? "shared-nothing" : "shared");
+    });
+    info.addSection("Clients", [&server](std::string& out) {
+        uint64_t connected = 0;
+        for (size_t i = 0; i < server.workerCount(); ++i) connected += server.worker(i).stats().connections();
+        ServerInfo::field(out, "connected_clients", connected);
+    });
+    info.addSection("Memory", [&store](std::string& out) {
+        ServerInfo::field(out, "used_memory", static_cast<uint64_t>(store.memoryUsage()));
+        ServerInfo::field(out, "maxmemory", static_cast<uint64_t>(store.maxMemory()));
+        ServerInfo::field(out, "compression_threshold", static_cast<uint64_t>(store.compressionThreshold()));
+        ServerInfo::field(out, "compressed_keys", static_cast<uint64_t>(store.compressedKeys()));
+    });
+    info.addSection("Persistence", [&store, aof_enabled](std::string& out) {
+        const KVStore::SnapshotStats snapshots = store.snapshotStats();
+        ServerInfo::field(out, "aof_enabled", uint64_t{aof_enabled});
+        ServerInfo::field(out, "rdb_bgsave_in_progress", uint64_t{snapshots.in_progress});
+        ServerInfo::field(out, "rdb_saves", snapshots.completed);
+        ServerInfo::field(out, "rdb_failed_saves", snapshots.failed);
+        ServerInfo::field(out, "rdb_last_save_time", static_cast<uint64_t>(snapshots.last_finished_ms / 1000));
+        ServerInfo::field(out, "rdb_last_bgsave_status", snapshots.last_ok ? "ok" : "err");
+        ServerInfo::field(out, "rdb_last_bgsave_time_ms", snapshots.last_duration_ns / 1000000);
+        ServerInfo::field(out, "latest_fork_usec", snapshots.last_fork_ns / 1000);
+    });
+    info.addSection("Stats", [&store, &server, &handler, &rates](std::string& out) {
+        const KVStore::LockStats locks = store.lockStats();
+        ServerInfo::field(out, "total_connections_received", sumWorkers(server, &WorkerStats::connections_received));
+        ServerInfo::field(out, "total_connections_timed_out", sumWorkers(server, &WorkerStats::connections_timed_out));
+        ServerInfo::field(out, "total_connections_handed_off", sumWorkers(server, &WorkerStats::connections_handed_off));
+        ServerInfo::field(out, "total_commands_processed", handler.total_commands());
+        ServerInfo::field(out, "instantaneous_ops_per_sec", static_cast<uint64_t>(rates.ops.perSecond()));
+        ServerInfo::field(out, "total_net_input_bytes", sumWorkers(server, &WorkerStats::bytes_in));
+        ServerInfo::field(out, "total_net_output_bytes", sumWorkers(server, &WorkerStats::bytes_out));
+        ServerInfo::field(out, "instantaneous_input_kbps", rates.input.perSecond() / 1024);
+        ServerInfo::field(out, "instantaneous_output_kbps", rates.output.perSecond() / 1024);
+        ServerInfo::field(out, "rejected_calls", handler.rejected_commands());
+        ServerInfo::field(out, "expired_keys", store.expiredKeys());
+        ServerInfo::field(out, "evicted_keys", store.evictedKeys());
+        ServerInfo::field(out, "shard_lock_waits", locks.waits);
+        ServerInfo::field(out, "shard_lock_wait_usec", locks.wait_ns / 1000);
+    });
+    info.addSection("Replication", std::move(replication));
+    info.addSection("Cluster", [cluster](std::string& out) {
+        if (cluster) {
+            cluster->writeInfo(out);
+        } else {
+            ServerInfo::field(out, "cluster_enabled", uint64_t{0});
+        }
+    });
+    info.addSection("Workers", [&server](std::string& out) {
+        for (size_t i = 0; i < server.workerCount(); ++i) {
+            const WorkerStats& stats = server.worker(i).stats();
+            ServerInfo::field(out, "worker_" + std::to_string(i),
+                              "connected_clients=" + std::to_string(stats.connections()) +
+                              ",connections_timed_out=" + std::to_string(stats.connections_timed_out.load()) +
+                              ",connections_handed_off=" + std::to_string(stats.connections_handed_off.load()) +
+                              ",net_input_bytes=" + std::to_string(stats.bytes_in.load()) +
+                              ",net_output_bytes=" + std::to_string(stats.bytes_out.load()) +
+                              ",event_loops=" + std::to_string(stats.loop_iterations.load()) +
+                              ",busy_usec=" + std::to_string(stats.busy_ns.load() / 1000));
+        }
+    });
+    info.addSection("Commandstats", [&handler](std::string& out) { handler.write_command_stats(out); }, false);
+    info.addSection("Latencystats", [&handler](std::string& out) { handler.write_latency_stats(out); }, false);
+    info.addSection("Hotkeys", [&handler](std::string& out) { handler.write_hot_key_stats(out); }, false);
+    info.addSection("Keyspace", [&store](std::string& out) {
+        const size_t keys = store.size();
+        if (keys == 0) return;
+        ServerInfo::field(out, "db0", "keys=" + std::to_string(keys) + ",expires=" + std::to_string(store.expiringKeys()));
+    });
+}
+
+int main(int argc, char** argv) {
+    // Taken by sigwait() below; blocked before any thread starts so that every thread inherits the mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
 
-int main() {
     try {
-        KVStore store;
+        size_t num_shards = DEFAULT_SHARD_COUNT;
+        size_t num_workers = std::thread::hardware_concurrency();
+        bool shared_nothing = false;
+        bool numa_local = false;
+        IoBackend backend = IoBackend::Epoll;
+        std::vector<size_t> cpus;
+        bool aof_enabled = false;
+        FsyncPolicy fsync_policy = FsyncPolicy::Interval;
+        size_t fsync_ms = 1000;
+        size_t max_memory = 0;
+        EvictionPolicy eviction_policy = EvictionPolicy::NoEviction;
+        uint16_t metrics_port = 0;
+        uint16_t port = 9001;
+        uint16_t replication_port = 0;
+        size_t repl_backlog_size = REPL_BACKLOG_SIZE;
+        std::string primary_host;
+        uint16_t primary_port = 0;
+        std::string cluster_config;
+        size_t idle_timeout_s = 0;
+        ConnectionBalance balance = ConnectionBalance::ReusePort;
+        size_t hot_key_cache = 0;
+        size_t compress_threshold = 0;
+        size_t save_s = 1000;
+        size_t shutdown_timeout_s = 10;
+
+        // Options from a config file take its place on the command line, so later flags override them.
+        std::vector<std::string> args;
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+                const std::vector<std::string> file_args = readConfigFile(argv[++i]);
+                args.insert(args.end(), file_args.begin(), file_args.end());
+            } else {
+                args.push_back(argv[i]);
+            }
+        }
+
+        for (size_t i = 0; i < args.size(); ++i) {
+            if (args[i] == "--shards" && i + 1 < args.size()) {
+                num_shards = std::stoul(args[++i]);
+            } else if (args[i] == "--workers" && i + 1 < args.size()) {
+                num_workers = std::stoul(args[++i]);
+            } else if (args[i] == "--shared-nothing") {
+                shared_nothing = true;
+            } else if (args[i] == "--cpus" && i + 1 < args.size()) {
+                cpus = parseCpuList(args[++i]);
+            } else if (args[i] == "--numa") {
+                numa_local = true;
+            } else if (args[i] == "--io-uring") {
+                backend = IoBackend::IoUring;
+            } else if (args[i] == "--aof") {
+                aof_enabled = true;
+            } else if (args[i] == "--aof-fsync" && i + 1 < args.size()) {
+                const std::string policy = args[++i];
+                if (policy == "always") fsync_policy = FsyncPolicy::Always;
+                else if (policy == "interval") fsync_policy = FsyncPolicy::Interval;
+                else if (policy == "os") fsync_policy = FsyncPolicy::OS;
+                else throw std::invalid_argument("--aof-fsync must be always, interval or os");
+            } else if (args[i] == "--aof-fsync-ms" && i + 1 < args.size()) {
+                fsync_ms = std::stoul(args[++i]);
+            } else if (args[i] == "--maxmemory" && i + 1 < args.size()) {
+                max_memory = parseBytes(args[++i]);
+            } else if (args[i] == "--maxmemory-policy" && i + 1 < args.size()) {
+                const std::string policy = args[++i];
+                if (policy == "noeviction") eviction_policy = EvictionPolicy::NoEviction;
+                else if (policy == "allkeys-lru") eviction_policy = EvictionPolicy::AllKeysLRU;
+                else if (policy == "allkeys-lfu") eviction_policy = EvictionPolicy::AllKeysLFU;
+                else throw std::invalid_argument("--maxmemory-policy must be noeviction, allkeys-lru or allkeys-lfu");
+            } else if (args[i] == "--metrics-port" && i + 1 < args.size()) {
+                metrics_port = static_cast<uint16_t>(std::stoul(args[++i]));
+            } else if (args[i] == "--port" && i + 1 < args.size()) {
+                port = static_cast<uint16_t>(std::stoul(args[++i]));
+            } else if (args[i] == "--replication-port" && i + 1 < args.size()) {
+                replication_port = static_cast<uint16_t>(std::stoul(args[++i]));
+            } else if (args[i] == "--repl-backlog-size" && i + 1 < args.size()) {
+                repl_backlog_size = parseBytes(args[++i]);
+            } else if (args[i] == "--cluster-config" && i + 1 < args.size()) {
+                cluster_config = args[++i];
+            } else if (args[i] == "--timeout" && i + 1 < args.size()) {
+                idle_timeout_s = std::stoul(args[++i]);
+            } else if (args[i] == "--balance" && i + 1 < args.size()) {
+                const std::string mode = args[++i];
+                if (mode == "reuseport") balance = ConnectionBalance::ReusePort;
+                else if (mode == "cpu") balance = ConnectionBalance::Cpu;
+                else if (mode == "least-loaded") balance = ConnectionBalance::LeastLoaded;
+                else throw std::invalid_argument("--balance must be reuseport, cpu or least-loaded");
+            } else if (args[i] == "--compress-threshold" && i + 1 < args.size()) {
+                compress_threshold = parseBytes(args[++i]);
+            } else if (args[i] == "--hotkey-cache" && i + 1 < args.size()) {
+                hot_key_cache = std::stoul(args[++i]);
+            } else if (args[i] == "--save" && i + 1 < args.size()) {
+                save_s = std::stoul(args[++i]);
+            } else if (args[i] == "--shutdown-timeout" && i + 1 < args.size()) {
+                shutdown_timeout_s = std::stoul(args[++i]);
+            } else if (args[i] == "--replicaof" && i + 2 < args.size()) {
+                primary_host = args[++i];
+                primary_port = static_cast<uint16_t>(std::stoul(args[++i]));
+            } else {
+                std::cerr << "Usage: " << argv[0] << " [--config FILE] [--workers N] [--shards N] [--shared-nothing] [--cpus LIST] [--numa]"
+                          << " [--io-uring] [--aof] [--aof-fsync always|interval|os] [--aof-fsync-ms N]"
+                          << " [--maxmemory BYTES] [--maxmemory-policy noeviction|allkeys-lru|allkeys-lfu]"
+                          << " [--metrics-port PORT] [--port PORT] [--replication-port PORT]"
+                          << " [--repl-backlog-size BYTES] [--replicaof HOST REPLICATION_PORT]"
+                          << " [--cluster-config FILE] [--timeout SECONDS] [--balance reuseport|cpu|least-loaded]"
+                          << " [--hotkey-cache ENTRIES] [--compress-threshold BYTES] [--save SECONDS]"
+                          << " [--shutdown-timeout SECONDS]"
+                          << std::endl;
+                return 1;
+            }
+        }
+        if (!primary_host.empty() && (aof_enabled || replication_port)) {
+            throw std::invalid_argument("--replicaof cannot be combined with --aof or --replication-port");
+        }
+
+        const std::vector<int> listeners = HotRestart::inheritedListeners();
+        const bool handed_over = HotRestart::inheritedDataset() != -1;
+        KVStore store(num_shards, !aof_enabled && !handed_over);
+        if (handed_over) HotRestart::loadDataset(store);
+        store.setCompression(compress_threshold);
+        std::unique_ptr<AppendOnlyLog> aof;
+        if (aof_enabled) {
+            aof = std::make_unique<AppendOnlyLog>("kvstore.aof", fsync_policy,
+                                                  std::chrono::milliseconds(fsync_ms), store.shardCount());
+            // A handed-over dataset is what the log describes: the previous process flushed it last.
+            aof->recover(store, !handed_over);
+            aof->start();
+        }
+        // Set after loading so a dataset that no longer fits is trimmed by writes, not on startup.
+        store.setMaxMemory(max_memory, eviction_policy);
+
+        std::unique_ptr<ReplicationPrimary> primary;
+        std::unique_ptr<ReplicaClient> replica;
+        auto openPrimary = [&] {
+            primary = std::make_unique<ReplicationPrimary>(store, aof.get(), replication_port, repl_backlog_size,
+                                                           store.shardCount());
+            store.setMutationLog(primary.get());
+        };
+        if (replication_port) {
+            openPrimary();
+        } else if (!primary_host.empty()) {
+            replica = std::make_unique<ReplicaClient>(store, primary_host, primary_port);
+        }
+
+        std::unique_ptr<Cluster> cluster;
+        if (!cluster_config.empty()) cluster = std::make_unique<Cluster>(store, cluster_config);
+
         RedisProtocolHandler dbHandler(store);
-        AsyncServer server(9001);
-        
-        server.setRequestHandler([&dbHandler](const std::string& request) {
-            return dbHandler.handle_request(request);
+        dbHandler.set_read_only(replica != nullptr);
+        dbHandler.set_cluster(cluster.get());
+        dbHandler.set_hot_key_cache(hot_key_cache);
+        AsyncServer server(port, num_workers, cpus, backend, listeners);
+        server.setBalance(balance);
+        server.setIdleTimeout(std::chrono::seconds(idle_timeout_s));
+        ShardRouter router(store, dbHandler, server);
+
+        ServerInfo info;
+        InfoRates rates;
+        addInfoSections(info, store, server, dbHandler, rates, backend, shared_nothing, aof_enabled, port,
+                        [&primary, &replica](std::string& out) {
+                            if (primary) {
+                                primary->writeInfo(out);
+                            } else if (replica) {
+                                replica->writeInfo(out);
+                            } else {
+                                ServerInfo::field(out, "role", "master");
+                                ServerInfo::field(out, "connected_slaves", uint64_t{0});
+                            }
+                        },
+                        cluster.get());
+        dbHandler.set_info(&info);
+        std::unique_ptr<MetricsExporter> metrics;
+        if (metrics_port) metrics = std::make_unique<MetricsExporter>(metrics_port, info);
+
+        if (numa_local) {
+            // Each worker pulls the shards it owns (see ShardRouter) into its local node.
+            server.setNumaLocal(true);
+            server.setThreadInit([&store, &server](Worker& worker) {
+                for (size_t shard = worker.id(); shard < store.shardCount(); shard += server.workerCount()) {
+                    store.rehomeShard(shard);
+                }
+            });
+        }
+
+        // Active expiry: each worker sweeps the shards it would own under shared-nothing routing.
+        server.setTimer(std::chrono::milliseconds(100), [&store, &server, &dbHandler, &rates](Worker& worker) {
+            if (worker.id() == 0) {
+                store.tick();
+                rates.ops.sample(dbHandler.total_commands());
+                rates.input.sample(sumWorkers(server, &WorkerStats::bytes_in));
+                rates.output.sample(sumWorkers(server, &WorkerStats::bytes_out));
+            }
+            store.expireCycle(worker.id(), server.workerCount());
         });
-        std::cout << "Server starting at " << 9001 << std::endl; 
+
+        server.setRequestHandler(shared_nothing ? RequestHandler::bind(router) : RequestHandler::bind(dbHandler));
+        std::cout << "Server starting at " << port << std::endl; 
         server.start();
-        
-        std::thread t1([&store] {
-            while (true) {
-                store.persistToDisk();
-                std::this_thread::sleep_for(std::chrono::seconds(1000));
+        if (metrics) metrics->start();
+        if (primary) primary->start();
+        if (replica) replica->start();
+
+        PersistenceLoop persistence(store, aof.get(), std::chrono::seconds(save_s));
+        if (aof || save_s) persistence.start();
+        HotRestart::notifyReady();
+
+        const auto drain_timeout = std::chrono::seconds(shutdown_timeout_s);
+        int signal = 0;
+        while (sigwait(&signals, &signal) == 0 && signal == SIGUSR2) {
+            // Hot restart: quiesce everything that writes, hand the sockets and the dataset to a new
+            // process, and exit once it serves; on failure, pick up where we left off.
+            std::cout << "Hot restart: handing over to a new process" << std::endl;
+            server.drain(drain_timeout);
+            server.stop();
+            persistence.stop();
+            if (replica) replica->stop();
+            // The new process binds these ports itself, so they are released here.
+            metrics.reset();
+            if (primary) {
+                primary->stop();
+                store.setMutationLog(aof.get());
+                primary.reset();
             }
-        });
-        t1.detach();
+            if (aof) aof->stop();
+
+            bool handed_off = false;
+            try {
+                const int dataset = HotRestart::saveDataset(store);
+                handed_off = HotRestart::spawn(argv, server.listenFds(), dataset,
+                                               std::chrono::milliseconds(HOT_RESTART_READY_TIMEOUT_MS));
+                close(dataset);
+            } catch (const std::exception& e) {
+                std::cerr << "Hot restart: " << e.what() << std::endl;
+            }
+            if (handed_off) {
+                std::cout << "Hot restart: new process is serving, exiting" << std::endl;
+                return 0;
+            }
+
+            std::cerr << "Hot restart failed, resuming" << std::endl;
+            if (aof) aof->start();
+            if (replication_port) {
+                openPrimary();
+                primary->start();
+            }
+            if (metrics_port) {
+                metrics = std::make_unique<MetricsExporter>(metrics_port, info);
+                metrics->start();
+            }
+            if (replica) replica->start();
+            if (aof || save_s) persistence.start();
+            server.resume();
+            server.start();
+        }
 
-        std::cin.get();
-        
+        // Graceful shutdown: answer what is in flight, then persist once more.
+        std::cout << "Shutting down" << std::endl;
+        if (replica) replica->stop();
+        if (metrics) metrics->stop();
+        if (!server.drain(drain_timeout)) {
+            std::cerr << "Shutdown: closing connections still open after " << shutdown_timeout_s << "s" << std::endl;
+        }
         server.stop();
+        if (primary) primary->stop();
+        persistence.stop();
+        if (aof) {
+            aof->stop();
+        } else if (save_s) {
+            store.persistToDisk();
+        }
     } catch (const std::exception& e) {
         std::cerr << "Server error: " << e.what() << std::endl;
         return 1;